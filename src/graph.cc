@@ -18,6 +18,152 @@
 #include "graph.h"
 #include "program.h"
 #include "instruction.h"
+#include "merge.h"
+
+#include <algorithm>
+
+void Frontier::initialize(int total, int lanes_per_warp)
+{
+  log_lanes = 0;
+  while ((1 << log_lanes) < lanes_per_warp)
+    log_lanes++;
+  assert((1 << log_lanes) == lanes_per_warp);
+  total_threads = total;
+  warps.assign((total + lanes_per_warp - 1) >> log_lanes, -1);
+  lanes.clear();
+}
+
+int Frontier::count_lanes(int warp) const
+{
+  return std::min(1 << log_lanes, total_threads - (warp << log_lanes));
+}
+
+int Frontier::expand(int warp)
+{
+  const int value = warps[warp];
+  if (value < -1)
+    return (-2 - value);
+  // Give every lane of the warp its own copy of the position
+  const int offset = lanes.size();
+  lanes.resize(offset + (1 << log_lanes), value);
+  warps[warp] = -2 - offset;
+  return offset;
+}
+
+void Frontier::set(int thread, int value)
+{
+  const int warp = thread >> log_lanes;
+  if (warps[warp] == value)
+    return;
+  if (log_lanes == 0)
+  {
+    warps[warp] = value;
+    return;
+  }
+  const int offset = expand(warp);
+  lanes[offset + (thread & ((1 << log_lanes) - 1))] = value;
+}
+
+void Frontier::update(const Frontier &other, bool latest)
+{
+  assert(warps.size() == other.warps.size());
+  // The common case is that all the warps of both have converged
+  if (lanes.empty() && other.lanes.empty())
+  {
+    if (latest)
+      merge_max(&warps.front(), &other.warps.front(), warps.size());
+    else
+      merge_min(&warps.front(), &other.warps.front(), warps.size());
+    return;
+  }
+  for (unsigned warp = 0; warp < warps.size(); warp++)
+  {
+    const int theirs = other.warps[warp];
+    if (theirs == -1)
+      continue;
+    int &ours = warps[warp];
+    if ((theirs >= 0) && (ours >= -1))
+    {
+      ours = latest ? merge_max(ours, theirs) : merge_min(ours, theirs);
+      continue;
+    }
+    const int offset = expand(warp);
+    const int total_lanes = count_lanes(warp);
+    if (theirs < -1)
+    {
+      const int *values = &other.lanes[-2 - theirs];
+      if (latest)
+        merge_max(&lanes[offset], values, total_lanes);
+      else
+        merge_min(&lanes[offset], values, total_lanes);
+      continue;
+    }
+    for (int lane = 0; lane < total_lanes; lane++)
+    {
+      int &current = lanes[offset + lane];
+      current = latest ? merge_max(current, theirs) 
+                       : merge_min(current, theirs);
+    }
+  }
+}
+
+bool Frontier::subsumes(const Frontier &other, bool latest) const
+{
+  // Whether every position in other is subsumed by one of ours,
+  // later ones for the latest before and earlier for the earliest after
+  assert(warps.size() == other.warps.size());
+  for (unsigned warp = 0; warp < warps.size(); warp++)
+  {
+    const int theirs = other.warps[warp];
+    if (theirs == -1)
+      continue;
+    const int ours = warps[warp];
+    if ((theirs >= 0) && (ours >= -1))
+    {
+      if ((ours == -1) || (latest ? (ours < theirs) : (ours > theirs)))
+        return false;
+      continue;
+    }
+    const int total_lanes = count_lanes(warp);
+    for (int lane = 0; lane < total_lanes; lane++)
+    {
+      const int value = other.get_lane(warp, lane);
+      if (value == -1)
+        continue;
+      const int current = get_lane(warp, lane);
+      if ((current == -1) || (latest ? (current < value) : (current > value)))
+        return false;
+    }
+  }
+  return true;
+}
+
+void Frontier::compress(void)
+{
+  if (lanes.empty())
+    return;
+  // Converge the warps whose lanes all agree again and pack the rest
+  std::vector<int> packed;
+  for (unsigned warp = 0; warp < warps.size(); warp++)
+  {
+    if (warps[warp] >= -1)
+      continue;
+    const int offset = -2 - warps[warp];
+    const int total_lanes = count_lanes(warp);
+    bool converged = true;
+    for (int lane = 1; converged && (lane < total_lanes); lane++)
+      converged = (lanes[offset + lane] == lanes[offset]);
+    if (converged)
+    {
+      warps[warp] = lanes[offset];
+      continue;
+    }
+    warps[warp] = -2 - int(packed.size());
+    packed.insert(packed.end(), lanes.begin() + offset, 
+                  lanes.begin() + offset + (1 << log_lanes));
+  }
+  lanes.swap(packed);
+}
 
 BarrierInstance::BarrierInstance(BarrierDependenceGraph *g,
                                  int n, int gen)
@@ -47,21 +193,21 @@ BarrierInstance& BarrierInstance::operator=(const BarrierInstance &rhs)
 void BarrierInstance::update_waiting_threads(std::set<Thread*> &waiting_threads)
 {
   // Add all the non-arrival participants to the set
-  for (std::vector<WeftBarrier*>::const_iterator it = participants.begin();
-        it != participants.end(); it++)
+  for (std::vector<BarrierParticipant>::const_iterator it = 
+        participants.begin(); it != participants.end(); it++)
   {
-    if ((*it)->is_arrive())
+    if (!it->sync)
       continue;
-    waiting_threads.insert((*it)->thread);
+    waiting_threads.insert(it->thread);
   }
 }
 
 bool BarrierInstance::intersects_with(const std::set<Thread*> &waiting_threads)
 {
-  for (std::vector<WeftBarrier*>::const_iterator it = participants.begin();
-        it != participants.end(); it++)
+  for (std::vector<BarrierParticipant>::const_iterator it = 
+        participants.begin(); it != participants.end(); it++)
   {
-    if (waiting_threads.find((*it)->thread) != waiting_threads.end())
+    if (waiting_threads.find(it->thread) != waiting_threads.end())
       return true;
   }
   return false;
@@ -73,42 +219,43 @@ bool BarrierInstance::happens_after(BarrierInstance *other)
 }
 
 bool BarrierInstance::happens_before(
-                const std::vector<WeftBarrier*> &other_participants)
+                const std::vector<BarrierParticipant> &other_participants)
 {
   // Go through all the other participants and see if we can 
   // find a commong thread
-  for (std::vector<WeftBarrier*>::const_iterator it = 
+  for (std::vector<BarrierParticipant>::const_iterator it = 
         other_participants.begin(); it != other_participants.end(); it++)
   {
-    std::map<Thread*,WeftBarrier*>::const_iterator finder = 
-      syncs_only.find((*it)->thread);
+    std::map<Thread*,int>::const_iterator finder = 
+      syncs_only.find(it->thread);
     if (finder != syncs_only.end())
     {
       // Found a common thread, see if they are both syncs or a
       // sync before an arrive
-      WeftInstruction *ours = finder->second;
-      WeftInstruction *theirs = (*it);
+      int ours = finder->second;
+      int theirs = it->thread_line_number;
       assert(ours != theirs);
       // The only way to get a happens before relationshiop is if
       // their instruction comes after ours
-      if (ours->thread_line_number < theirs->thread_line_number)
+      if (ours < theirs)
         return true;
       else // A little sanity check
-        assert(theirs->is_arrive());
+        assert(!it->sync);
     }
   }
   return false;
 }
 
-void BarrierInstance::add_participant(WeftBarrier *participant, bool sync)
+void BarrierInstance::add_participant(const BarrierParticipant &participant)
 {
   participants.push_back(participant);
-  if (sync)
+  if (participant.sync)
   {
-    assert(syncs_only.find(participant->thread) == syncs_only.end());
-    syncs_only[participant->thread] = participant;
+    assert(syncs_only.find(participant.thread) == syncs_only.end());
+    syncs_only[participant.thread] = participant.thread_line_number;
   }
-  participant->set_instance(this);
+  participant.thread->set_barrier_generation(
+                        participant.thread_line_number, generation);
 }
 
 bool BarrierInstance::has_next(BarrierInstance *other)
@@ -210,13 +357,13 @@ void BarrierInstance::launch_if_ready(Weft *weft, bool forward)
   {
     int remaining = __sync_sub_and_fetch(&pending_incoming, 1);
     if (remaining == 0)
-      weft->enqueue_task(new T(this, weft, true/*forward*/));
+      graph->program->enqueue_task(new T(this, weft, true/*forward*/));
   }
   else
   {
     int remaining = __sync_sub_and_fetch(&pending_outgoing, 1);
     if (remaining == 0)
-      weft->enqueue_task(new T(this, weft, false/*forward*/));
+      graph->program->enqueue_task(new T(this, weft, false/*forward*/));
   }
 }
 
@@ -251,7 +398,14 @@ void BarrierInstance::compute_reachability(Weft *weft, bool forward)
   if (forward)
   {
     // Initialize our vector with our incoming
-    latest_incoming = incoming;
+    latest_incoming.resize(incoming.size(), -1);
+    for (std::vector<BarrierInstance*>::const_iterator it = 
+          incoming.begin(); it != incoming.end(); it++)
+    {
+      if ((*it) == NULL)
+        continue;
+      latest_incoming[(*it)->name] = (*it)->generation;
+    }
     // Then update the incoming based on what all our incoming can reach
     for (std::vector<BarrierInstance*>::const_iterator it = 
           incoming.begin(); it != incoming.end(); it++)
@@ -282,101 +436,74 @@ void BarrierInstance::compute_transitivity(Weft *weft, bool forward)
   // Then do the transitive update
   if (forward)
   {
-    latest_before.resize(graph->program->thread_count(), -1);
-    for (std::vector<WeftBarrier*>::const_iterator it = 
+    latest_before.initialize(graph->program->thread_count(), 
+                             graph->frontier_lanes);
+    for (std::vector<BarrierParticipant>::const_iterator it = 
           participants.begin(); it != participants.end(); it++)
     {
-      latest_before[(*it)->thread->thread_id] = (*it)->thread_line_number;
+      latest_before.set(it->thread->thread_id, it->thread_line_number);
     }
     // Now check all our latest incoming barriers for transitive cases
-    for (std::vector<BarrierInstance*>::const_iterator it = 
-          latest_incoming.begin(); it != latest_incoming.end(); it++)
+    for (unsigned idx = 0; idx < latest_incoming.size(); idx++)
     {
-      if ((*it) == NULL)
+      if (latest_incoming[idx] == -1)
         continue;
-      (*it)->update_latest_before(latest_before);
+      graph->get_instance(idx, latest_incoming[idx])->
+        update_latest_before(latest_before);
     }
+    latest_before.compress();
   }
   else
   {
-    earliest_after.resize(graph->program->thread_count(), -1);
-    for (std::vector<WeftBarrier*>::const_iterator it = 
+    earliest_after.initialize(graph->program->thread_count(),
+                              graph->frontier_lanes);
+    for (std::vector<BarrierParticipant>::const_iterator it = 
           participants.begin(); it != participants.end(); it++)
     {
       // We can't count arrives as providing a happens-after relationship
-      if ((*it)->is_arrive())
+      if (!it->sync)
         continue;
-      earliest_after[(*it)->thread->thread_id] = (*it)->thread_line_number;
+      earliest_after.set(it->thread->thread_id, it->thread_line_number);
     }
     // Now check all our earliest before barriers for transitive cases
-    for (std::vector<BarrierInstance*>::const_iterator it = 
-          earliest_outgoing.begin(); it != earliest_outgoing.end(); it++)
+    for (unsigned idx = 0; idx < earliest_outgoing.size(); idx++)
     {
-      (*it)->update_earliest_after(earliest_after);
+      if (earliest_outgoing[idx] == -1)
+        continue;
+      graph->get_instance(idx, earliest_outgoing[idx])->
+        update_earliest_after(earliest_after);
     }
+    earliest_after.compress();
   }
   // Then update all our dependences
   notify_dependences<TransitiveTask>(weft, forward);
 }
 
-void BarrierInstance::update_latest_incoming(
-                              std::vector<BarrierInstance*> &other)
+void BarrierInstance::update_latest_incoming(std::vector<int> &other)
 {
-  unsigned idx = 0;
-  for (std::vector<BarrierInstance*>::const_iterator it = 
-        latest_incoming.begin(); it != latest_incoming.end(); it++, idx++)
-  {
-    if ((*it) == NULL)
-      continue;
-    BarrierInstance *bar = other[idx];
-    // If we have no previous barrier or we have a later generation
-    // of the same named barrier then we use that
-    if ((bar == NULL) || ((*it)->generation > bar->generation))
-      other[idx] = (*it);
-  }
+  // A later generation of the same named barrier is a later instance
+  assert(other.size() >= latest_incoming.size());
+  if (!latest_incoming.empty())
+    merge_max(&other.front(), &latest_incoming.front(), 
+              latest_incoming.size());
 }
 
-void BarrierInstance::update_earliest_outgoing(
-                              std::vector<BarrierInstance*> &other)
+void BarrierInstance::update_earliest_outgoing(std::vector<int> &other)
 {
-  unsigned idx = 0;
-  for (std::vector<BarrierInstance*>::const_iterator it = 
-        earliest_outgoing.begin(); it != earliest_outgoing.end(); it++, idx++)
-  {
-    if ((*it) == NULL)
-      continue;
-    BarrierInstance *bar = other[idx];
-    if ((bar == NULL) || ((*it)->generation < bar->generation))
-      other[idx] = (*it);
-  }
+  assert(other.size() >= earliest_outgoing.size());
+  if (!earliest_outgoing.empty())
+    merge_min(&other.front(), &earliest_outgoing.front(),
+              earliest_outgoing.size());
 }
 
-void BarrierInstance::update_latest_before(std::vector<int> &other)
+void BarrierInstance::update_latest_before(Frontier &other)
 {
-  unsigned idx = 0;
-  for (std::vector<int>::const_iterator it = latest_before.begin();
-        it != latest_before.end(); it++, idx++)
-  {
-    if ((*it) == -1)
-      continue;
-    int latest = other[idx];
-    if ((latest == -1) || ((*it) > latest))
-      other[idx] = (*it);
-  }
+  other.update(latest_before, true/*latest*/);
 }
 
-void BarrierInstance::update_earliest_after(std::vector<int> &other)
+void BarrierInstance::update_earliest_after(Frontier &other)
 {
-  unsigned idx = 0;
-  for (std::vector<int>::const_iterator it = earliest_after.begin();
-        it != earliest_after.end(); it++, idx++)
-  {
-    if ((*it) == -1)
-      continue;
-    int earliest = other[idx];
-    if ((earliest == -1) || ((*it) < earliest))
-      other[idx] = (*it);
-  }
+  other.update(earliest_after, false/*latest*/);
 }
 
 void BarrierInstance::traverse_forward(std::deque<BarrierInstance*> &queue,
@@ -439,15 +566,17 @@ void BarrierDependenceGraph::PreceedingBarriers::add_instance(
 }
 
 BarrierDependenceGraph::BarrierDependenceGraph(Weft *w, Program *p)
-  : weft(w), program(p), max_num_barriers(p->barrier_upper_bound())
+  : weft(w), program(p), max_num_barriers(p->barrier_upper_bound()),
+    frontier_lanes(w->track_warp_frontiers() ? WARP_SIZE : 1)
 {
   barrier_instances.resize(max_num_barriers);
   PTHREAD_SAFE_CALL( pthread_mutex_init(&validation_mutex, NULL) );
+  PTHREAD_SAFE_CALL( pthread_mutex_init(&merge_mutex, NULL) );
 }
 
 BarrierDependenceGraph::BarrierDependenceGraph(
                         const BarrierDependenceGraph &rhs)
-  : weft(NULL), program(NULL), max_num_barriers(0)
+  : weft(NULL), program(NULL), max_num_barriers(0), frontier_lanes(0)
 {
   assert(false);
 }
@@ -462,6 +591,7 @@ BarrierDependenceGraph::~BarrierDependenceGraph(void)
   }
   all_barriers.clear();
   PTHREAD_SAFE_CALL( pthread_mutex_destroy(&validation_mutex) );
+  PTHREAD_SAFE_CALL( pthread_mutex_destroy(&merge_mutex) );
 }
 
 BarrierDependenceGraph& BarrierDependenceGraph::operator=(
@@ -474,19 +604,23 @@ BarrierDependenceGraph& BarrierDependenceGraph::operator=(
 void BarrierDependenceGraph::construct_graph(
                             const std::vector<Thread*> &threads)
 {
-  std::vector<int> program_counters(threads.size(), 0); 
-  std::vector<PendingState> pending_arrives(max_num_barriers);
-  std::vector<PreceedingBarriers> preceeding_barriers(max_num_barriers);
+  FILE *out = program->out;
+  ConstructionState state(threads.size(), max_num_barriers);
+  for (unsigned idx = 0; idx < threads.size(); idx++)
+  {
+    if (threads[idx]->get_program_size() == 0)
+      continue;
+    state.active_threads++;
+    update_top(idx, state, threads);
+  }
   bool has_deadlock = false;
   while (true)
   {
-    if (remove_complete_barriers(program_counters, pending_arrives,
-                             preceeding_barriers, threads))
+    if (remove_complete_barriers(state, threads))
       continue;
-    if (are_empty(program_counters, threads))
+    if (state.active_threads == 0)
       break;
-    else if (!advance_program_counters(program_counters, 
-                                       pending_arrives, threads))
+    else if (!advance_program_counters(state, threads))
     {
       has_deadlock = true;
       break;
@@ -500,8 +634,8 @@ void BarrierDependenceGraph::construct_graph(
       snprintf(buffer, 1023, "DEADLOCK DETECTED IN KERNEL %s! "
                       "(thread and barrier state reported above)",
                       program->get_name());
-      report_state(program_counters, threads, pending_arrives);
-      weft->report_error(WEFT_ERROR_DEADLOCK, buffer);
+      report_state(state.program_counters, threads, state.pending_arrives);
+      weft->report_error(WEFT_ERROR_DEADLOCK, buffer, program);
     }
     else
     {
@@ -509,14 +643,14 @@ void BarrierDependenceGraph::construct_graph(
       snprintf(buffer, 1023, "DEADLOCK DETECTED IN KERNEL %s! "
           "(run in detailed mode with '-d' to see thread and barrier state)",
           program->get_name());
-      weft->report_error(WEFT_ERROR_DEADLOCK, buffer);
+      weft->report_error(WEFT_ERROR_DEADLOCK, buffer, program);
     }
   }
   else
-    fprintf(stdout,"WEFT INFO: No deadlocks detected in kernel %s!\n",
+    fprintf(out,"WEFT INFO: No deadlocks detected in kernel %s!\n",
             program->get_name());
   if (weft->print_verbose())
-    fprintf(stdout,"WEFT INFO: Total barrier instances in kernel %s: %ld\n",
+    fprintf(out,"WEFT INFO: Total barrier instances in kernel %s: %ld\n",
             program->get_name(), all_barriers.size());
 }
 
@@ -545,34 +679,36 @@ void BarrierDependenceGraph::enqueue_validation_tasks(void)
     for (unsigned idx = 0; idx < (local.size()-1); idx++)
     {
       ValidationTask *task = new ValidationTask(this, name, idx);
-      weft->enqueue_task(task);
+      program->enqueue_task(task);
     }
   }
 }
 
 void BarrierDependenceGraph::check_for_validation_errors(void)
 {
+  FILE *out = program->out;
+  FILE *err = program->err;
   // No need to hold the lock here since we are done with the
   // threadpool when we invokee this method
   if (!failed_validations.empty())
   {
-    fprintf(stderr, "WEFT INFO: BARRIERS NOT PROPERLY RECYCLED "
-                    "IN KERNEL %s!\n", program->get_name());
+    fprintf(err,"WEFT INFO: BARRIERS NOT PROPERLY RECYCLED "
+                "IN KERNEL %s!\n", program->get_name());
     for (std::vector<std::pair<int,int> >::const_iterator it = 
           failed_validations.begin(); it != failed_validations.end(); it++)
     {
-      fprintf(stderr,"  Unable to find happens-before relationship between "
-                     "generations %d and %d of named barrier %d in kernel %s\n",
-                     it->second, it->second+1, it->first, program->get_name());
+      fprintf(err,"  Unable to find happens-before relationship between "
+                  "generations %d and %d of named barrier %d in kernel %s\n",
+                  it->second, it->second+1, it->first, program->get_name());
     }
     char buffer[1024];
     snprintf(buffer, 1023, "Unable to find happens before relationships for %ld "
                            "different named barrier generations in kernel %s",
                            failed_validations.size(), program->get_name());
-    weft->report_error(WEFT_ERROR_GRAPH_VALIDATION, buffer);
+    weft->report_error(WEFT_ERROR_GRAPH_VALIDATION, buffer, program);
   }
   else
-    fprintf(stdout,"WEFT INFO: Barriers properly recycled in kernel %s!\n",
+    fprintf(out,"WEFT INFO: Barriers properly recycled in kernel %s!\n",
             program->get_name());
 }
 
@@ -631,6 +767,40 @@ void BarrierDependenceGraph::enqueue_transitive_happens_tasks(void)
   }
 }
 
+const Frontier* BarrierDependenceGraph::merge_latest_before(
+                              const std::vector<BarrierInstance*> &barriers)
+{
+  PTHREAD_SAFE_CALL( pthread_mutex_lock(&merge_mutex) );
+  Frontier &merged = merged_before[barriers];
+  if (merged.empty())
+  {
+    merged.initialize(program->thread_count(), frontier_lanes);
+    for (std::vector<BarrierInstance*>::const_iterator it = 
+          barriers.begin(); it != barriers.end(); it++)
+      (*it)->update_latest_before(merged);
+    merged.compress();
+  }
+  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&merge_mutex) );
+  return &merged;
+}
+
+const Frontier* BarrierDependenceGraph::merge_earliest_after(
+                              const std::vector<BarrierInstance*> &barriers)
+{
+  PTHREAD_SAFE_CALL( pthread_mutex_lock(&merge_mutex) );
+  Frontier &merged = merged_after[barriers];
+  if (merged.empty())
+  {
+    merged.initialize(program->thread_count(), frontier_lanes);
+    for (std::vector<BarrierInstance*>::const_iterator it = 
+          barriers.begin(); it != barriers.end(); it++)
+      (*it)->update_earliest_after(merged);
+    merged.compress();
+  }
+  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&merge_mutex) );
+  return &merged;
+}
+
 void BarrierDependenceGraph::initialize_pending_counts(void)
 {
   for (std::deque<BarrierInstance*>::const_iterator it = 
@@ -640,203 +810,290 @@ void BarrierDependenceGraph::initialize_pending_counts(void)
   }
 }
 
-bool BarrierDependenceGraph::remove_complete_barriers(
-                                std::vector<int> &program_counters,
-                                std::vector<PendingState> &pending_arrives,
-                                std::vector<PreceedingBarriers> &preceeding,
-                                const std::vector<Thread*> &threads)
+void BarrierDependenceGraph::update_top(int idx, ConstructionState &state,
+                                        const std::vector<Thread*> &threads)
 {
-  bool removed_barrier = false;
-  std::vector<int> barrier_expected(max_num_barriers, -1);
-  std::vector<int> barrier_participants(max_num_barriers, -1);
-  std::vector<bool> all_arrives(max_num_barriers, true);
-  // Initialize the pending state for all barriers
-  for (int name = 0; name < max_num_barriers; name++)
+  const int line = state.program_counters[idx];
+  const WeftInstruction *inst = threads[idx]->get_instruction(line);
+  if (inst == NULL)
   {
-    PendingState &state = pending_arrives[name];
-    if (state.expected <= 0)
-      continue;
-    barrier_expected[name] = state.expected;
-    barrier_participants[name] = state.arrivals.size();
+    state.active_threads--;
+    return;
   }
-  // Scan across all the threads and see if we can find any complete
-  // barriers, if so pop them off the stack and advance program counters
-  int idx = 0;
-  for (std::vector<Thread*>::const_iterator it = threads.begin();
-        it != threads.end(); it++, idx++)
+  if (!inst->is_sync())
+    state.runnable_threads.push_back(idx);
+  if (!inst->is_barrier())
+    return;
+  const int name = inst->get_name();
+  assert((name >= 0) && (name < max_num_barriers));
+  WaitingThreads &waiting = state.waiting[name];
+  waiting.threads.push_back(std::pair<int,int>(idx, line));
+  waiting.total++;
+  if (inst->is_sync())
+    waiting.syncs++;
+  waiting.add_count(inst->get_count());
+  mark_changed(name, state);
+}
+
+void BarrierDependenceGraph::mark_changed(int name, ConstructionState &state)
+{
+  WaitingThreads &waiting = state.waiting[name];
+  if (waiting.changed)
+    return;
+  waiting.changed = true;
+  state.changed_names.push_back(name);
+}
+
+bool BarrierDependenceGraph::remove_complete_barriers(
+                                ConstructionState &state,
+                                const std::vector<Thread*> &threads)
+{
+  if (state.changed_names.empty())
+    return false;
+  // Only barriers whose waiting threads or arrivals changed since the
+  // last time we looked can have become complete, we look at all of 
+  // them as they are now before removing any of them
+  std::vector<int> names;
+  names.swap(state.changed_names);
+  std::sort(names.begin(), names.end());
+  std::vector<int> barrier_expected(names.size(), -1);
+  std::vector<int> barrier_participants(names.size(), -1);
+  std::vector<bool> all_arrives(names.size(), true);
+  bool check_counts = false;
+  for (unsigned idx = 0; idx < names.size(); idx++)
   {
-    WeftInstruction *inst = (*it)->get_instruction(program_counters[idx]);
-    // If we're done we can skip this thread
-    if (inst == NULL)
+    const int name = names[idx];
+    WaitingThreads &waiting = state.waiting[name];
+    waiting.changed = false;
+    if (waiting.min_count != waiting.max_count)
+      check_counts = true;
+    const PendingState &pending = state.pending_arrives[name];
+    if (pending.expected > 0)
+    {
+      barrier_expected[idx] = pending.expected;
+      barrier_participants[idx] = pending.arrivals.size();
+    }
+    if (waiting.syncs > 0)
+      all_arrives[idx] = false;
+    if (waiting.total == 0)
       continue;
-    // Check to see if a barrier is at the top
-    if (inst->is_barrier())
+    if (barrier_expected[idx] == -1)
     {
-      WeftBarrier *bar = inst->as_barrier(); 
-      int name = bar->name;
-      assert((name >= 0) && (name < max_num_barriers));
-      // See if we've seen this barrier ID before
-      if (barrier_expected[name] == -1)
+      // Any of the waiting threads can tell us the count
+      for (std::vector<std::pair<int,int> >::const_iterator it = 
+            waiting.threads.begin(); it != waiting.threads.end(); it++)
       {
-        // If not, set up the pending arrivals
-        assert(barrier_participants[name] == -1);
-        barrier_expected[name] = bar->count;
-        barrier_participants[name] = 1;
-      }
-      else
-      {
-        // Otherwise, update the pending counts
-        if (barrier_expected[name] != bar->count)
-        {
-          char buffer[1024];
-          snprintf(buffer, 1023, "Different arrival counts of %d and %d "
-                                 "possible on barrier %d in kernel %s",
-                                 barrier_expected[name], bar->count, 
-                                 name, program->get_name());
-          weft->report_error(WEFT_ERROR_ARRIVAL_MISMATCH, buffer);
-        }
-        barrier_participants[name]++;
+        if (state.program_counters[it->first] != it->second)
+          continue;
+        barrier_expected[idx] = 
+          threads[it->first]->get_instruction(it->second)->get_count();
+        break;
       }
-      if (bar->is_sync())
-        all_arrives[name] = false;
+      barrier_participants[idx] = 0;
     }
+    barrier_participants[idx] += waiting.total;
   }
+  // The counts for a barrier might differ so find the first
+  // thread that has a different count than the others
+  if (check_counts)
+    check_arrival_counts(state, threads);
   // Now let's see which barriers are complete
-  for (int name = 0; name < max_num_barriers; name++)
+  bool removed_barrier = false;
+  for (unsigned idx = 0; idx < names.size(); idx++)
   {
-    if (barrier_expected[name] == -1)
+    if (barrier_expected[idx] == -1)
       continue;
-    if (barrier_participants[name] > barrier_expected[name])
+    const int name = names[idx];
+    if (barrier_participants[idx] > barrier_expected[idx])
     {
       char buffer[1024];
       snprintf(buffer, 1023, "Too many participants (%d) for barrier %d while "
                              "expecting only %d participants in kernel %s", 
-                             barrier_participants[name], name,
-                             barrier_expected[name], program->get_name());
-      weft->report_error(WEFT_ERROR_TOO_MANY_PARTICIPANTS, buffer);
+                             barrier_participants[idx], name,
+                             barrier_expected[idx], program->get_name());
+      weft->report_error(WEFT_ERROR_TOO_MANY_PARTICIPANTS, buffer, program);
     }
-    if (barrier_participants[name] == barrier_expected[name])
+    if (barrier_participants[idx] != barrier_expected[idx])
+      continue;
+    if (all_arrives[idx])
     {
-      if (all_arrives[name])
-      {
-        char buffer[1024];
-        snprintf(buffer, 1023, "All arrivals on barrier %d possible in kernel %s", 
-                                name, program->get_name());
-        weft->report_error(WEFT_ERROR_ALL_ARRIVALS, buffer);
-      }
-      // Mark that we removed a barrier
-      removed_barrier = true;
-      // We have a complete barrier so let's pop everything off the stacks
-      PendingState &state = pending_arrives[name];
-      // Create a new barrier instance
-      BarrierInstance *bar_inst = 
-                        new BarrierInstance(this, name, state.generation);
-      barrier_instances[name].push_back(bar_inst);
-      all_barriers.push_back(bar_inst);
-      idx = 0;
-      for (std::vector<Thread*>::const_iterator it = threads.begin();
-            it != threads.end(); it++, idx++)
-      {
-        WeftInstruction *inst = (*it)->get_instruction(program_counters[idx]);
-        if (inst == NULL)
-          continue;
-        if (!inst->is_barrier())
-          continue;
-        WeftBarrier *bar = inst->as_barrier();  
-        if (bar->name != name)
-          continue;
-        bar_inst->add_participant(bar, bar->is_sync());
-        // We can advance the counter since we handled the instruction
-        program_counters[idx]++;
-      }
-      // Also handle the pending arrivals
-      if (state.expected != -1)
+      char buffer[1024];
+      snprintf(buffer, 1023, "All arrivals on barrier %d possible in kernel %s", 
+                              name, program->get_name());
+      weft->report_error(WEFT_ERROR_ALL_ARRIVALS, buffer, program);
+    }
+    // Mark that we removed a barrier
+    removed_barrier = true;
+    // We have a complete barrier so let's pop everything off the stacks
+    PendingState &pending = state.pending_arrives[name];
+    // Create a new barrier instance
+    BarrierInstance *bar_inst = 
+                      new BarrierInstance(this, name, pending.generation);
+    barrier_instances[name].push_back(bar_inst);
+    all_barriers.push_back(bar_inst);
+    // Threads join the barrier in order, the ones still waiting
+    // on it are at the top of their traces
+    WaitingThreads &waiting = state.waiting[name];
+    std::vector<std::pair<int,int> > participants;
+    participants.swap(waiting.threads);
+    waiting.reset();
+    std::sort(participants.begin(), participants.end());
+    for (std::vector<std::pair<int,int> >::const_iterator it = 
+          participants.begin(); it != participants.end(); it++)
+    {
+      if (state.program_counters[it->first] != it->second)
+        continue;
+      const WeftInstruction *inst = 
+        threads[it->first]->get_instruction(it->second);
+      bar_inst->add_participant(
+          BarrierParticipant(threads[it->first], it->second, inst->is_sync()));
+      // We can advance the counter since we handled the instruction
+      state.program_counters[it->first]++;
+      update_top(it->first, state, threads);
+    }
+    // Also handle the pending arrivals
+    if (pending.expected != -1)
+    {
+      for (std::vector<BarrierParticipant>::const_iterator it = 
+            pending.arrivals.begin(); it != pending.arrivals.end(); it++)
       {
-        for (std::set<BarrierArrive*>::const_iterator it = 
-              state.arrivals.begin(); it != state.arrivals.end(); it++)
-        {
-          bar_inst->add_participant(*it, false/*sync*/);
-        }
+        bar_inst->add_participant(*it);
       }
-      // Reet the state
-      state.reset();
-      // If we made a new barrier, then find all the immediately
-      // preceeding instances of barriers on which this barrier
-      // is guaranteed to have a happens-before relationship
-      for (idx = 0; idx < max_num_barriers; idx++)
-        preceeding[idx].find_preceeding(bar_inst);
-      // Add this barrier to the preceeding instances for the given name
-      preceeding[name].add_instance(bar_inst);
     }
+    // Reet the state
+    pending.reset();
+    // If we made a new barrier, then find all the immediately
+    // preceeding instances of barriers on which this barrier
+    // is guaranteed to have a happens-before relationship
+    for (int other = 0; other < max_num_barriers; other++)
+      state.preceeding[other].find_preceeding(bar_inst);
+    // Add this barrier to the preceeding instances for the given name
+    state.preceeding[name].add_instance(bar_inst);
   }
   return removed_barrier;
 }
 
-bool BarrierDependenceGraph::are_empty(const std::vector<int> &program_counters,
-                                       const std::vector<Thread*> &threads)
+void BarrierDependenceGraph::check_arrival_counts(
+                                const ConstructionState &state,
+                                const std::vector<Thread*> &threads)
 {
-  for (unsigned idx = 0; idx < threads.size(); idx++)
+  std::vector<int> barrier_expected(max_num_barriers, -1);
+  for (int name = 0; name < max_num_barriers; name++)
   {
-    size_t size = threads[idx]->get_program_size();
-    assert(unsigned(program_counters[idx]) <= size);
-    if (unsigned(program_counters[idx]) < size)
-      return false;
+    const PendingState &pending = state.pending_arrives[name];
+    if (pending.expected > 0)
+      barrier_expected[name] = pending.expected;
+  }
+  // Scan across all the threads in order for one that is waiting
+  // on a barrier with a different count than the ones before it
+  int idx = 0;
+  for (std::vector<Thread*>::const_iterator it = threads.begin();
+        it != threads.end(); it++, idx++)
+  {
+    const WeftInstruction *inst = 
+      (*it)->get_instruction(state.program_counters[idx]);
+    if ((inst == NULL) || !inst->is_barrier())
+      continue;
+    const int name = inst->get_name();
+    if (barrier_expected[name] == -1)
+      barrier_expected[name] = inst->get_count();
+    else if (barrier_expected[name] != inst->get_count())
+    {
+      char buffer[1024];
+      snprintf(buffer, 1023, "Different arrival counts of %d and %d "
+                             "possible on barrier %d in kernel %s",
+                             barrier_expected[name], inst->get_count(), 
+                             name, program->get_name());
+      weft->report_error(WEFT_ERROR_ARRIVAL_MISMATCH, buffer, program);
+    }
   }
-  return true;
 }
 
 bool BarrierDependenceGraph::advance_program_counters(
-                                std::vector<int> &program_counters,
-                                std::vector<PendingState> &pending_arrives,
+                                ConstructionState &state,
                                 const std::vector<Thread*> &threads)
 {
-  bool found = false;
-  unsigned idx = 0;
-  for (std::vector<Thread*>::const_iterator it = threads.begin();
-        it != threads.end(); it++, idx++)
+  // Only threads that are not blocked on a sync barrier can advance,
+  // the ones that have since moved on to a sync barrier or exited can't
+  std::vector<int> runnable;
+  runnable.swap(state.runnable_threads);
+  std::sort(runnable.begin(), runnable.end());
+  runnable.erase(std::unique(runnable.begin(), runnable.end()), 
+                 runnable.end());
+  unsigned total_runnable = 0;
+  for (unsigned idx = 0; idx < runnable.size(); idx++)
   {
-    if (unsigned(program_counters[idx]) == (*it)->get_program_size())
+    const WeftInstruction *inst = 
+      threads[runnable[idx]]->get_instruction(
+          state.program_counters[runnable[idx]]);
+    if ((inst == NULL) || inst->is_sync())
       continue;
-    WeftInstruction *inst = (*it)->get_instruction(program_counters[idx]);
-    while (!inst->is_barrier() || inst->is_arrive())
+    runnable[total_runnable++] = runnable[idx];
+  }
+  if (total_runnable == 0)
+    return false;
+  runnable.resize(total_runnable);
+  // Walk the threads in parallel until they block on a sync barrier
+  if (state.arrive_lines.size() < total_runnable)
+    state.arrive_lines.resize(total_runnable);
+  state.stop_lines.resize(total_runnable);
+  AdvanceThreads advance(&threads.front(), &runnable.front(),
+                         &state.program_counters.front(), 
+                         &state.stop_lines.front(), 
+                         &state.arrive_lines.front());
+  weft->parallel_for(program, &advance, 0, total_runnable, MIN_ADVANCE_CHUNK);
+  // Then apply the arrivals in thread order so the pending arrivals
+  // and any errors are the same as if we had walked them in order
+  for (unsigned idx = 0; idx < total_runnable; idx++)
+  {
+    const int thread_idx = runnable[idx];
+    Thread *thread = threads[thread_idx];
+    int &line = state.program_counters[thread_idx];
+    // An arrive at the top no longer waits on its barrier once we
+    // move it into the pending arrivals below
+    const WeftInstruction *top = thread->get_instruction(line);
+    if (top->is_arrive())
+      state.waiting[top->get_name()].total--;
+    std::vector<int> &arrives = state.arrive_lines[idx];
+    for (std::vector<int>::const_iterator it = 
+          arrives.begin(); it != arrives.end(); it++)
     {
-      if (inst->is_arrive())
+      // Pop the arrival off and put in the pending arrive data structure
+      const WeftInstruction *inst = thread->get_instruction(*it);
+      const int name = inst->get_name();
+      assert((name >= 0) && (name < max_num_barriers));
+      PendingState &pending = state.pending_arrives[name];
+      if (pending.expected == -1)
+        pending.expected = inst->get_count();
+      else if (pending.expected != inst->get_count())
       {
-        // If it is an arrival, pop it off and put in the
-        // pending arrive data structure
-        BarrierArrive *arrive = inst->as_arrive();
-        assert((arrive->name >= 0) && (arrive->name < max_num_barriers));
-        PendingState &state = pending_arrives[arrive->name];
-        if (state.expected == -1)
-          state.expected = arrive->count;
-        else if (state.expected != arrive->count)
-        {
-          char buffer[1024];
-          snprintf(buffer, 1023, "Different arrival counts of %d and %d "
-                                 "possible on barrier %d in kernel %s",
-                                 state.expected, arrive->count, 
-                                 arrive->name, program->get_name());
-          weft->report_error(WEFT_ERROR_ARRIVAL_MISMATCH, buffer);
-        }
-        state.arrivals.insert(arrive);
-        if (unsigned(state.expected) == state.arrivals.size())
-        {
-          char buffer[1024];
-          snprintf(buffer, 1023, "All arrivals on barrier %d possible in kernel %s",
-                                  arrive->name, program->get_name());
-          weft->report_error(WEFT_ERROR_ALL_ARRIVALS, buffer);
-        }
+        char buffer[1024];
+        snprintf(buffer, 1023, "Different arrival counts of %d and %d "
+                               "possible on barrier %d in kernel %s",
+                               pending.expected, inst->get_count(), 
+                               name, program->get_name());
+        weft->report_error(WEFT_ERROR_ARRIVAL_MISMATCH, buffer, program);
       }
-      // Otherwise it is a shared memory access so we can
-      // safely ignore it for now
-      found = true;
-      program_counters[idx]++;
-      inst = (*it)->get_instruction(program_counters[idx]);
-      if (inst == NULL)
-        break;
+      pending.arrivals.push_back(
+          BarrierParticipant(thread, *it, false/*sync*/));
+      if (unsigned(pending.expected) == pending.arrivals.size())
+      {
+        char buffer[1024];
+        snprintf(buffer, 1023, "All arrivals on barrier %d possible in kernel %s",
+                                name, program->get_name());
+        weft->report_error(WEFT_ERROR_ALL_ARRIVALS, buffer, program);
+      }
+      if (pending.expected > 0)
+        state.waiting[name].add_count(pending.expected);
+      mark_changed(name, state);
     }
+    arrives.clear();
+    line = state.stop_lines[idx];
+    // Now either exited or blocked on a sync barrier
+    update_top(thread_idx, state, threads);
   }
-  return found;
+  // Every runnable thread moved at least one instruction
+  return true;
 }
 
 void BarrierDependenceGraph::report_state(
@@ -844,41 +1101,70 @@ void BarrierDependenceGraph::report_state(
                                 const std::vector<Thread*> &threads, 
                                 const std::vector<PendingState> &pending_arrives)
 {
+  FILE *err = program->err;
   unsigned idx = 0;
   for (std::vector<Thread*>::const_iterator it = threads.begin(); 
         it != threads.end(); it++, idx++)
   {
-    WeftInstruction *inst = (*it)->get_instruction(program_counters[idx]); 
+    const WeftInstruction *inst = (*it)->get_instruction(program_counters[idx]); 
     if (inst != NULL)
     {
       assert(inst->is_sync());
-      BarrierSync *sync = inst->as_sync();
-      if (sync->instruction->source_file == NULL)
-        fprintf(stderr,"  Thread %d: Blocked on barrier %d (PTX line %d)\n", 
-                        idx, sync->name, sync->instruction->line_number);
+      PTXInstruction *sync = 
+        program->get_instruction(inst->get_program_counter());
+      if (sync->source_file == NULL)
+        fprintf(err,"  Thread %d: Blocked on barrier %d (PTX line %d)\n", 
+                     idx, inst->get_name(), sync->line_number);
       else
-        fprintf(stderr,"  Thread %d: Blocked on barrier %d (on line %d of %s)\n",
-                        idx, sync->name, sync->instruction->source_line_number, 
-                        sync->instruction->source_file);
+        fprintf(err,"  Thread %d: Blocked on barrier %d (on line %d of %s)\n",
+                     idx, inst->get_name(), sync->source_line_number, 
+                     sync->source_file);
     }
     else
-      fprintf(stderr,"  Thread %d: Exited\n", idx);
+      fprintf(err,"  Thread %d: Exited\n", idx);
   }
-  fprintf(stderr,"\n");
+  fprintf(err,"\n");
   idx = 0;
   for (std::vector<PendingState>::const_iterator it = pending_arrives.begin();
         it != pending_arrives.end(); it++, idx++)
   {
     if (it->expected > 0)
-      fprintf(stderr,"  Barrier %d (generation %d) has observed "
-                     "%ld arrivals for %d expected participants\n", 
-                     idx, it->generation, it->arrivals.size(), it->expected); 
+      fprintf(err,"  Barrier %d (generation %d) has observed "
+                  "%ld arrivals for %d expected participants\n", 
+                  idx, it->generation, it->arrivals.size(), it->expected); 
     else
-      fprintf(stderr,"  Barrier %d (generation %d) has observed "
-                     "%ld arrivals for an unknown number of participants\n", 
-                     idx, it->generation, it->arrivals.size());
+      fprintf(err,"  Barrier %d (generation %d) has observed "
+                  "%ld arrivals for an unknown number of participants\n", 
+                  idx, it->generation, it->arrivals.size());
+  }
+  fprintf(err,"\n");
+}
+
+AdvanceThreads::AdvanceThreads(Thread *const *t, const int *r, 
+                               const int *pcs, int *stops, 
+                               std::vector<int> *arrives)
+  : ParallelBody(), threads(t), runnable(r), program_counters(pcs), 
+    stop_lines(stops), arrive_lines(arrives)
+{
+}
+
+void AdvanceThreads::execute(int start, int stop)
+{
+  for (int idx = start; idx < stop; idx++)
+  {
+    Thread *thread = threads[runnable[idx]];
+    int line = program_counters[runnable[idx]];
+    const WeftInstruction *inst = thread->get_instruction(line);
+    // Skip over shared memory accesses and remember the arrives
+    // until we reach a sync barrier or the end of the trace
+    while ((inst != NULL) && (!inst->is_barrier() || inst->is_arrive()))
+    {
+      if (inst->is_arrive())
+        arrive_lines[idx].push_back(line);
+      inst = thread->get_instruction(++line);
+    }
+    stop_lines[idx] = line;
   }
-  fprintf(stderr,"\n");
 }
 
 ValidationTask::ValidationTask(BarrierDependenceGraph *g, int n, int gen)
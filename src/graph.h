@@ -25,11 +25,57 @@
 
 class Weft;
 class Thread;
-class WeftBarrier;
-class BarrierArrive;
-class WeftInstruction;
+class Program;
 class BarrierDependenceGraph;
 
+// Positions in the traces of all the threads which are stored once for
+// each warp whose lanes agree and expanded to one position for each lane
+// only for the warps whose lanes diverge on barriers
+class Frontier {
+public:
+  Frontier(void) : log_lanes(0), total_threads(0) { }
+public:
+  void initialize(int total_threads, int lanes_per_warp);
+  inline bool empty(void) const { return warps.empty(); }
+  inline int get(int thread) const
+  {
+    const int value = warps[thread >> log_lanes];
+    if (value >= -1)
+      return value;
+    return lanes[-2 - value + (thread & ((1 << log_lanes) - 1))];
+  }
+  void set(int thread, int value);
+  void update(const Frontier &other, bool latest);
+  bool subsumes(const Frontier &other, bool latest) const;
+  void compress(void);
+protected:
+  int expand(int warp);
+  int count_lanes(int warp) const;
+  inline int get_lane(int warp, int lane) const
+  {
+    const int value = warps[warp];
+    return (value >= -1) ? value : lanes[-2 - value + lane];
+  }
+protected:
+  int log_lanes;
+  int total_threads;
+  // The position of each warp whose lanes agree, otherwise the
+  // offset of the positions of its lanes encoded below -1
+  std::vector<int> warps;
+  std::vector<int> lanes;
+};
+
+// A barrier instruction at a position in the trace of a thread
+struct BarrierParticipant {
+public:
+  BarrierParticipant(Thread *t, int line, bool s)
+    : thread(t), thread_line_number(line), sync(s) { }
+public:
+  Thread *thread;
+  int thread_line_number;
+  bool sync;
+};
+
 class BarrierInstance {
 public:
   BarrierInstance(BarrierDependenceGraph *graph, int name, int generation);
@@ -41,9 +87,10 @@ public:
   void update_waiting_threads(std::set<Thread*> &waiting_threads);
   bool intersects_with(const std::set<Thread*> &waiting_threads);
   bool happens_after(BarrierInstance *other);
-  bool happens_before(const std::vector<WeftBarrier*> &other_participants);
+  bool happens_before(
+      const std::vector<BarrierParticipant> &other_participants);
 public:
-  void add_participant(WeftBarrier *participant, bool sync);
+  void add_participant(const BarrierParticipant &participant);
   bool has_next(BarrierInstance *other);
   bool has_previous(BarrierInstance *other);
   void add_incoming(BarrierInstance *other);
@@ -58,10 +105,14 @@ public:
   void notify_dependences(Weft *weft, bool forward);
   void compute_reachability(Weft *weft, bool forward);
   void compute_transitivity(Weft *weft, bool forward);
-  void update_latest_incoming(std::vector<BarrierInstance*> &other);
-  void update_earliest_outgoing(std::vector<BarrierInstance*> &other);
-  void update_latest_before(std::vector<int> &other);
-  void update_earliest_after(std::vector<int> &other);
+  void update_latest_incoming(std::vector<int> &other);
+  void update_earliest_outgoing(std::vector<int> &other);
+  void update_latest_before(Frontier &other);
+  void update_earliest_after(Frontier &other);
+  inline const Frontier& get_latest_before(void) const
+    { return latest_before; }
+  inline const Frontier& get_earliest_after(void) const
+    { return earliest_after; }
 public:
   void traverse_forward(std::deque<BarrierInstance*> &queue,
                         std::set<BarrierInstance*> &visited);
@@ -70,18 +121,20 @@ public:
   const int name;
   const int generation;
 protected:
-  std::vector<WeftBarrier*> participants;
+  std::vector<BarrierParticipant> participants;
   // Helpful for constructing barrier dependence graph
-  std::map<Thread*,WeftBarrier*> syncs_only;
+  std::map<Thread*,int/*line*/> syncs_only;
 protected:
   std::vector<BarrierInstance*> incoming;
   std::vector<BarrierInstance*> outgoing;
 protected:
-  std::vector<BarrierInstance*> latest_incoming;
-  std::vector<BarrierInstance*> earliest_outgoing;
+  // Generations of the latest and earliest instances of each named
+  // barrier that are reachable from us, -1 if there are none
+  std::vector<int> latest_incoming;
+  std::vector<int> earliest_outgoing;
 protected:
-  std::vector<int> latest_before;
-  std::vector<int> earliest_after;
+  Frontier latest_before;
+  Frontier earliest_after;
 protected:
   int base_incoming;
   int base_outgoing;
@@ -104,7 +157,7 @@ private:
   public:
     int expected;
     int generation;
-    std::set<BarrierArrive*> arrivals;
+    std::vector<BarrierParticipant> arrivals;
   };
   struct PreceedingBarriers {
   public:
@@ -117,6 +170,58 @@ private:
     std::set<Thread*> arrival_threads;
     std::deque<BarrierInstance*> previous;
   };
+  struct WaitingThreads {
+  public:
+    WaitingThreads(void)
+      : total(0), syncs(0), min_count(-1), max_count(-1), changed(false) { }
+  public:
+    inline void reset(void) {
+      threads.clear();
+      total = 0;
+      syncs = 0;
+      min_count = -1;
+      max_count = -1;
+    }
+    inline void add_count(int count) {
+      if ((min_count == -1) || (count < min_count))
+        min_count = count;
+      if ((max_count == -1) || (count > max_count))
+        max_count = count;
+    }
+  public:
+    // Threads that had the barrier at the top of their trace and where,
+    // the ones that have since moved on are skipped when it completes
+    std::vector<std::pair<int/*thread*/,int/*line*/> > threads;
+    int total;
+    int syncs;
+    // Bounds on the arrival counts seen since the barrier last completed
+    int min_count;
+    int max_count;
+    bool changed;
+  };
+  // Where all the threads are while constructing the graph so that
+  // each step only looks at the threads and barriers that changed
+  struct ConstructionState {
+  public:
+    ConstructionState(int total_threads, int max_num_barriers)
+      : program_counters(total_threads, 0), 
+        pending_arrives(max_num_barriers), 
+        preceeding(max_num_barriers), waiting(max_num_barriers),
+        active_threads(0) { }
+  public:
+    std::vector<int> program_counters;
+    std::vector<PendingState> pending_arrives;
+    std::vector<PreceedingBarriers> preceeding;
+    std::vector<WaitingThreads> waiting;
+    // Names of barriers whose waiting threads or arrivals changed
+    std::vector<int> changed_names;
+    // Threads that are not blocked on a sync barrier or exited
+    std::vector<int> runnable_threads;
+    int active_threads;
+    // Where each runnable thread stopped and the arrives it passed
+    std::vector<int> stop_lines;
+    std::vector<std::vector<int> > arrive_lines;
+  };
 public:
   BarrierDependenceGraph(Weft *weft, Program *p);
   BarrierDependenceGraph(const BarrierDependenceGraph &rhs);
@@ -131,17 +236,23 @@ public:
   void validate_barrier(int name, int generation);
 public:
   int count_total_barriers(void);
+  inline BarrierInstance* get_instance(int name, int generation) const
+    { return barrier_instances[name][generation]; }
   void enqueue_reachability_tasks(void);
   void enqueue_transitive_happens_tasks(void);
+  const Frontier* merge_latest_before(
+                      const std::vector<BarrierInstance*> &barriers);
+  const Frontier* merge_earliest_after(
+                      const std::vector<BarrierInstance*> &barriers);
 protected:
-  bool remove_complete_barriers(std::vector<int> &program_counters,
-                                std::vector<PendingState> &pending_arrives,
-                                std::vector<PreceedingBarriers> &preceeding,
+  void update_top(int thread_idx, ConstructionState &state,
+                  const std::vector<Thread*> &threads);
+  void mark_changed(int name, ConstructionState &state);
+  bool remove_complete_barriers(ConstructionState &state,
                                 const std::vector<Thread*> &threads);
-  bool are_empty(const std::vector<int> &program_counters,
-                 const std::vector<Thread*> &threads);
-  bool advance_program_counters(std::vector<int> &program_counters,
-                                std::vector<PendingState> &pending_arrives,
+  void check_arrival_counts(const ConstructionState &state,
+                            const std::vector<Thread*> &threads);
+  bool advance_program_counters(ConstructionState &state,
                                 const std::vector<Thread*> &threads);
   void report_state(const std::vector<int> &program_counters,
                     const std::vector<Thread*> &threads,
@@ -152,6 +263,8 @@ public:
   Weft *const weft;
   Program *const program;
   const int max_num_barriers;
+  // Lanes of each warp that share a position in the frontiers
+  const int frontier_lanes;
 protected:
   std::vector<std::deque<BarrierInstance*> > barrier_instances;
   // A summary of all barriers in one place
@@ -159,6 +272,12 @@ protected:
 protected:
   pthread_mutex_t validation_mutex;
   std::vector<std::pair<int/*name*/,int/*gen*/> > failed_validations;
+protected:
+  // Positions merged from sets of barrier instances, which are shared
+  // by all the happens with the same set of barriers
+  pthread_mutex_t merge_mutex;
+  std::map<std::vector<BarrierInstance*>,Frontier> merged_before;
+  std::map<std::vector<BarrierInstance*>,Frontier> merged_after;
 };
 
 class BFSSearch {
@@ -212,7 +212,7 @@ inline int64_t parse_immediate(const std::string &imm)
 }
 
 PTXInstruction::PTXInstruction(void)
-  : kind(PTX_LAST), line_number(0), next(NULL),
+  : kind(PTX_LAST), line_number(0), next(NULL), program_counter(-1),
     source_file(NULL), source_line_number(-1)
 {
   // should never be called
@@ -220,7 +220,8 @@ PTXInstruction::PTXInstruction(void)
 }
 
 PTXInstruction::PTXInstruction(PTXKind k, int line_num)
-  : kind(k), line_number(line_num), next(NULL)
+  : kind(k), line_number(line_num), next(NULL), program_counter(-1),
+    source_file(NULL), source_line_number(-1)
 {
 }
 
@@ -257,58 +258,101 @@ void PTXInstruction::set_source_location(const char *file, int line)
   source_line_number = line;
 }
 
+// Each opcode mnemonic maps directly to the parser for its instruction
+typedef bool (*PTXParser)(const std::string &line,
+                          const std::vector<std::string> &tokens,
+                          int line_num, PTXInstruction *&result);
+
+struct PTXOpcode {
+  const char *mnemonic;
+  PTXParser parser;
+};
+
+// Must be kept sorted by mnemonic for the binary search in interpret
+static const PTXOpcode ptx_opcodes[] = {
+  { ".const",   PTXGlobalDecl::interpret        },
+  { ".global",  PTXGlobalDecl::interpret        },
+  { ".shared",  PTXSharedDecl::interpret        },
+  { "add",      PTXAdd::interpret               },
+  { "and",      PTXAnd::interpret               },
+  { "atom",     PTXSharedAccess::interpret      },
+  { "bar",      PTXBarrier::interpret           },
+  { "bfe",      PTXBitFieldExtract::interpret   },
+  { "bra",      PTXBranch::interpret            },
+  { "cvt",      PTXConvert::interpret           },
+  { "exit",     PTXExit::interpret              },
+  { "ld",       PTXSharedAccess::interpret      },
+  { "mad",      PTXMad::interpret               },
+  { "mov",      PTXMove::interpret              },
+  { "mul",      PTXMul::interpret               },
+  { "neg",      PTXNeg::interpret               },
+  { "not",      PTXNot::interpret               },
+  { "or",       PTXOr::interpret                },
+  { "red",      PTXSharedAccess::interpret      },
+  { "ret",      PTXExit::interpret              },
+  { "selp",     PTXSelectPred::interpret        },
+  { "setp",     PTXSetPred::interpret           },
+  { "shfl",     PTXShuffle::interpret           },
+  { "shl",      PTXLeftShift::interpret         },
+  { "shr",      PTXRightShift::interpret        },
+  { "st",       PTXSharedAccess::interpret      },
+  { "sub",      PTXSub::interpret               },
+  { "xor",      PTXXor::interpret               },
+};
+
+static PTXParser find_parser(const char *mnemonic, size_t length)
+{
+  int lo = 0;
+  int hi = (sizeof(ptx_opcodes) / sizeof(ptx_opcodes[0])) - 1;
+  while (lo <= hi)
+  {
+    const int mid = (lo + hi) / 2;
+    const char *name = ptx_opcodes[mid].mnemonic;
+    int cmp = strncmp(name, mnemonic, length);
+    // A table entry longer than the mnemonic sorts after it
+    if ((cmp == 0) && (name[length] != '\0'))
+      cmp = 1;
+    if (cmp == 0)
+      return ptx_opcodes[mid].parser;
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+  return NULL;
+}
+
 /*static*/ 
-PTXInstruction* PTXInstruction::interpret(const std::string &line, int line_num)
+PTXInstruction* PTXInstruction::interpret(const std::string &line,
+                                const std::vector<std::string> &tokens,
+                                int line_num)
 {
   PTXInstruction *result = NULL;
-  if (PTXBranch::interpret(line, line_num, result))
-    return result;
-  if (PTXLabel::interpret(line, line_num, result))
-    return result;
-  if (PTXSharedDecl::interpret(line, line_num, result))
-    return result; 
-  if (PTXMove::interpret(line, line_num, result))
-    return result;
-  if (PTXRightShift::interpret(line, line_num, result))
-    return result;
-  if (PTXLeftShift::interpret(line, line_num, result))
-    return result;
-  if (PTXAnd::interpret(line, line_num, result))
-    return result;
-  if (PTXOr::interpret(line, line_num, result))
-    return result;
-  if (PTXXor::interpret(line, line_num, result))
-    return result;
-  if (PTXNot::interpret(line, line_num, result))
-    return result;
-  if (PTXAdd::interpret(line, line_num, result))
-    return result;
-  if (PTXSub::interpret(line, line_num, result))
+  if (tokens.empty())
     return result;
-  if (PTXNeg::interpret(line, line_num, result))
-    return result;
-  if (PTXMul::interpret(line, line_num, result))
-    return result;
-  if (PTXMad::interpret(line, line_num, result))
-    return result;
-  if (PTXSetPred::interpret(line, line_num, result))
-    return result;
-  if (PTXSelectPred::interpret(line, line_num, result))
-    return result;
-  if (PTXBarrier::interpret(line, line_num, result))
-    return result;
-  if (PTXSharedAccess::interpret(line, line_num, result))
-    return result;
-  if (PTXConvert::interpret(line, line_num, result))
-    return result;
-  if (PTXBitFieldExtract::interpret(line, line_num, result))
-    return result;
-  if (PTXShuffle::interpret(line, line_num, result))
-    return result;
-  if (PTXExit::interpret(line, line_num, result))
+  const std::string &first = tokens[0];
+  if (first[first.size() - 1] == ':')
+  {
+    PTXLabel::interpret(line, tokens, line_num, result);
     return result;
-  if (PTXGlobalDecl::interpret(line, line_num, result))
+  }
+  // Skip any guard predicate and linkage directives to find the opcode
+  unsigned index = 0;
+  while ((index < tokens.size()) && 
+         ((tokens[index][0] == '@') || (tokens[index] == ".visible") ||
+          (tokens[index] == ".extern") || (tokens[index] == ".weak")))
+    index++;
+  if (index == tokens.size())
     return result;
+  // The mnemonic ends at the first type or state space qualifier
+  const char *opcode = tokens[index].c_str();
+  size_t length = 1;
+  while ((opcode[length] != '\0') && (opcode[length] != '.') &&
+         (opcode[length] != ';'))
+    length++;
+  PTXParser parser = find_parser(opcode, length);
+  if (parser != NULL)
+    (*parser)(line, tokens, line_num, result);
   return result;
 }
 
@@ -419,6 +463,11 @@ PTXInstruction* PTXLabel::emulate_warp(Thread **threads,
   return next;
 }
 
+void PTXLabel::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_NOP;
+}
+
 void PTXLabel::update_labels(std::map<std::string,PTXLabel*> &labels)
 {
   std::map<std::string,PTXLabel*>::const_iterator finder = 
@@ -428,36 +477,32 @@ void PTXLabel::update_labels(std::map<std::string,PTXLabel*> &labels)
 }
 
 /*static*/
-bool PTXLabel::interpret(const std::string &line, int line_num,
-                         PTXInstruction *&result)
+bool PTXLabel::interpret(const std::string &line,
+                         const std::vector<std::string> &tokens,
+                         int line_num, PTXInstruction *&result)
 {
-  if (line.find(":") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 1);
-    std::string label = tokens[0].substr(0, tokens[0].size() - 1);
-    result = new PTXLabel(label, line_num);
-    return true;
-  }
-  return false;
+  assert(tokens.size() == 1);
+  std::string label = tokens[0].substr(0, tokens[0].size() - 1);
+  result = new PTXLabel(label, line_num);
+  return true;
 }
 
 PTXBranch::PTXBranch(const std::string &l, int line_num)
-  : PTXInstruction(PTX_BRANCH, line_num), predicate(0), label(l), target(NULL)
+  : PTXInstruction(PTX_BRANCH, line_num), has_predicate(false), 
+    predicate(0), negate(false), label(l), target(NULL)
 {
 }
 
 PTXBranch::PTXBranch(int64_t p, bool n, const std::string &l, int line_num)
   : PTXInstruction(PTX_BRANCH, line_num), 
-    predicate(p), negate(n), label(l), target(NULL)
+    has_predicate(true), predicate(p), negate(n), label(l), target(NULL)
 {
 }
 
 PTXInstruction* PTXBranch::emulate(Thread *thread)
 {
   // Handle the uniform branch case
-  if (predicate == 0)
+  if (!has_predicate)
     return target;
   bool value;
   if (!thread->get_pred(predicate, value))
@@ -465,7 +510,8 @@ PTXInstruction* PTXBranch::emulate(Thread *thread)
     if (thread->program->weft->report_warnings())
     {
       char buffer[11];
-      decompress_identifier(predicate, buffer, 11);
+      decompress_identifier(thread->program->get_predicate_name(predicate),
+                            buffer, 11);
       fprintf(stderr,"WEFT WARNING: Branch depends on undefined predicate %s\n",
                      buffer);
     }
@@ -483,69 +529,63 @@ PTXInstruction* PTXBranch::emulate_warp(Thread **threads,
                                         int &shared_access_id,
                                         SharedStore &store)
 {
-  // Evaluate all the branches for all the enabled threads
-  PTXInstruction *targets[WARP_SIZE];
+  uint32_t enabled = 0, disabled = 0;
   for (int i = 0; i < WARP_SIZE; i++)
   {
     if (thread_state[i].status == THREAD_ENABLED)
+      enabled |= (1U << i);
+    else if (thread_state[i].status == THREAD_DISABLED)
+      disabled |= (1U << i);
+  }
+  // Evaluate the branch for all the enabled threads at once
+  // using the lane-major predicate word for this warp
+  uint32_t taken = enabled;
+  if (has_predicate)
+  {
+    uint32_t values, defined;
+    threads[0]->get_warp_pred(predicate, values, defined);
+    uint32_t undefined = enabled & ~defined;
+    if (undefined && threads[0]->program->weft->report_warnings())
     {
-      if (predicate == 0)
-        targets[i] = target;
-      else
+      char buffer[11];
+      decompress_identifier(threads[0]->program->get_predicate_name(predicate),
+                            buffer, 11);
+      for (int i = 0; i < WARP_SIZE; i++)
       {
-        bool value;
-        if (!threads[i]->get_pred(predicate, value))
-        {
-          if (threads[i]->program->weft->report_warnings())
-          {
-            char buffer[11];
-            decompress_identifier(predicate, buffer, 11);
-            fprintf(stderr,"WEFT WARNING: Branch depends on "
-                           "undefined predicate %s\n", buffer);
-          }
-          targets[i] = next;
-        }
-        else
+        if (undefined & (1U << i))
         {
-          // We successfully got a predicate
-          if (negate)
-            value = !value;
-          if (value)
-            targets[i] = target;
-          else
-            targets[i] = next;
+          fprintf(stderr,"WEFT WARNING: Unable to find predicate %s\n", buffer);
+          fprintf(stderr,"WEFT WARNING: Branch depends on "
+                         "undefined predicate %s\n", buffer);
         }
       }
     }
-    else if (thread_state[i].status == THREAD_DISABLED)
-    {
-      targets[i] = thread_state[i].next;
-      assert(targets[i] != NULL);
-    }
-    else
-      targets[i] = NULL; // exitted threads don't matter
+    // Threads with undefined predicates fall through
+    taken = enabled & defined & (negate ? ~values : values);
   }
-  // We have all the targets 
-  // See if we have consensus about where to go next 
+  const uint32_t fall_through = enabled & ~taken;
+  // See if we have consensus about where to go next,
+  // exitted threads don't matter
   bool converged = true; 
   PTXInstruction *result = NULL;
-  for (int i = 0; i < WARP_SIZE; i++)
+  if (taken)
+    result = target;
+  if (fall_through)
+  {
+    if ((result != NULL) && (result != next))
+      converged = false;
+    else
+      result = next;
+  }
+  for (int i = 0; converged && (i < WARP_SIZE); i++)
   {
-    // Skip any exitted threads
-    if (targets[i] == NULL)
+    if (!(disabled & (1U << i)))
       continue;
-    // If this is our first non-NULL entry record it
+    assert(thread_state[i].next != NULL);
     if (result == NULL)
-    {
-      result = targets[i];
-      continue;
-    }
-    // If we diverge at some point then we are done
-    if (targets[i] != result)
-    {
+      result = thread_state[i].next;
+    else if (thread_state[i].next != result)
       converged = false;
-      break;
-    }
   }
   // If all the threads have exitted we should never be here
   assert(result != NULL);
@@ -567,20 +607,18 @@ PTXInstruction* PTXBranch::emulate_warp(Thread **threads,
   // Recompute the enabled and disabled threads
   for (int i = 0; i < WARP_SIZE; i++)
   {
-    // Skip all the exitted threads
-    if (targets[i] == NULL)
-      continue;
+    const uint32_t mask = (1U << i);
     // Enable any threads going to next
-    if (targets[i] == next)
+    if ((fall_through & mask) || ((taken & mask) && (target == next)) ||
+        ((disabled & mask) && (thread_state[i].next == next)))
     {
       thread_state[i].status = THREAD_ENABLED;
       thread_state[i].next = NULL;
     }
-    else if (thread_state[i].status == THREAD_ENABLED)
+    else if (taken & mask)
     {
       // Disable all threads not going to next that 
       // weren't already disabled to begin with
-      assert(targets[i] == target);
       thread_state[i].status = THREAD_DISABLED;
       thread_state[i].next = target;
     }
@@ -588,6 +626,21 @@ PTXInstruction* PTXBranch::emulate_warp(Thread **threads,
   return next;
 }
 
+void PTXBranch::assign_slots(Program *program)
+{
+  if (has_predicate)
+    predicate = program->get_predicate_slot(predicate);
+}
+
+void PTXBranch::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = has_predicate ? COMPILED_BRANCH : COMPILED_UNIFORM_BRANCH;
+  code.flags = negate;
+  code.src[0] = predicate;
+  assert(target != NULL);
+  code.target = target->get_program_counter();
+}
+
 void PTXBranch::set_targets(const std::map<std::string,PTXLabel*> &labels)
 {
   std::map<std::string,PTXLabel*>::const_iterator finder =
@@ -598,38 +651,44 @@ void PTXBranch::set_targets(const std::map<std::string,PTXLabel*> &labels)
 }
 
 /*static*/
-bool PTXBranch::interpret(const std::string &line, int line_num,
-                          PTXInstruction *&result)
+bool PTXBranch::interpret(const std::string &line,
+                          const std::vector<std::string> &tokens,
+                          int line_num, PTXInstruction *&result)
 {
-  if (line.find("bra") != std::string::npos)
+  if (tokens.size() == 3)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    if (tokens.size() == 3)
-    {
-      bool negate;
-      int64_t predicate = parse_predicate(tokens[0], negate);
-      std::string arg2 = tokens[2].substr(0, tokens[2].size() - 1);
-      result = new PTXBranch(predicate, negate, arg2, line_num);
-    }
-    else if (tokens.size() == 2)
-    {
-      assert(line.find("bra.uni") != std::string::npos);
-      std::string arg = tokens[1].substr(0, tokens[1].size() - 1);
-      result = new PTXBranch(arg, line_num);
-    }
-    else
-      assert(false);
-    return true;
+    bool negate;
+    int64_t predicate = parse_predicate(tokens[0], negate);
+    std::string arg2 = tokens[2].substr(0, tokens[2].size() - 1);
+    result = new PTXBranch(predicate, negate, arg2, line_num);
   }
-  return false;
+  else if (tokens.size() == 2)
+  {
+    assert(tokens[0].find("bra.uni") == 0);
+    std::string arg = tokens[1].substr(0, tokens[1].size() - 1);
+    result = new PTXBranch(arg, line_num);
+  }
+  else
+    assert(false);
+  return true;
 }
 
-PTXSharedDecl::PTXSharedDecl(const std::string &n, int64_t addr, int line_num)
-  : PTXInstruction(PTX_SHARED_DECL, line_num), name(n), address(addr)
+PTXSharedDecl::PTXSharedDecl(const std::string &n, int64_t addr, 
+                             int64_t s, int line_num)
+  : PTXInstruction(PTX_SHARED_DECL, line_num), name(n), address(addr), size(s)
 {
 }
 
+void PTXSharedDecl::assign_address(void)
+{
+  // Addresses are handed out in file order after parsing
+  static int64_t shared_offset = 1;
+  // This is just an approximation to stride all 
+  // the shared memory allocations far away from each other
+  address = shared_offset * SDDRINC;
+  shared_offset++;
+}
+
 PTXInstruction* PTXSharedDecl::emulate(Thread *thread)
 {
   thread->register_shared_location(name, address);
@@ -637,23 +696,39 @@ PTXInstruction* PTXSharedDecl::emulate(Thread *thread)
 }
 
 /*static*/
-bool PTXSharedDecl::interpret(const std::string &line, int line_num,
-                              PTXInstruction *&result)
-{
-  static int64_t shared_offset = 1;
-  if ((line.find(".shared") != std::string::npos) &&
-      (line.find(".align") != std::string::npos))
-  {
-    int start = line.find("_");
-    std::string name = line.substr(start, line.find("[") - start);
-    // This is just an approximation to stride all 
-    // the shared memory allocations far away from each other
-    int64_t address = shared_offset * SDDRINC;
-    shared_offset++;
-    result = new PTXSharedDecl(name, address, line_num);
-    return true;
+bool PTXSharedDecl::interpret(const std::string &line,
+                              const std::vector<std::string> &tokens,
+                              int line_num, PTXInstruction *&result)
+{
+  // Only aligned arrays are modeled as shared allocations, the
+  // state space can come after linkage directives such as .extern
+  unsigned shared = 0;
+  while ((shared < tokens.size()) && (tokens[shared] != ".shared"))
+    shared++;
+  unsigned align = shared + 1;
+  while ((align < tokens.size()) && (tokens[align] != ".align"))
+    align++;
+  if (align >= tokens.size())
+    return false;
+  // The name follows the alignment and the type
+  if ((align + 3) >= tokens.size())
+    return false;
+  const std::string &declared = tokens[align + 3];
+  std::string name = declared.substr(0, declared.find_first_of("[;"));
+  // The size is the number of elements times the bits in the type
+  // which follows the alignment, extern arrays have no known size
+  int64_t size = 0;
+  const size_t bracket = line.find("[");
+  if (bracket != std::string::npos)
+  {
+    int elements = 0, bits = 0;
+    if ((sscanf(line.c_str() + bracket, "[%d]", &elements) == 1) &&
+        (sscanf(tokens[align + 2].c_str(), ".%*c%d", &bits) == 1))
+      size = int64_t(elements) * (bits / 8);
   }
-  return false;
+  // The address is assigned by PTXSharedDecl::assign_address
+  result = new PTXSharedDecl(name, 0/*address*/, size, line_num);
+  return true;
 }
 
 PTXMove::PTXMove(int64_t dst, int64_t src, bool imm, int line_num)
@@ -693,41 +768,54 @@ PTXInstruction* PTXMove::emulate(Thread *thread)
   return next;
 }
 
+void PTXMove::assign_slots(Program *program)
+{
+  args[0] = program->get_destination_slot(args[0]);
+  if (source.empty() && !immediate)
+    args[1] = program->get_register_slot(args[1]);
+}
+
+void PTXMove::compile(Program *program, CompiledInstruction &code) const
+{
+  code.dst = args[0];
+  // Moves of shared memory names still need emulate
+  if (!source.empty())
+    return;
+  code.opcode = COMPILED_MOVE;
+  code.src[0] = immediate ? program->get_constant_slot(args[1]) : args[1];
+}
+
 /*static*/
-bool PTXMove::interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result)
+bool PTXMove::interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result)
 {
-  if (line.find("mov.") != std::string::npos)
+  if (tokens.size() != 3)
+    return false;
+  assert(tokens.size() == 3);
+  if (count(line, "%") == 2)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    if (tokens.size() != 3)
-      return false;
-    assert(tokens.size() == 3);
-    if (count(line, "%") == 2)
-    {
-      int64_t arg1 = parse_register(tokens[1]);
-      int64_t arg2 = parse_register(tokens[2]);
-      result = new PTXMove(arg1, arg2, false/*immediate*/, line_num);
-      return true;
-    }
-    else if (contains(line, "cuda"))
-    {
-      int end_arg1 = line.find(",");
-      int start_arg2 = line.find("_", end_arg1);
-      int end_arg2 = line.find(";");
-      int64_t arg1 = parse_register(tokens[1]);
-      std::string arg2 = line.substr(start_arg2, end_arg2 - start_arg2);
-      result = new PTXMove(arg1, arg2, line_num);
-      return true;
-    }
-    else if (count(line, "%") == 1)
-    {
-      int64_t arg1 = parse_register(tokens[1]);
-      int64_t arg2 = parse_immediate(tokens[2]);
-      result = new PTXMove(arg1, arg2, true/*immediate*/, line_num);
-      return true;
-    }
+    int64_t arg1 = parse_register(tokens[1]);
+    int64_t arg2 = parse_register(tokens[2]);
+    result = new PTXMove(arg1, arg2, false/*immediate*/, line_num);
+    return true;
+  }
+  else if (contains(line, "cuda"))
+  {
+    int end_arg1 = line.find(",");
+    int start_arg2 = line.find("_", end_arg1);
+    int end_arg2 = line.find(";");
+    int64_t arg1 = parse_register(tokens[1]);
+    std::string arg2 = line.substr(start_arg2, end_arg2 - start_arg2);
+    result = new PTXMove(arg1, arg2, line_num);
+    return true;
+  }
+  else if (count(line, "%") == 1)
+  {
+    int64_t arg1 = parse_register(tokens[1]);
+    int64_t arg2 = parse_immediate(tokens[2]);
+    result = new PTXMove(arg1, arg2, true/*immediate*/, line_num);
+    return true;
   }
   return false;
 }
@@ -764,26 +852,37 @@ PTXInstruction* PTXRightShift::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXRightShift::interpret(const std::string &line, int line_num,
-                              PTXInstruction *&result)
+void PTXRightShift::assign_slots(Program *program)
 {
-  if (line.find("shr.") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 4);
-    int64_t arg1 = parse_register(tokens[1]);
-    int64_t arg2 = parse_register(tokens[2]);
-    const size_t regs = count(line, "%");
-    assert((regs == 2) || (regs == 3));
-    const bool immediate = (regs == 2);
-    int64_t arg3 = immediate ? parse_immediate(tokens[3]) 
-                             : parse_register(tokens[3]);
-    result = new PTXRightShift(arg1, arg2, arg3, immediate, line_num);
-    return true;
-  }
-  return false;
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXRightShift::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_RIGHT_SHIFT;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
+/*static*/
+bool PTXRightShift::interpret(const std::string &line,
+                              const std::vector<std::string> &tokens,
+                              int line_num, PTXInstruction *&result)
+{
+  assert(tokens.size() == 4);
+  int64_t arg1 = parse_register(tokens[1]);
+  int64_t arg2 = parse_register(tokens[2]);
+  const size_t regs = count(line, "%");
+  assert((regs == 2) || (regs == 3));
+  const bool immediate = (regs == 2);
+  int64_t arg3 = immediate ? parse_immediate(tokens[3]) 
+                           : parse_register(tokens[3]);
+  result = new PTXRightShift(arg1, arg2, arg3, immediate, line_num);
+  return true;
 }
 
 PTXLeftShift::PTXLeftShift(int64_t one, int64_t two, int64_t three, 
@@ -818,26 +917,37 @@ PTXInstruction* PTXLeftShift::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXLeftShift::interpret(const std::string &line, int line_num,
-                              PTXInstruction *&result)
+void PTXLeftShift::assign_slots(Program *program)
 {
-  if (line.find("shl.") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 4);
-    int64_t arg1 = parse_register(tokens[1]);
-    int64_t arg2 = parse_register(tokens[2]);
-    const size_t regs = count(line, "%");
-    assert((regs == 2) || (regs == 3));
-    const bool immediate = (regs == 2);
-    int64_t arg3 = immediate ? parse_immediate(tokens[3])
-                             : parse_register(tokens[3]);
-    result = new PTXLeftShift(arg1, arg2, arg3, immediate, line_num);
-    return true;
-  }
-  return false;
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXLeftShift::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_LEFT_SHIFT;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
+/*static*/
+bool PTXLeftShift::interpret(const std::string &line,
+                             const std::vector<std::string> &tokens,
+                             int line_num, PTXInstruction *&result)
+{
+  assert(tokens.size() == 4);
+  int64_t arg1 = parse_register(tokens[1]);
+  int64_t arg2 = parse_register(tokens[2]);
+  const size_t regs = count(line, "%");
+  assert((regs == 2) || (regs == 3));
+  const bool immediate = (regs == 2);
+  int64_t arg3 = immediate ? parse_immediate(tokens[3])
+                           : parse_register(tokens[3]);
+  result = new PTXLeftShift(arg1, arg2, arg3, immediate, line_num);
+  return true;
 }
 
 PTXAnd::PTXAnd(int64_t zero, int64_t one, int64_t two, 
@@ -864,10 +974,10 @@ PTXInstruction* PTXAnd::emulate(Thread *thread)
     }
     else
     {
-      int64_t source, other; 
-      if (!thread->get_value(args[1], source))
+      bool source, other;
+      if (!thread->get_pred(args[1], source))
         return next;
-      if (!thread->get_value(args[2], other))
+      if (!thread->get_pred(args[2], other))
         return next;
       bool value = source && other;
       thread->set_pred(args[0], value);
@@ -897,14 +1007,47 @@ PTXInstruction* PTXAnd::emulate(Thread *thread)
   return next;
 }
 
+void PTXAnd::assign_slots(Program *program)
+{
+  // Predicated versions operate on predicates which live
+  // in the predicate bitsets instead of the register file
+  if (predicate)
+  {
+    args[0] = program->get_predicate_slot(args[0]);
+    args[1] = program->get_predicate_slot(args[1]);
+    if (!immediate)
+      args[2] = program->get_predicate_slot(args[2]);
+    return;
+  }
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXAnd::compile(Program *program, CompiledInstruction &code) const
+{
+  if (predicate)
+  {
+    // Immediate predicates are rare enough to leave to emulate
+    if (immediate)
+      return;
+    code.opcode = COMPILED_AND_PREDICATE;
+  }
+  else
+    code.opcode = COMPILED_AND;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
 /*static*/
-bool PTXAnd::interpret(const std::string &line, int line_num,
-                       PTXInstruction *&result)
+bool PTXAnd::interpret(const std::string &line,
+                       const std::vector<std::string> &tokens,
+                       int line_num, PTXInstruction *&result)
 {
-  if (line.find("and.b") != std::string::npos)
+  if (tokens[0].find("and.b") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 4);
     int64_t arg1 = parse_register(tokens[1]);
     int64_t arg2 = parse_register(tokens[2]);
@@ -917,10 +1060,8 @@ bool PTXAnd::interpret(const std::string &line, int line_num,
                         false/*pred*/, line_num);
     return true;
   }
-  else if (line.find("and.pred") != std::string::npos)
+  else if (tokens[0].find("and.pred") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 4);
     bool negate;
     int64_t arg1 = parse_predicate(tokens[1], negate);
@@ -994,14 +1135,47 @@ PTXInstruction* PTXOr::emulate(Thread *thread)
   return next;
 }
 
+void PTXOr::assign_slots(Program *program)
+{
+  // Predicated versions operate on predicates which live
+  // in the predicate bitsets instead of the register file
+  if (predicate)
+  {
+    args[0] = program->get_predicate_slot(args[0]);
+    args[1] = program->get_predicate_slot(args[1]);
+    if (!immediate)
+      args[2] = program->get_predicate_slot(args[2]);
+    return;
+  }
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXOr::compile(Program *program, CompiledInstruction &code) const
+{
+  if (predicate)
+  {
+    // Immediate predicates are rare enough to leave to emulate
+    if (immediate)
+      return;
+    code.opcode = COMPILED_OR_PREDICATE;
+  }
+  else
+    code.opcode = COMPILED_OR;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
 /*static*/
-bool PTXOr::interpret(const std::string &line, int line_num,
-                      PTXInstruction *&result)
+bool PTXOr::interpret(const std::string &line,
+                      const std::vector<std::string> &tokens,
+                      int line_num, PTXInstruction *&result)
 {
-  if (line.find("or.b") != std::string::npos)
+  if (tokens[0].find("or.b") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 4);
     int64_t arg1 = parse_register(tokens[1]);
     int64_t arg2 = parse_register(tokens[2]);
@@ -1014,10 +1188,8 @@ bool PTXOr::interpret(const std::string &line, int line_num,
                        false/*predi*/, line_num);
     return true;
   }
-  else if (line.find("or.pred") != std::string::npos)
+  else if (tokens[0].find("or.pred") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 4);
     bool negate;
     int64_t arg1 = parse_predicate(tokens[1], negate);
@@ -1092,14 +1264,47 @@ PTXInstruction* PTXXor::emulate(Thread *thread)
   return next;
 }
 
+void PTXXor::assign_slots(Program *program)
+{
+  // Predicated versions operate on predicates which live
+  // in the predicate bitsets instead of the register file
+  if (predicate)
+  {
+    args[0] = program->get_predicate_slot(args[0]);
+    args[1] = program->get_predicate_slot(args[1]);
+    if (!immediate)
+      args[2] = program->get_predicate_slot(args[2]);
+    return;
+  }
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXXor::compile(Program *program, CompiledInstruction &code) const
+{
+  if (predicate)
+  {
+    // Immediate predicates are rare enough to leave to emulate
+    if (immediate)
+      return;
+    code.opcode = COMPILED_XOR_PREDICATE;
+  }
+  else
+    code.opcode = COMPILED_XOR;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
 /*static*/
-bool PTXXor::interpret(const std::string &line, int line_num,
-                      PTXInstruction *&result)
+bool PTXXor::interpret(const std::string &line,
+                       const std::vector<std::string> &tokens,
+                       int line_num, PTXInstruction *&result)
 {
-  if (line.find("xor.b") != std::string::npos)
+  if (tokens[0].find("xor.b") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 4);
     int64_t arg1 = parse_register(tokens[1]);
     int64_t arg2 = parse_register(tokens[2]);
@@ -1112,10 +1317,8 @@ bool PTXXor::interpret(const std::string &line, int line_num,
                        false/*predi*/, line_num);
     return true;
   }
-  else if (line.find("xor.pred") != std::string::npos)
+  else if (tokens[0].find("xor.pred") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 4);
     bool negate;
     int64_t arg1 = parse_predicate(tokens[1], negate);
@@ -1160,24 +1363,40 @@ PTXInstruction* PTXNot::emulate(Thread *thread)
   return next;
 }
 
+void PTXNot::assign_slots(Program *program)
+{
+  if (predicate)
+  {
+    args[0] = program->get_predicate_slot(args[0]);
+    args[1] = program->get_predicate_slot(args[1]);
+    return;
+  }
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+}
+
+void PTXNot::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = predicate ? COMPILED_NOT_PREDICATE : COMPILED_NOT;
+  code.dst = args[0];
+  code.src[0] = args[1];
+}
+
 /*static*/
-bool PTXNot::interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result)
+bool PTXNot::interpret(const std::string &line,
+                       const std::vector<std::string> &tokens,
+                       int line_num, PTXInstruction *&result)
 {
-  if (line.find("not.b") != std::string::npos)
+  if (tokens[0].find("not.b") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 3);
     int64_t arg1 = parse_register(tokens[1]);
     int64_t arg2 = parse_register(tokens[2]);
     result = new PTXNot(arg1, arg2, false/*pred*/, line_num);
     return true;
   }
-  else if (line.find("not.pred") != std::string::npos)
+  else if (tokens[0].find("not.pred") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 3);
     bool negate;
     int64_t arg1 = parse_predicate(tokens[1], negate);
@@ -1220,26 +1439,37 @@ PTXInstruction* PTXAdd::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXAdd::interpret(const std::string &line, int line_num,
-                       PTXInstruction *&result)
+void PTXAdd::assign_slots(Program *program)
 {
-  if (line.find("add.") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 4);
-    int64_t arg1 = parse_register(tokens[1]);
-    int64_t arg2 = parse_register(tokens[2]);
-    const size_t regs = count(line, "%");
-    assert((regs == 2) || (regs == 3));
-    const bool immediate = (regs == 2);
-    int64_t arg3 = immediate ? parse_immediate(tokens[3])
-                             : parse_register(tokens[3]);
-    result = new PTXAdd(arg1, arg2, arg3, immediate, line_num);
-    return true;
-  }
-  return false;
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXAdd::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_ADD;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
+/*static*/
+bool PTXAdd::interpret(const std::string &line,
+                       const std::vector<std::string> &tokens,
+                       int line_num, PTXInstruction *&result)
+{
+  assert(tokens.size() == 4);
+  int64_t arg1 = parse_register(tokens[1]);
+  int64_t arg2 = parse_register(tokens[2]);
+  const size_t regs = count(line, "%");
+  assert((regs == 2) || (regs == 3));
+  const bool immediate = (regs == 2);
+  int64_t arg3 = immediate ? parse_immediate(tokens[3])
+                           : parse_register(tokens[3]);
+  result = new PTXAdd(arg1, arg2, arg3, immediate, line_num);
+  return true;
 }
 
 PTXSub::PTXSub(int64_t zero, int64_t one, int64_t two, 
@@ -1274,26 +1504,37 @@ PTXInstruction* PTXSub::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXSub::interpret(const std::string &line, int line_num,
-                       PTXInstruction *&result)
+void PTXSub::assign_slots(Program *program)
 {
-  if (line.find("sub.") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 4);
-    int64_t arg1 = parse_register(tokens[1]);
-    int64_t arg2 = parse_register(tokens[2]);
-    const size_t regs = count(line, "%");
-    assert((regs == 2) || (regs == 3));
-    const bool immediate = (regs == 2);
-    int64_t arg3 = immediate ? parse_immediate(tokens[3])
-                             : parse_register(tokens[3]);
-    result = new PTXSub(arg1, arg2, arg3, immediate, line_num);
-    return true;
-  }
-  return false;
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXSub::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_SUB;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
+/*static*/
+bool PTXSub::interpret(const std::string &line,
+                       const std::vector<std::string> &tokens,
+                       int line_num, PTXInstruction *&result)
+{
+  assert(tokens.size() == 4);
+  int64_t arg1 = parse_register(tokens[1]);
+  int64_t arg2 = parse_register(tokens[2]);
+  const size_t regs = count(line, "%");
+  assert((regs == 2) || (regs == 3));
+  const bool immediate = (regs == 2);
+  int64_t arg3 = immediate ? parse_immediate(tokens[3])
+                           : parse_register(tokens[3]);
+  result = new PTXSub(arg1, arg2, arg3, immediate, line_num);
+  return true;
 }
 
 PTXNeg::PTXNeg(int64_t zero, int64_t one, bool imm, int line_num)
@@ -1319,25 +1560,34 @@ PTXInstruction* PTXNeg::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXNeg::interpret(const std::string &line, int line_num,
-                       PTXInstruction *&result)
+void PTXNeg::assign_slots(Program *program)
 {
-  if (line.find("neg.") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 3);
-    int64_t arg1 = parse_register(tokens[1]);
-    const size_t regs = count(line, "%");
-    assert((regs == 1) || (regs == 2));
-    const bool immediate = (regs == 1);
-    int64_t arg2 = immediate ? parse_immediate(tokens[2])
-                             : parse_register(tokens[2]);
-    result = new PTXNeg(arg1, arg2, immediate, line_num);
-    return true;
-  }
-  return false;
+  args[0] = program->get_destination_slot(args[0]);
+  if (!immediate)
+    args[1] = program->get_register_slot(args[1]);
+}
+
+void PTXNeg::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_NEGATE;
+  code.dst = args[0];
+  code.src[0] = immediate ? program->get_constant_slot(args[1]) : args[1];
+}
+
+/*static*/
+bool PTXNeg::interpret(const std::string &line,
+                       const std::vector<std::string> &tokens,
+                       int line_num, PTXInstruction *&result)
+{
+  assert(tokens.size() == 3);
+  int64_t arg1 = parse_register(tokens[1]);
+  const size_t regs = count(line, "%");
+  assert((regs == 1) || (regs == 2));
+  const bool immediate = (regs == 1);
+  int64_t arg2 = immediate ? parse_immediate(tokens[2])
+                           : parse_register(tokens[2]);
+  result = new PTXNeg(arg1, arg2, immediate, line_num);
+  return true;
 }
 
 PTXMul::PTXMul(int64_t zero, int64_t one, int64_t two, bool imm, int line_num)
@@ -1371,26 +1621,37 @@ PTXInstruction* PTXMul::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXMul::interpret(const std::string &line, int line_num,
-                       PTXInstruction *&result)
+void PTXMul::assign_slots(Program *program)
 {
-  if (line.find("mul.") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 4);
-    int64_t arg1 = parse_register(tokens[1]);
-    int64_t arg2 = parse_register(tokens[2]);
-    const size_t regs = count(line, "%");
-    assert((regs == 2) || (regs == 3));
-    const bool immediate = (regs == 2);
-    int64_t arg3 = immediate ? parse_immediate(tokens[3])
-                             : parse_register(tokens[3]);
-    result = new PTXMul(arg1, arg2, arg3, immediate, line_num);
-    return true;
-  }
-  return false;
+  args[0] = program->get_destination_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXMul::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_MULTIPLY;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
+/*static*/
+bool PTXMul::interpret(const std::string &line,
+                       const std::vector<std::string> &tokens,
+                       int line_num, PTXInstruction *&result)
+{
+  assert(tokens.size() == 4);
+  int64_t arg1 = parse_register(tokens[1]);
+  int64_t arg2 = parse_register(tokens[2]);
+  const size_t regs = count(line, "%");
+  assert((regs == 2) || (regs == 3));
+  const bool immediate = (regs == 2);
+  int64_t arg3 = immediate ? parse_immediate(tokens[3])
+                           : parse_register(tokens[3]);
+  result = new PTXMul(arg1, arg2, arg3, immediate, line_num);
+  return true;
 }
 
 PTXMad::PTXMad(int64_t a[4], bool imm[4], int line_num)
@@ -1417,34 +1678,48 @@ PTXInstruction* PTXMad::emulate(Thread *thread)
   return next;
 }
 
+void PTXMad::assign_slots(Program *program)
+{
+  args[0] = program->get_destination_slot(args[0]);
+  for (int i = 1; i < 4; i++)
+  {
+    if (!immediate[i])
+      args[i] = program->get_register_slot(args[i]);
+  }
+}
+
+void PTXMad::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_MAD;
+  code.dst = args[0];
+  for (int i = 0; i < 3; i++)
+    code.src[i] = immediate[i+1] ? 
+      program->get_constant_slot(args[i+1]) : args[i+1];
+}
+
 /*static*/
-bool PTXMad::interpret(const std::string &line, int line_num,
-                       PTXInstruction *&result)
+bool PTXMad::interpret(const std::string &line,
+                       const std::vector<std::string> &tokens,
+                       int line_num, PTXInstruction *&result)
 {
-  if (line.find("mad.") != std::string::npos)
+  if ((tokens[0].find(".lo") != std::string::npos) ||
+      (tokens[0].find(".wide") != std::string::npos))
   {
-    if ((line.find("lo") != std::string::npos) ||
-        (line.find("wide") != std::string::npos))
+    assert(tokens.size() == 5);
+    int64_t args[4];
+    bool immediate[4];
+    for (int i = 0; i < 4; i++)
     {
-      std::vector<std::string> tokens; 
-      split(tokens, line.c_str());
-      assert(tokens.size() == 5);
-      int64_t args[4];
-      bool immediate[4];
-      for (int i = 0; i < 4; i++)
-      {
-        const bool imm = (tokens[i+1].find("%") == std::string::npos);
-        immediate[i] = imm;
-        args[i] = imm ? parse_immediate(tokens[i+1])
-                      : parse_register(tokens[i+1]);
-      }
-      result = new PTXMad(args, immediate, line_num);
+      const bool imm = (tokens[i+1].find("%") == std::string::npos);
+      immediate[i] = imm;
+      args[i] = imm ? parse_immediate(tokens[i+1])
+                    : parse_register(tokens[i+1]);
     }
-    else
-      assert(false); // TODO: implement hi
-    return true;
+    result = new PTXMad(args, immediate, line_num);
   }
-  return false;
+  else
+    assert(false); // TODO: implement hi
+  return true;
 }
 
 PTXSetPred::PTXSetPred(int64_t zero, int64_t one, int64_t two, 
@@ -1506,44 +1781,57 @@ PTXInstruction* PTXSetPred::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXSetPred::interpret(const std::string &line, int line_num,
-                           PTXInstruction *&result)
+void PTXSetPred::assign_slots(Program *program)
 {
-  if (line.find("setp.") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    const size_t regs = count(line, "%");
-    assert((regs == 2) || (regs == 3));
-    split(tokens, line.c_str());
-    assert(tokens.size() == 4);
-    bool negate;
-    int64_t arg1 = parse_predicate(tokens[1], negate);
-    assert(!negate);
-    int64_t arg2 = parse_register(tokens[2]);
-    const bool immediate = (regs == 2);
-    int64_t arg3 = immediate ? parse_immediate(tokens[3])
-                             : parse_register(tokens[3]);
-    CompType comparison;
-    if (line.find(".gt") != std::string::npos)
-      comparison = COMP_GT;
-    else if (line.find(".ge") != std::string::npos)
-      comparison = COMP_GE;
-    else if (line.find(".eq") != std::string::npos)
-      comparison = COMP_EQ;
-    else if (line.find(".ne") != std::string::npos)
-      comparison = COMP_NE;
-    else if (line.find(".le") != std::string::npos)
-      comparison = COMP_LE;
-    else if (line.find(".lt") != std::string::npos)
-      comparison = COMP_LT;
-    else
-      assert(false);
-    result = new PTXSetPred(arg1, arg2, arg3, 
-                            immediate, comparison, line_num);
-    return true;
-  }
-  return false;
+  // The destination is a predicate
+  args[0] = program->get_predicate_slot(args[0]);
+  args[1] = program->get_register_slot(args[1]);
+  if (!immediate)
+    args[2] = program->get_register_slot(args[2]);
+}
+
+void PTXSetPred::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_SET_PREDICATE;
+  code.flags = comparison;
+  code.dst = args[0];
+  code.src[0] = args[1];
+  code.src[1] = immediate ? program->get_constant_slot(args[2]) : args[2];
+}
+
+/*static*/
+bool PTXSetPred::interpret(const std::string &line,
+                           const std::vector<std::string> &tokens,
+                           int line_num, PTXInstruction *&result)
+{
+  const size_t regs = count(line, "%");
+  assert((regs == 2) || (regs == 3));
+  assert(tokens.size() == 4);
+  bool negate;
+  int64_t arg1 = parse_predicate(tokens[1], negate);
+  assert(!negate);
+  int64_t arg2 = parse_register(tokens[2]);
+  const bool immediate = (regs == 2);
+  int64_t arg3 = immediate ? parse_immediate(tokens[3])
+                           : parse_register(tokens[3]);
+  CompType comparison;
+  if (tokens[0].find(".gt") != std::string::npos)
+    comparison = COMP_GT;
+  else if (tokens[0].find(".ge") != std::string::npos)
+    comparison = COMP_GE;
+  else if (tokens[0].find(".eq") != std::string::npos)
+    comparison = COMP_EQ;
+  else if (tokens[0].find(".ne") != std::string::npos)
+    comparison = COMP_NE;
+  else if (tokens[0].find(".le") != std::string::npos)
+    comparison = COMP_LE;
+  else if (tokens[0].find(".lt") != std::string::npos)
+    comparison = COMP_LT;
+  else
+    assert(false);
+  result = new PTXSetPred(arg1, arg2, arg3, 
+                          immediate, comparison, line_num);
+  return true;
 }
 
 PTXSelectPred::PTXSelectPred(int64_t zero, int64_t one, int64_t two, int64_t three,
@@ -1579,29 +1867,46 @@ PTXInstruction* PTXSelectPred::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXSelectPred::interpret(const std::string &line, int line_num,
-                              PTXInstruction *&result)
+void PTXSelectPred::assign_slots(Program *program)
 {
-  if (line.find("selp.") != std::string::npos)
+  args[0] = program->get_destination_slot(args[0]);
+  for (int i = 0; i < 2; i++)
   {
-    std::vector<std::string> tokens; 
-    split(tokens, line.c_str());
-    assert(tokens.size() == 5);
-    int64_t arg1 = parse_register(tokens[1]);
-    bool two_imm = (tokens[2].find("%") == std::string::npos);
-    int64_t arg2 = two_imm ? parse_immediate(tokens[2])
-                       : parse_register(tokens[2]);
-    bool three_imm = (tokens[3].find("%") == std::string::npos);
-    int64_t arg3 = three_imm ? parse_immediate(tokens[3])
-                         : parse_register(tokens[3]);
-    bool negate;
-    int64_t arg4 = parse_predicate(tokens[4], negate);
-    result = new PTXSelectPred(arg1, arg2, arg3, arg4, negate,
-                               two_imm, three_imm, line_num);
-    return true;
+    if (!immediate[i])
+      args[i+1] = program->get_register_slot(args[i+1]);
   }
-  return false;
+  predicate = program->get_predicate_slot(predicate);
+}
+
+void PTXSelectPred::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_SELECT_PREDICATE;
+  code.flags = negate;
+  code.dst = args[0];
+  for (int i = 0; i < 2; i++)
+    code.src[i] = immediate[i] ? 
+      program->get_constant_slot(args[i+1]) : args[i+1];
+  code.src[2] = predicate;
+}
+
+/*static*/
+bool PTXSelectPred::interpret(const std::string &line,
+                              const std::vector<std::string> &tokens,
+                              int line_num, PTXInstruction *&result)
+{
+  assert(tokens.size() == 5);
+  int64_t arg1 = parse_register(tokens[1]);
+  bool two_imm = (tokens[2].find("%") == std::string::npos);
+  int64_t arg2 = two_imm ? parse_immediate(tokens[2])
+                     : parse_register(tokens[2]);
+  bool three_imm = (tokens[3].find("%") == std::string::npos);
+  int64_t arg3 = three_imm ? parse_immediate(tokens[3])
+                       : parse_register(tokens[3]);
+  bool negate;
+  int64_t arg4 = parse_predicate(tokens[4], negate);
+  result = new PTXSelectPred(arg1, arg2, arg3, arg4, negate,
+                             two_imm, three_imm, line_num);
+  return true;
 }
 
 PTXBarrier::PTXBarrier(int64_t n, int64_t c, bool s, 
@@ -1629,12 +1934,7 @@ PTXInstruction* PTXBarrier::emulate(Thread *thread)
   }
   else
     count_value = count;
-  WeftInstruction *instruction;
-  if (sync)
-    instruction = new BarrierSync(name_value, count_value, this, thread);
-  else
-    instruction = new BarrierArrive(name_value, count_value, this, thread);
-  thread->add_instruction(instruction);
+  thread->add_barrier(this, sync, name_value, count_value);
   thread->update_max_barrier_name(name_value);
   return next;
 }
@@ -1674,56 +1974,62 @@ void PTXBarrier::update_count(unsigned arrival_count)
   }
 }
 
+void PTXBarrier::assign_slots(Program *program)
+{
+  if (!name_immediate)
+    name = program->get_register_slot(name);
+  if (!count_immediate)
+    count = program->get_register_slot(count);
+}
+
 /*static*/
-bool PTXBarrier::interpret(const std::string &line, int line_num,
-                           PTXInstruction *&result)
-{
-  if ((line.find("bar.") != std::string::npos) &&
-      (line.find("membar.") == std::string::npos))
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert((tokens.size() == 2) || (tokens.size() == 3));
-    bool name_immediate = false;
-    int64_t name;
-    if (tokens[1].find("%") == std::string::npos)
+bool PTXBarrier::interpret(const std::string &line,
+                           const std::vector<std::string> &tokens,
+                           int line_num, PTXInstruction *&result)
+{
+  assert((tokens.size() == 2) || (tokens.size() == 3));
+  bool name_immediate = false;
+  int64_t name;
+  if (tokens[1].find("%") == std::string::npos)
+  {
+    name = parse_immediate(tokens[1]);
+    name_immediate = true;
+  }
+  else
+    name = parse_register(tokens[1]);
+  int64_t count = -1;
+  bool count_immediate = false;
+  if (tokens.size() == 3)
+  {
+    if (tokens[2].find("%") == std::string::npos)
     {
-      name = parse_immediate(tokens[1]);
-      name_immediate = true;
+      count = parse_immediate(tokens[2]);
+      count_immediate = true;
     }
     else
-      name = parse_register(tokens[1]);
-    int64_t count = -1;
-    bool count_immediate = false;
-    if (tokens.size() == 3)
-    {
-      if (tokens[2].find("%") == std::string::npos)
-      {
-        count = parse_immediate(tokens[2]);
-        count_immediate = true;
-      }
-      else
-        count = parse_register(tokens[2]);
-    }
-    bool sync = (line.find("arrive") == std::string::npos);
-    result = new PTXBarrier(name, count, sync, name_immediate, 
-                            count_immediate, line_num);
-    return true;
+      count = parse_register(tokens[2]);
   }
-  return false;
+  bool sync = (tokens[0].find("arrive") == std::string::npos);
+  result = new PTXBarrier(name, count, sync, name_immediate, 
+                          count_immediate, line_num);
+  return true;
 }
 
 PTXSharedAccess::PTXSharedAccess(int64_t ad, int64_t o, bool w, 
-                                 bool has, int64_t ag, bool imm, int line_num)
+                                 bool has, int64_t ag, bool imm, 
+                                 int log, int line_num)
   : PTXInstruction(PTX_SHARED_ACCESS, line_num), has_name(false),
-    addr(ad), offset(o), arg(ag), write(w), has_arg(has), immediate(imm)
+    addr(ad), offset(o), arg(ag), write(w), has_arg(has), immediate(imm),
+    log_width(log)
 {
 }
 
 PTXSharedAccess::PTXSharedAccess(const std::string &n, int64_t o, bool w,
-                                 bool has, int64_t a, bool imm, int line_num)
+                                 bool has, int64_t a, bool imm, 
+                                 int log, int line_num)
   : PTXInstruction(PTX_SHARED_ACCESS, line_num), has_name(true),
-    name(n), offset(o), arg(a), write(w), has_arg(has), immediate(imm)
+    name(n), offset(o), arg(a), write(w), has_arg(has), immediate(imm),
+    log_width(log)
 {
 }
 
@@ -1738,13 +2044,7 @@ PTXInstruction* PTXSharedAccess::emulate(Thread *thread)
   else if (!thread->get_value(addr, value))
     return next;
   int64_t address = value + offset;
-  WeftAccess *instruction;
-  if (write)
-    instruction = new SharedWrite(address, this, thread);
-  else
-    instruction = new SharedRead(address, this, thread);
-  thread->add_instruction(instruction);
-  thread->update_shared_memory(instruction);
+  thread->add_shared_access(this, write, address, log_width);
   return next;
 }
 
@@ -1771,10 +2071,8 @@ PTXInstruction* PTXSharedAccess::emulate_warp(Thread **threads,
       else if (!threads[i]->get_value(addr, addr_value))
         continue;
       int64_t address = addr_value + offset;
-      WeftAccess *instruction = 
-        new SharedWrite(address, this, threads[i], shared_access_id);
-      threads[i]->add_instruction(instruction);
-      threads[i]->update_shared_memory(instruction);
+      threads[i]->add_shared_access(this, true/*write*/, address, 
+                                    log_width, shared_access_id);
       if (has_arg)
       {
         if (!immediate)
@@ -1803,10 +2101,8 @@ PTXInstruction* PTXSharedAccess::emulate_warp(Thread **threads,
       else if (!threads[i]->get_value(addr, addr_value))
         continue;
       int64_t address = addr_value + offset;
-      WeftAccess *instruction = 
-        new SharedRead(address, this, threads[i], shared_access_id);
-      threads[i]->add_instruction(instruction);
-      threads[i]->update_shared_memory(instruction);
+      threads[i]->add_shared_access(this, false/*write*/, address, 
+                                    log_width, shared_access_id);
       if (has_arg)
       {
         assert(!immediate);
@@ -1821,79 +2117,99 @@ PTXInstruction* PTXSharedAccess::emulate_warp(Thread **threads,
   return next;
 }
 
+void PTXSharedAccess::assign_slots(Program *program)
+{
+  if (!has_name)
+    addr = program->get_register_slot(addr);
+  // Loads define their argument and stores use it
+  if (has_arg && !immediate)
+    arg = write ? program->get_register_slot(arg) 
+                : program->get_destination_slot(arg);
+}
+
 /*static*/
-bool PTXSharedAccess::interpret(const std::string &line, int line_num,
-                                PTXInstruction *&result)
-{
-  if ((line.find(".shared.") != std::string::npos) &&
-      (line.find(".align.") == std::string::npos))
-  {
-    
-    bool write = (line.find("st.") != std::string::npos);
-    int64_t addr = 0;
-    int64_t offset = 0;   
-    std::string name;
-    bool has_name = false;
-    // First check to see if it has an offset
-    if (line.find("+") != std::string::npos)
-    {
-      // Offset
-      int start = line.find("[") + 1;
-      int end = line.find("+");
-      name = line.substr(start, end - start);
-      if (name.find("%") != std::string::npos)
-        addr = parse_register(name);
-      else
-        has_name = true;
-      // Now parse the offset
-      offset = parse_immediate(line.substr(end+1));
-    }
+bool PTXSharedAccess::interpret(const std::string &line,
+                                const std::vector<std::string> &tokens,
+                                int line_num, PTXInstruction *&result)
+{
+  // Guarded accesses are still modeled as happening unconditionally
+  const std::string &opcode = (tokens[0][0] == '@') ? tokens[1] : tokens[0];
+  if (opcode.find(".shared") == std::string::npos)
+    return false;
+  bool write = (opcode.find("st.") == 0);
+  int64_t addr = 0;
+  int64_t offset = 0;   
+  std::string name;
+  bool has_name = false;
+  // First check to see if it has an offset
+  if (line.find("+") != std::string::npos)
+  {
+    // Offset
+    int start = line.find("[") + 1;
+    int end = line.find("+");
+    name = line.substr(start, end - start);
+    if (name.find("%") != std::string::npos)
+      addr = parse_register(name);
+    else
+      has_name = true;
+    // Now parse the offset
+    offset = parse_immediate(line.substr(end+1));
+  }
+  else
+  {
+    // No Offset
+    int start = line.find("[") + 1;
+    int end = line.find("]");
+    name = line.substr(start, end - start);
+    if (name.find("%") != std::string::npos)
+      addr = parse_register(name);
     else
+      has_name = true;
+  }
+  // Now parse the other argument
+  bool has_arg = false;
+  bool immediate = false;
+  int64_t arg = 0;
+  if (tokens.size() == 3)
+  {
+    has_arg = true;
+    if (write)
     {
-      // No Offset
-      int start = line.find("[") + 1;
-      int end = line.find("]");
-      name = line.substr(start, end - start);
-      if (name.find("%") != std::string::npos)
-        addr = parse_register(name);
+      immediate = (tokens[2].find("%") == std::string::npos);
+      if (immediate)
+        arg = parse_immediate(tokens[2]);
       else
-        has_name = true;
+        arg = parse_register(tokens[2]);
     }
-    // Now parse the other argument
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    bool has_arg = false;
-    bool immediate = false;
-    int64_t arg = 0;
-    if (tokens.size() == 3)
+    else
     {
-      has_arg = true;
-      if (write)
-      {
-        immediate = (tokens[2].find("%") == std::string::npos);
-        if (immediate)
-          arg = parse_immediate(tokens[2]);
-        else
-          arg = parse_register(tokens[2]);
-      }
+      immediate = (tokens[1].find("%") == std::string::npos);
+      if (immediate)
+        arg = parse_immediate(tokens[1]);
       else
-      {
-        immediate = (tokens[1].find("%") == std::string::npos);
-        if (immediate)
-          arg = parse_immediate(tokens[1]);
-        else
-          arg = parse_register(tokens[1]);
-      }
+        arg = parse_register(tokens[1]);
     }
-    if (has_name)
-      result = new PTXSharedAccess(name, offset, write, has_arg,
-                                   arg, immediate, line_num);
-    else
-      result = new PTXSharedAccess(addr, offset, write, has_arg, 
-                                   arg, immediate, line_num);
-    return true;
   }
-  return false;
+  // The bytes accessed are the vector count times the bits of the 
+  // type which is always the last qualifier on the opcode
+  int vector = 1, bits = 8;
+  if (opcode.find(".v2.") != std::string::npos)
+    vector = 2;
+  else if (opcode.find(".v4.") != std::string::npos)
+    vector = 4;
+  if ((sscanf(opcode.c_str() + opcode.rfind(".") + 1, "%*c%d", &bits) != 1) ||
+      (bits < 8))
+    bits = 8;
+  int log_width = 0;
+  while (((1 << log_width) * 8) < (vector * bits) && (log_width < 7))
+    log_width++;
+  if (has_name)
+    result = new PTXSharedAccess(name, offset, write, has_arg,
+                                 arg, immediate, log_width, line_num);
+  else
+    result = new PTXSharedAccess(addr, offset, write, has_arg, 
+                                 arg, immediate, log_width, line_num);
+  return true;
 }
 
 PTXConvert::PTXConvert(int64_t zero, int64_t one, int line_num)
@@ -1910,21 +2226,30 @@ PTXInstruction* PTXConvert::emulate(Thread *thread)
   return next;
 }
 
+void PTXConvert::assign_slots(Program *program)
+{
+  src = program->get_register_slot(src);
+  dst = program->get_destination_slot(dst);
+}
+
+void PTXConvert::compile(Program *program, CompiledInstruction &code) const
+{
+  // Conversions don't change values so they are just moves
+  code.opcode = COMPILED_MOVE;
+  code.dst = dst;
+  code.src[0] = src;
+}
+
 /*static*/
-bool PTXConvert::interpret(const std::string &line, int line_num,
-                           PTXInstruction *&result)
+bool PTXConvert::interpret(const std::string &line,
+                           const std::vector<std::string> &tokens,
+                           int line_num, PTXInstruction *&result)
 {
-  if (line.find("cvt.") != std::string::npos)
-  {
-    std::vector<std::string> tokens; 
-    split(tokens, line.c_str());
-    assert(tokens.size() == 3);
-    int64_t arg1 = parse_register(tokens[1]);
-    int64_t arg2 = parse_register(tokens[2]);
-    result = new PTXConvert(arg1, arg2, line_num);
-    return true;
-  }
-  return false;
+  assert(tokens.size() == 3);
+  int64_t arg1 = parse_register(tokens[1]);
+  int64_t arg2 = parse_register(tokens[2]);
+  result = new PTXConvert(arg1, arg2, line_num);
+  return true;
 }
 
 PTXConvertAddress::PTXConvertAddress(int64_t zero, int64_t one, int line_num)
@@ -1957,29 +2282,41 @@ PTXInstruction* PTXConvertAddress::emulate(Thread *thread)
   return next;
 }
 
+void PTXConvertAddress::assign_slots(Program *program)
+{
+  if (!has_name)
+    src = program->get_register_slot(src);
+  dst = program->get_destination_slot(dst);
+}
+
+void PTXConvertAddress::compile(Program *program, CompiledInstruction &code) const
+{
+  // Global names still need emulate to find their location
+  if (has_name)
+    return;
+  code.opcode = COMPILED_MOVE;
+  code.dst = dst;
+  code.src[0] = src;
+}
+
 /*static*/
-bool PTXConvertAddress::interpret(const std::string &line, int line_num,
-                                  PTXInstruction *&result)
+bool PTXConvertAddress::interpret(const std::string &line,
+                                  const std::vector<std::string> &tokens,
+                                  int line_num, PTXInstruction *&result)
 {
-  if (line.find("cvta.") != std::string::npos)
+  assert(tokens.size() == 3);
+  int64_t arg1 = parse_register(tokens[1]);
+  if (tokens[2].find("%") != std::string::npos)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 3);
-    int64_t arg1 = parse_register(tokens[1]);
-    if (tokens[2].find("%") != std::string::npos)
-    {
-      int64_t arg2 = parse_register(tokens[2]);
-      result = new PTXConvertAddress(arg1, arg2, line_num);
-    }
-    else
-    {
-      std::string name = tokens[2].substr(0, tokens[2].size()-1);
-      result = new PTXConvertAddress(arg1, name, line_num);
-    }
-    return true;
+    int64_t arg2 = parse_register(tokens[2]);
+    result = new PTXConvertAddress(arg1, arg2, line_num);
   }
-  return false;
+  else
+  {
+    std::string name = tokens[2].substr(0, tokens[2].size()-1);
+    result = new PTXConvertAddress(arg1, name, line_num);
+  }
+  return true;
 }
 
 PTXBitFieldExtract::PTXBitFieldExtract(int64_t a[4], bool imm[4], int line_num)
@@ -2011,28 +2348,42 @@ PTXInstruction* PTXBitFieldExtract::emulate(Thread *thread)
   return next;
 }
 
+void PTXBitFieldExtract::assign_slots(Program *program)
+{
+  args[0] = program->get_destination_slot(args[0]);
+  for (int i = 1; i < 4; i++)
+  {
+    if (!immediate[i])
+      args[i] = program->get_register_slot(args[i]);
+  }
+}
+
+void PTXBitFieldExtract::compile(Program *program, CompiledInstruction &code) const
+{
+  code.opcode = COMPILED_BFE;
+  code.dst = args[0];
+  for (int i = 0; i < 3; i++)
+    code.src[i] = immediate[i+1] ? 
+      program->get_constant_slot(args[i+1]) : args[i+1];
+}
+
 /*static*/
-bool PTXBitFieldExtract::interpret(const std::string &line, int line_num,
-                                   PTXInstruction *&result)
+bool PTXBitFieldExtract::interpret(const std::string &line,
+                                   const std::vector<std::string> &tokens,
+                                   int line_num, PTXInstruction *&result)
 {
-  if (line.find("bfe.") != std::string::npos)
+  assert(tokens.size() == 5);
+  int64_t args[4];
+  bool immediate[4];
+  for (int i = 0; i < 4; i++)
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 5);
-    int64_t args[4];
-    bool immediate[4];
-    for (int i = 0; i < 4; i++)
-    {
-      const bool imm = (tokens[i+1].find("%") == std::string::npos);
-      immediate[i] = imm;
-      args[i] = imm ? parse_immediate(tokens[i+1])
-                    : parse_register(tokens[i+1]);
-    }
-    result = new PTXBitFieldExtract(args, immediate, line_num);
-    return true;
+    const bool imm = (tokens[i+1].find("%") == std::string::npos);
+    immediate[i] = imm;
+    args[i] = imm ? parse_immediate(tokens[i+1])
+                  : parse_register(tokens[i+1]);
   }
-  return false;
+  result = new PTXBitFieldExtract(args, immediate, line_num);
+  return true;
 }
 
 PTXShuffle::PTXShuffle(ShuffleKind k, int64_t a[4], bool imm[4], int line_num)
@@ -2086,7 +2437,7 @@ PTXInstruction* PTXShuffle::emulate_warp(Thread **threads,
   // Now that we've got all the inputs, compute the shuffle
   for (int lane = 0; lane < WARP_SIZE; lane++)
   {
-    int64_t b, c, dst;
+    int64_t b, c;
     if (immediate[2])
       b = args[2];
     else if (!threads[lane]->get_value(args[2], b))
@@ -2096,8 +2447,6 @@ PTXInstruction* PTXShuffle::emulate_warp(Thread **threads,
     else if (!threads[lane]->get_value(args[3], c))
       continue;
     assert(!immediate[0]);
-    if (!threads[lane]->get_value(args[0], dst))
-      continue;
 
     int bval = b & 0x1f;
     int mask = (c & 0x1f00) >> 8;
@@ -2141,45 +2490,50 @@ PTXInstruction* PTXShuffle::emulate_warp(Thread **threads,
       value = inputs[lane];
     else
       value = inputs[src];
-    threads[lane]->set_value(dst, value);
+    threads[lane]->set_value(args[0], value);
   }
   return next;
 }
 
+void PTXShuffle::assign_slots(Program *program)
+{
+  args[0] = program->get_destination_slot(args[0]);
+  for (int i = 1; i < 4; i++)
+  {
+    if (!immediate[i])
+      args[i] = program->get_register_slot(args[i]);
+  }
+}
+
 /*static*/
-bool PTXShuffle::interpret(const std::string &line, int line_num,
-                           PTXInstruction *&result)
-{
-  if (line.find("shfl.") != std::string::npos)
-  {
-    ShuffleKind kind;
-    if (line.find(".up") != std::string::npos)
-      kind = SHUFFLE_UP;
-    else if (line.find(".down") != std::string::npos)
-      kind = SHUFFLE_DOWN;
-    else if (line.find(".bfly") != std::string::npos)
-      kind = SHUFFLE_BUTTERFLY;
-    else
-    {
-      assert(line.find(".idx") != std::string::npos);
-      kind = SHUFFLE_IDX;
-    }
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 5);
-    int64_t args[4];
-    bool immediate[4];
-    for (int i = 0; i < 4; i++)
-    {
-      const bool imm = (tokens[i+1].find("%") == std::string::npos);
-      immediate[i] = imm;
-      args[i] = imm ? parse_immediate(tokens[i+1])
-                    : parse_register(tokens[i+1]);
-    }
-    result = new PTXShuffle(kind, args, immediate, line_num);
-    return true;
+bool PTXShuffle::interpret(const std::string &line,
+                           const std::vector<std::string> &tokens,
+                           int line_num, PTXInstruction *&result)
+{
+  ShuffleKind kind;
+  if (tokens[0].find(".up") != std::string::npos)
+    kind = SHUFFLE_UP;
+  else if (tokens[0].find(".down") != std::string::npos)
+    kind = SHUFFLE_DOWN;
+  else if (tokens[0].find(".bfly") != std::string::npos)
+    kind = SHUFFLE_BUTTERFLY;
+  else
+  {
+    assert(tokens[0].find(".idx") != std::string::npos);
+    kind = SHUFFLE_IDX;
   }
-  return false;
+  assert(tokens.size() == 5);
+  int64_t args[4];
+  bool immediate[4];
+  for (int i = 0; i < 4; i++)
+  {
+    const bool imm = (tokens[i+1].find("%") == std::string::npos);
+    immediate[i] = imm;
+    args[i] = imm ? parse_immediate(tokens[i+1])
+                  : parse_register(tokens[i+1]);
+  }
+  result = new PTXShuffle(kind, args, immediate, line_num);
+  return true;
 }
 
 PTXExit::PTXExit(int line_num)
@@ -2205,7 +2559,8 @@ PTXInstruction* PTXExit::emulate(Thread *thread)
     if (thread->program->weft->report_warnings())
     {
       char buffer[11];
-      decompress_identifier(predicate, buffer, 11);
+      decompress_identifier(thread->program->get_predicate_name(predicate),
+                            buffer, 11);
       fprintf(stderr,"WEFT WARNING: Exit depends on undefined "
                      "predicate %s\n", buffer);
     }
@@ -2240,7 +2595,8 @@ PTXInstruction* PTXExit::emulate_warp(Thread **threads,
         if (threads[i]->program->weft->report_warnings())
         {
           char buffer[11];
-          decompress_identifier(predicate, buffer, 11);
+          decompress_identifier(
+              threads[i]->program->get_predicate_name(predicate), buffer, 11);
           fprintf(stderr,"WEFT WARNING: Exit depends on undefined "
                          "predicate %s\n", buffer);
         }
@@ -2268,29 +2624,43 @@ PTXInstruction* PTXExit::emulate_warp(Thread **threads,
   return next;
 }
 
+void PTXExit::assign_slots(Program *program)
+{
+  if (has_predicate)
+    predicate = program->get_predicate_slot(predicate);
+}
+
+void PTXExit::compile(Program *program, CompiledInstruction &code) const
+{
+  if (!has_predicate)
+  {
+    code.opcode = COMPILED_EXIT;
+    return;
+  }
+  // Predicated exits are handled like branches to nowhere
+  code.opcode = COMPILED_BRANCH;
+  code.flags = negate;
+  code.src[0] = predicate;
+  code.target = -1;
+}
+
 /*static*/
-bool PTXExit::interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result)
+bool PTXExit::interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result)
 {
   // We'll model both return and exit the same
-  if ((line.find("exit") != std::string::npos) ||
-      (line.find("ret") != std::string::npos))
+  if (tokens.size() == 2)
   {
-    std::vector<std::string> tokens; 
-    split(tokens, line.c_str());
-    if (tokens.size() == 2)
-    {
-      bool negate;
-      int64_t predicate = parse_predicate(tokens[0], negate);
-      result = new PTXExit(predicate, negate, line_num);
-    }
-    else if(tokens.size() == 1)
-      result = new PTXExit(line_num);
-    else
-      assert(false);
-    return true;
+    bool negate;
+    int64_t predicate = parse_predicate(tokens[0], negate);
+    result = new PTXExit(predicate, negate, line_num);
   }
-  return false;
+  else if(tokens.size() == 1)
+    result = new PTXExit(line_num);
+  else
+    assert(false);
+  return true;
 }
 
 PTXGlobalDecl::PTXGlobalDecl(char *n, int *v, size_t s, int line_num)
@@ -2306,53 +2676,52 @@ PTXInstruction* PTXGlobalDecl::emulate(Thread *thread)
 }
 
 /*static*/
-bool PTXGlobalDecl::interpret(const std::string &line, int line_num,
-                              PTXInstruction *&result)
-{
-  if ((line.find(".const .align") != std::string::npos) ||
-      (line.find(".global .align") != std::string::npos))
-  {
-    // Assume byte loading
-    int start = line.find(".b8");
-    // Jump to the start of the name
-    int name_start = start + 4;
-    int name_end = line.find("[");
-    std::string name = line.substr(name_start, name_end - name_start);
-    int size_start = name_end+1;
-    int size_end = line.find("]");
-    std::string size_str = line.substr(size_start, size_start - size_end);
-    size_t bytes = atoi(size_str.c_str());
-    assert((bytes % 4) == 0);
-    size_t size = bytes/4;
-    int *values = (int*)malloc(bytes);
-    // Read in the numbers
-    int index = line.find("{");
-    for (unsigned i = 0; i < size; i++)
+bool PTXGlobalDecl::interpret(const std::string &line,
+                              const std::vector<std::string> &tokens,
+                              int line_num, PTXInstruction *&result)
+{
+  // Only aligned byte arrays with initializers are modeled
+  if (line.find(".align") == std::string::npos)
+    return false;
+  // Assume byte loading
+  int start = line.find(".b8");
+  // Jump to the start of the name
+  int name_start = start + 4;
+  int name_end = line.find("[");
+  std::string name = line.substr(name_start, name_end - name_start);
+  int size_start = name_end+1;
+  int size_end = line.find("]");
+  std::string size_str = line.substr(size_start, size_start - size_end);
+  size_t bytes = atoi(size_str.c_str());
+  assert((bytes % 4) == 0);
+  size_t size = bytes/4;
+  int *values = (int*)malloc(bytes);
+  // Read in the numbers
+  int index = line.find("{");
+  for (unsigned i = 0; i < size; i++)
+  {
+    int value = 0;
+    for (int j = 0; j < 4; j++)
     {
-      int value = 0;
-      for (int j = 0; j < 4; j++)
-      {
-        // Read until we get to a number
-        while ((line[index] < '0') ||
-               (line[index] > '9'))
-          index++;
-        // We know these are never longer than 4 bytes;
-        char buffer[4];
-        int local_index = 0;
-        while ((line[index] >= '0') &&
-               (line[index] <= '9'))
-          buffer[local_index++] = line[index++];
-        assert(local_index < 4);
-        buffer[local_index] = '\0';
-        int temp = atoi(buffer);
-        value |= (temp << (j*8));
-      }
-      values[i] = value;
+      // Read until we get to a number
+      while ((line[index] < '0') ||
+             (line[index] > '9'))
+        index++;
+      // We know these are never longer than 4 bytes;
+      char buffer[4];
+      int local_index = 0;
+      while ((line[index] >= '0') &&
+             (line[index] <= '9'))
+        buffer[local_index++] = line[index++];
+      assert(local_index < 4);
+      buffer[local_index] = '\0';
+      int temp = atoi(buffer);
+      value |= (temp << (j*8));
     }
-    result = new PTXGlobalDecl(strdup(name.c_str()), values, size, line_num);
-    return true;
+    values[i] = value;
   }
-  return false;
+  result = new PTXGlobalDecl(strdup(name.c_str()), values, size, line_num);
+  return true;
 }
 
 PTXGlobalLoad::PTXGlobalLoad(int64_t d, int64_t a, int line_num)
@@ -2368,125 +2737,48 @@ PTXInstruction* PTXGlobalLoad::emulate(Thread *thread)
   return next;
 }
 
-/*static*/
-bool PTXGlobalLoad::interpret(const std::string &line, int line_num,
-                              PTXInstruction *&result)
-{
-  if (line.find("ld.global") != std::string::npos)
-  {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
-    assert(tokens.size() == 3);
-    int arg1 = parse_register(tokens[1]);
-    int arg2 = parse_register(tokens[2]);
-    result = new PTXGlobalLoad(arg1, arg2, line_num);
-    return true;
-  }
-  return false;
-}
-
-WeftInstruction::WeftInstruction(PTXInstruction *inst, Thread *t)
-  : instruction(inst), thread(t), thread_line_number(t->get_program_size()),
-    happens_relationship(NULL)
-{
-}
-
-void WeftInstruction::initialize_happens(Happens *happens)
-{
-  assert(happens != NULL);
-  assert(happens_relationship == NULL);
-  happens_relationship = happens;
-}
-
-WeftBarrier::WeftBarrier(int n, int c, PTXBarrier *bar, Thread *thread)
-  : WeftInstruction(bar, thread), name(n), count(c), 
-    barrier(bar), instance(NULL)
-{
-}
-
-void WeftBarrier::set_instance(BarrierInstance *inst)
+void PTXGlobalLoad::assign_slots(Program *program)
 {
-  assert(instance == NULL);
-  assert(inst != NULL);
-  instance = inst;
+  dst = program->get_destination_slot(dst);
 }
 
-BarrierSync::BarrierSync(int n, int c, PTXBarrier *bar, Thread *thread)
-  : WeftBarrier(n, c, bar, thread)
-{ 
-}
-
-void BarrierSync::print_instruction(FILE *target)
-{
-  fprintf(target,"bar.sync %d, %d;\n", name, count);
-}
-
-BarrierArrive::BarrierArrive(int n, int c, PTXBarrier *bar, Thread *thread)
-  : WeftBarrier(n, c, bar, thread)
-{
-}
-
-void BarrierArrive::print_instruction(FILE *target)
-{
-  fprintf(target,"bar.arrive %d, %d;\n", name, count);
-}
-
-WeftAccess::WeftAccess(int addr, PTXSharedAccess *acc, 
-                       Thread *thread, int acc_id)
-  : WeftInstruction(acc, thread), address(addr), access(acc), access_id(acc_id)
-{
-}
-
-bool WeftAccess::has_happens_relationship(WeftAccess *other)
-{
-  // If they are the same thread, then we are done
-  if (thread == other->thread)
-    return true;
-  assert(happens_relationship != NULL);
-  int thread_id = other->thread->thread_id;
-  int line_number = other->thread_line_number;
-  return happens_relationship->has_happens(thread_id, line_number);
-}
-
-bool WeftAccess::is_warp_synchronous(WeftAccess *other)
-{
-  // Check to see if the threads are in the same warp
-  int local_wid = thread->thread_id/WARP_SIZE;
-  int other_wid = other->thread->thread_id/WARP_SIZE;
-  if (local_wid != other_wid)
-    return false;
-  // We should only be here if we assumed warp synchronous
-  // execution and therefore access IDs are non-negative.
-  assert(access_id >= 0);
-  assert(other->access_id >= 0);
-  // If they are in the same warp, check to see if they have
-  // the same access_id.  If they do, then we cannot use 
-  // warp-synchronous execution to avoid the race test.
-  // If they come from different access IDs then we know
-  // they can't have happened at the same time because
-  // warps execute in lock step.
-  return (access_id != other->access_id);
-}
-
-SharedWrite::SharedWrite(int addr, PTXSharedAccess *acc, 
-                         Thread *thread, int acc_id /*=-1*/)
-  : WeftAccess(addr, acc, thread, acc_id)
-{
-}
-
-void SharedWrite::print_instruction(FILE *target)
-{
-  fprintf(target,"write shared[%d];\n", address);
-}
-
-SharedRead::SharedRead(int addr, PTXSharedAccess *acc, 
-                       Thread *thread, int acc_id /*=-1*/)
-  : WeftAccess(addr, acc, thread, acc_id)
+/*static*/
+bool PTXGlobalLoad::interpret(const std::string &line,
+                              const std::vector<std::string> &tokens,
+                              int line_num, PTXInstruction *&result)
 {
+  assert(tokens.size() == 3);
+  int arg1 = parse_register(tokens[1]);
+  int arg2 = parse_register(tokens[2]);
+  result = new PTXGlobalLoad(arg1, arg2, line_num);
+  return true;
 }
 
-void SharedRead::print_instruction(FILE *target)
+void WeftInstruction::print_instruction(FILE *target) const
 {
-  fprintf(target,"read shared[%d];\n", address);
+  switch (get_kind())
+  {
+    case WEFT_SHARED_READ:
+      {
+        fprintf(target,"read shared[%d];\n", get_address());
+        break;
+      }
+    case WEFT_SHARED_WRITE:
+      {
+        fprintf(target,"write shared[%d];\n", get_address());
+        break;
+      }
+    case WEFT_BARRIER_SYNC:
+      {
+        fprintf(target,"bar.sync %d, %d;\n", get_name(), get_count());
+        break;
+      }
+    case WEFT_BARRIER_ARRIVE:
+      {
+        fprintf(target,"bar.arrive %d, %d;\n", get_name(), get_count());
+        break;
+      }
+    default:
+      assert(false);
+  }
 }
-
@@ -102,17 +102,67 @@ inline void split(std::vector<std::string> &results,
 }
 
 class Thread;
+class Program;
+class PTXInstruction;
 class PTXLabel;
 class PTXBranch;
 class PTXBarrier;
-class WeftBarrier;
-class WeftAccess;
-class BarrierSync;
-class BarrierArrive;
-class SharedWrite;
-class SharedRead;
+class PTXMove;
+class PTXSharedDecl;
 class SharedStore;
 class BarrierInstance;
+struct ThreadState;
+
+// The opcodes for the pre-decoded form of instructions that
+// Program::emulate interprets, anything without a specialized
+// opcode goes through the virtual emulate method
+enum CompiledOpcode {
+  COMPILED_EMULATE,
+  COMPILED_NOP,
+  COMPILED_MOVE,
+  COMPILED_RIGHT_SHIFT,
+  COMPILED_LEFT_SHIFT,
+  COMPILED_AND,
+  COMPILED_OR,
+  COMPILED_XOR,
+  COMPILED_NOT,
+  COMPILED_ADD,
+  COMPILED_SUB,
+  COMPILED_NEGATE,
+  COMPILED_MULTIPLY,
+  COMPILED_MAD,
+  COMPILED_BFE,
+  COMPILED_SET_PREDICATE,
+  COMPILED_SELECT_PREDICATE,
+  COMPILED_AND_PREDICATE,
+  COMPILED_OR_PREDICATE,
+  COMPILED_XOR_PREDICATE,
+  COMPILED_NOT_PREDICATE,
+  COMPILED_BRANCH,
+  COMPILED_UNIFORM_BRANCH,
+  COMPILED_EXIT,
+  COMPILED_UNIFORM, // evaluated once per CTA, see Program::find_uniform_registers
+};
+
+// All operands are register or predicate slots, immediates
+// are given constant register slots by Program::get_constant_slot.
+// Program counters are indexes into the compiled instructions
+// with -1 indicating that the thread has exitted.
+struct CompiledInstruction {
+public:
+  CompiledInstruction(void)
+    : opcode(COMPILED_EMULATE), flags(0), dst(-1), 
+      next(-1), target(-1), instruction(NULL)
+    { src[0] = -1; src[1] = -1; src[2] = -1; }
+public:
+  CompiledOpcode opcode;
+  int flags; // comparison kind or predicate negation
+  int dst;
+  int src[3];
+  int next;
+  int target;
+  PTXInstruction *instruction;
+};
 
 class PTXInstruction {
 public:
@@ -127,22 +177,39 @@ public:
                                        ThreadState *thread_state,
                                        int &shared_access_id,
                                        SharedStore &store);
+  // Rewrite register operands into dense slot indices once the
+  // whole program has been parsed, see Program::convert_to_instructions
+  virtual void assign_slots(Program *program) { }
+  // Fill in the pre-decoded form of this instruction after slots have 
+  // been assigned, by default we fall back to the emulate method
+  virtual void compile(Program *program, CompiledInstruction &code) const
+    { code.opcode = COMPILED_EMULATE; }
 public:
   virtual bool is_label(void) const { return false; }
   virtual bool is_branch(void) const { return false; } 
   virtual bool is_barrier(void) const { return false; }
   virtual bool is_shuffle(void) const { return false; }
+  virtual bool is_move(void) const { return false; }
+  virtual bool is_shared_decl(void) const { return false; }
 public:
   virtual PTXLabel* as_label(void) { return NULL; }
+  virtual PTXMove* as_move(void) { return NULL; }
+  virtual PTXSharedDecl* as_shared_decl(void) { return NULL; }
   virtual PTXBranch* as_branch(void) { return NULL; }
   virtual PTXBarrier* as_barrier(void) { return NULL; }
 public:
   inline PTXKind get_kind(void) const { return kind; }
 public:
   void set_next(PTXInstruction *next);
+  inline PTXInstruction* get_next(void) const { return next; }
+  inline void set_program_counter(int pc) { program_counter = pc; }
+  inline int get_program_counter(void) const { return program_counter; }
   void set_source_location(const char *file, int line);
 public:
-  static PTXInstruction* interpret(const std::string &line, int line_num);
+  // Tokens are the line already split by the caller
+  static PTXInstruction* interpret(const std::string &line,
+                                   const std::vector<std::string> &tokens,
+                                   int line_num);
   static const char* get_kind_name(PTXKind k);
 public:
   static uint64_t compress_identifier(const char *buffer, size_t buffer_size);
@@ -152,6 +219,7 @@ public:
   const int line_number;
 protected:
   PTXInstruction *next;
+  int program_counter;
 public:
   const char *source_file;
   int source_line_number;
@@ -171,6 +239,7 @@ public:
                                        ThreadState *thread_state,
                                        int &shared_access_id,
                                        SharedStore &store);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 public:
   virtual bool is_label(void) const { return true; }
 public:
@@ -180,8 +249,9 @@ public:
 protected:
   std::string label;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXBranch : public PTXInstruction {
@@ -199,6 +269,8 @@ public:
                                        ThreadState *thread_state,
                                        int &shared_access_id,
                                        SharedStore &store);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 public:
   virtual bool is_branch(void) const { return true; }
 public:
@@ -206,18 +278,21 @@ public:
 public:
   void set_targets(const std::map<std::string,PTXLabel*> &labels);
 protected:
+  bool has_predicate;
   int64_t predicate;
   bool negate;
   std::string label;
   PTXLabel *target;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXSharedDecl : public PTXInstruction {
 public:
-  PTXSharedDecl(const std::string &name, int64_t address, int line_num);
+  PTXSharedDecl(const std::string &name, int64_t address, 
+                int64_t size, int line_num);
   PTXSharedDecl(const PTXSharedDecl &rhs) { assert(false); }
   virtual ~PTXSharedDecl(void) { }
 public:
@@ -225,12 +300,23 @@ public:
     { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+public:
+  virtual bool is_shared_decl(void) const { return true; }
+public:
+  virtual PTXSharedDecl* as_shared_decl(void) { return this; }
+public:
+  inline const std::string& get_name(void) const { return name; }
+  inline int64_t get_address(void) const { return address; }
+  inline int64_t get_size(void) const { return size; }
+  void assign_address(void);
 protected:
   std::string name;
   int64_t address;
+  int64_t size; // in bytes, zero if not declared
 public:
-  static bool interpret(const std::string &line, int line_num, 
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXMove : public PTXInstruction {
@@ -243,13 +329,23 @@ public:
   PTXMove& operator=(const PTXMove &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
+public:
+  virtual bool is_move(void) const { return true; }
+public:
+  virtual PTXMove* as_move(void) { return this; }
+public:
+  // The name of the shared memory location being moved if any
+  inline const std::string& get_shared_source(void) const { return source; }
 protected:
   int64_t args[2];
   std::string source;
   bool immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXRightShift : public PTXInstruction {
@@ -263,12 +359,15 @@ public:
     { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[3];
   bool immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXLeftShift : public PTXInstruction {
@@ -282,12 +381,15 @@ public:
     { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[3];
   bool immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXAnd : public PTXInstruction {
@@ -300,13 +402,16 @@ public:
   PTXAnd& operator=(const PTXAnd &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[3];
   bool immediate;
   bool predicate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXOr : public PTXInstruction {
@@ -319,13 +424,16 @@ public:
   PTXOr& operator=(const PTXOr &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[3];
   bool immediate;
   bool predicate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXXor : public PTXInstruction {
@@ -338,13 +446,16 @@ public:
   PTXXor& operator=(const PTXXor &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[3];
   bool immediate;
   bool predicate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXNot : public PTXInstruction {
@@ -356,12 +467,15 @@ public:
   PTXNot& operator=(const PTXNot &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[2];
   bool predicate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXAdd : public PTXInstruction {
@@ -374,12 +488,15 @@ public:
   PTXAdd& operator=(const PTXAdd &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[3];
   bool immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXSub : public PTXInstruction {
@@ -392,12 +509,15 @@ public:
   PTXSub& operator=(const PTXSub &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[3];
   bool immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXNeg : public PTXInstruction {
@@ -409,12 +529,15 @@ public:
   PTXNeg& operator=(const PTXNeg &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[2];
   bool immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXMul : public PTXInstruction {
@@ -427,12 +550,15 @@ public:
   PTXMul& operator=(const PTXMul &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[3];
   bool immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXMad : public PTXInstruction {
@@ -444,12 +570,15 @@ public:
   PTXMad& operator=(const PTXMad &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[4];
   bool immediate[4];
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXSetPred : public PTXInstruction {
@@ -460,6 +589,8 @@ public:
   virtual ~PTXSetPred(void) { }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 public:
   PTXSetPred& operator=(const PTXSetPred &rhs) { assert(false); return *this; }
 protected:
@@ -467,8 +598,9 @@ protected:
   CompType comparison;
   bool immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXSelectPred : public PTXInstruction {
@@ -481,14 +613,17 @@ public:
   PTXSelectPred& operator=(const PTXSelectPred &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   bool negate;
   int64_t predicate;
   int64_t args[3];
   bool immediate[2];
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXBarrier : public PTXInstruction {
@@ -501,6 +636,7 @@ public:
   PTXBarrier& operator=(const PTXBarrier &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
   // Override for warp-synchronous execution!
   virtual PTXInstruction* emulate_warp(Thread **threads,
                                        ThreadState *thread_state,
@@ -516,16 +652,19 @@ protected:
   bool sync;
   bool name_immediate, count_immediate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXSharedAccess : public PTXInstruction {
 public:
   PTXSharedAccess(int64_t addr, int64_t offset, bool write, 
-                  bool has_arg, int64_t arg, bool immediate, int line_num);
+                  bool has_arg, int64_t arg, bool immediate, 
+                  int log_width, int line_num);
   PTXSharedAccess(const std::string &name, int64_t offset, bool write,
-                  bool has_arg, int64_t arg, bool immediate, int line_num);
+                  bool has_arg, int64_t arg, bool immediate, 
+                  int log_width, int line_num);
   PTXSharedAccess(const PTXSharedAccess &rhs) { assert(false); }
   virtual ~PTXSharedAccess(void) { }
 public:
@@ -533,6 +672,7 @@ public:
     { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
   // Override for warp-synchronous execution!
   virtual PTXInstruction* emulate_warp(Thread **threads,
                                        ThreadState *thread_state,
@@ -543,9 +683,11 @@ protected:
   std::string name;
   int64_t addr, offset, arg;
   bool write, has_arg, immediate;
+  int log_width; // log2 of the bytes accessed
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXConvert : public PTXInstruction {
@@ -557,11 +699,14 @@ public:
   PTXConvert& operator=(const PTXConvert &rhs) { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t src, dst;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXConvertAddress : public PTXInstruction {
@@ -575,13 +720,16 @@ public:
   { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   bool has_name;
   int64_t src, dst;
   std::string name;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXBitFieldExtract : public PTXInstruction {
@@ -594,12 +742,15 @@ public:
     { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   int64_t args[4];
   bool immediate[4];
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXShuffle : public PTXInstruction {
@@ -619,6 +770,7 @@ public:
     { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
   // Override for warp-synchronous execution!
   virtual PTXInstruction* emulate_warp(Thread **threads,
                                        ThreadState *thread_state,
@@ -630,8 +782,9 @@ protected:
   int64_t args[4];
   bool immediate[4];
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXExit : public PTXInstruction {
@@ -650,13 +803,16 @@ public:
                                        ThreadState *thread_state,
                                        int &shared_access_id,
                                        SharedStore &store);
+  virtual void assign_slots(Program *program);
+  virtual void compile(Program *program, CompiledInstruction &code) const;
 protected:
   bool has_predicate;
   bool negate;
   int64_t predicate;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXGlobalDecl : public PTXInstruction {
@@ -674,8 +830,9 @@ protected:
   int *values;
   size_t size;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
 class PTXGlobalLoad : public PTXInstruction {
@@ -688,155 +845,75 @@ public:
     { assert(false); return *this; }
 public:
   virtual PTXInstruction* emulate(Thread *thread);
+  virtual void assign_slots(Program *program);
 protected:
   int64_t dst, addr;
 public:
-  static bool interpret(const std::string &line, int line_num,
-                        PTXInstruction *&result);
+  static bool interpret(const std::string &line,
+                        const std::vector<std::string> &tokens,
+                        int line_num, PTXInstruction *&result);
 };
 
-class WeftInstruction {
-public:
-  WeftInstruction(PTXInstruction *instruction, Thread *thread);
-  WeftInstruction(const WeftInstruction &rhs) : instruction(NULL), 
-    thread(NULL), thread_line_number(-1) { assert(false); }
-  virtual ~WeftInstruction(void) { }
-public:
-  WeftInstruction& operator=(const WeftInstruction &rhs)
-    { assert(false); return *this; }
-public:
-  virtual bool is_barrier(void) const { return false; }
-  virtual WeftBarrier* as_barrier(void) { return NULL; }
-public:
-  virtual bool is_access(void) const { return false; }
-  virtual WeftAccess* as_access(void) { return NULL; }
-public:
-  virtual bool is_sync(void) const { return false; }
-  virtual BarrierSync* as_sync(void) { return NULL; }
-public:
-  virtual bool is_arrive(void) const { return false; }
-  virtual BarrierArrive* as_arrive(void) { return NULL; }
-public:
-  virtual bool is_write(void) const { return false; }
-  virtual SharedWrite* as_write(void) { return NULL; }
-public:
-  virtual bool is_read(void) const { return false; }
-  virtual SharedRead* as_read(void) { return NULL; }
-public:
-  void initialize_happens(Happens *happens);
-  inline Happens* get_happens(void) const { return happens_relationship; }
-public:
-  virtual void print_instruction(FILE *target) = 0;
-public:
-  PTXInstruction *const instruction;
-  Thread *const thread;
-  const int thread_line_number;
-protected:
-  Happens *happens_relationship;
+enum WeftKind {
+  WEFT_SHARED_READ    = 0,
+  WEFT_SHARED_WRITE   = 1,
+  WEFT_BARRIER_SYNC   = 2,
+  WEFT_BARRIER_ARRIVE = 3,
 };
 
-class WeftBarrier : public WeftInstruction {
-public:
-  WeftBarrier(int name, int count, PTXBarrier *bar, Thread *thread);
-  WeftBarrier(const WeftBarrier &rhs) : WeftInstruction(NULL, NULL),
-    name(0), count(0), barrier(NULL) { assert(false); }
-  virtual ~WeftBarrier(void) { }
-public:
-  WeftBarrier& operator=(const WeftBarrier &rhs) { assert(false); return *this; }
-public:
-  virtual bool is_barrier(void) const { return true; }
-  virtual WeftBarrier* as_barrier(void) { return this; }
-public:
-  void set_instance(BarrierInstance *instance);
-  inline BarrierInstance* get_instance(void) const { return instance; }
-public:
-  virtual void print_instruction(FILE *target) = 0;
+// Weft instructions are packed 16 byte records stored by value in
+// the trace of each thread. The low two bits of the header hold the
+// kind, the next three hold the log2 of the bytes an access touches,
+// and the rest holds the program counter of the PTX instruction.
+// Accesses record their address, their warp-synchronous access ID,
+// and the number of barriers before them in the thread which names
+// the interval whose Happens object they use. Barriers record their
+// name, their arrival count, and the generation of the barrier 
+// instance they participate in once the graph has been built.
+class WeftInstruction {
 public:
-  const int name;
-  const int count;
-  PTXBarrier *const barrier;
+  WeftInstruction(WeftKind kind, int pc, int first, int second, int third,
+                  int log_width = 0)
+    : header((uint32_t(pc) << 5) | (uint32_t(log_width) << 2) | 
+             uint32_t(kind))
+    { operands[0] = first; operands[1] = second; operands[2] = third; }
+public:
+  inline WeftKind get_kind(void) const { return WeftKind(header & 0x3); }
+  inline int get_program_counter(void) const { return int(header >> 5); }
+public:
+  inline bool is_barrier(void) const { return ((header & 0x2) != 0); }
+  inline bool is_access(void) const { return ((header & 0x2) == 0); }
+  inline bool is_sync(void) const { return (get_kind() == WEFT_BARRIER_SYNC); }
+  inline bool is_arrive(void) const 
+    { return (get_kind() == WEFT_BARRIER_ARRIVE); }
+  inline bool is_write(void) const { return (get_kind() == WEFT_SHARED_WRITE); }
+  inline bool is_read(void) const { return (get_kind() == WEFT_SHARED_READ); }
+public:
+  // Accesses
+  inline int get_address(void) const 
+    { assert(is_access()); return operands[0]; }
+  inline int get_width(void) const
+    { assert(is_access()); return (1 << ((header >> 2) & 0x7)); }
+  inline int get_access_id(void) const 
+    { assert(is_access()); return operands[1]; }
+  inline int get_interval(void) const 
+    { assert(is_access()); return operands[2]; }
+public:
+  // Barriers
+  inline int get_name(void) const 
+    { assert(is_barrier()); return operands[0]; }
+  inline int get_count(void) const 
+    { assert(is_barrier()); return operands[1]; }
+  inline int get_generation(void) const 
+    { assert(is_barrier()); return operands[2]; }
+  inline void set_generation(int generation)
+    { assert(is_barrier()); assert(operands[2] == -1); 
+      operands[2] = generation; }
+public:
+  void print_instruction(FILE *target) const;
 protected:
-  BarrierInstance *instance;
-};
-
-class BarrierSync : public WeftBarrier {
-public:
-  BarrierSync(int name, int count, PTXBarrier *bar, Thread *thread);
-  BarrierSync(const BarrierSync &rhs) : WeftBarrier(0, 0, NULL, NULL)
-    { assert(false); }
-  virtual ~BarrierSync(void) { }
-public:
-  BarrierSync& operator=(const BarrierSync &rhs) { assert(false); return *this; }
-public:
-  virtual bool is_sync(void) const { return true; }
-  virtual BarrierSync* as_sync(void) { return this; }
-  virtual void print_instruction(FILE *target);
-};
-
-class BarrierArrive : public WeftBarrier {
-public:
-  BarrierArrive(int name, int count, PTXBarrier *bar, Thread *thread);
-  BarrierArrive(const BarrierArrive &rhs) : WeftBarrier(0, 0, NULL, NULL)
-    { assert(false); }
-  virtual ~BarrierArrive(void) { }
-public:
-  BarrierArrive& operator=(const BarrierArrive &rhs) { assert(false); return *this; }
-public:
-  virtual bool is_arrive(void) const { return true; }
-  virtual BarrierArrive* as_arrive(void) { return this; }
-  virtual void print_instruction(FILE *target);
-};
-
-class WeftAccess : public WeftInstruction {
-public:
-  WeftAccess(int address, PTXSharedAccess *access, Thread *thread, int access_id);
-  WeftAccess(const WeftAccess &rhs) : WeftInstruction(NULL, NULL),
-    address(0), access(NULL), access_id(-1) { assert(false); }
-  virtual ~WeftAccess(void) { }
-public:
-  WeftAccess& operator=(const WeftAccess &rhs) { assert(false); return *this; }
-public:
-  virtual bool is_access(void) const { return true; }
-  virtual WeftAccess* as_access(void) { return this; }
-public:
-  bool has_happens_relationship(WeftAccess *other);
-  bool is_warp_synchronous(WeftAccess *other);
-public:
-  virtual void print_instruction(FILE *target) = 0;
-public:
-  const int address;
-  PTXSharedAccess *const access;
-  const int access_id; // for warp-synchronous execution
-};
-
-class SharedWrite : public WeftAccess {
-public:
-  SharedWrite(int address, PTXSharedAccess *access, 
-              Thread *thread, int access_id = -1);
-  SharedWrite(const SharedWrite &rhs) : WeftAccess(0, NULL, NULL, -1)
-    { assert(false); }
-  virtual ~SharedWrite(void) { }
-public:
-  SharedWrite& operator=(const SharedWrite &rhs) { assert(false); return *this; }
-public:
-  virtual bool is_write(void) const { return true; }
-  virtual SharedWrite* as_write(void) { return this; }
-  virtual void print_instruction(FILE *target);
-};
-
-class SharedRead : public WeftAccess {
-public:
-  SharedRead(int address, PTXSharedAccess *access, 
-             Thread *thread, int access_id = -1);
-  SharedRead(const SharedRead &rhs) : WeftAccess(0, NULL, NULL, -1)
-    { assert(false); }
-  virtual ~SharedRead(void) { }
-public:
-  SharedRead& operator=(const SharedRead &rhs) { assert(false); return *this; }
-public:
-  virtual bool is_read(void) const { return true; }
-  virtual SharedRead* as_read(void) { return this; }
-  virtual void print_instruction(FILE *target);
+  uint32_t header;
+  int operands[3];
 };
 
 #endif // __INSTRUCTION_H__
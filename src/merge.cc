@@ -0,0 +1,173 @@
+/*
+ * Copyright 2015 Stanford University and NVIDIA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "merge.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MERGE_X86
+#include <immintrin.h>
+#endif
+
+typedef void (*MergeFunction)(int *dst, const int *src, size_t count);
+
+struct MergeKernel {
+public:
+  const char *name;
+  MergeFunction merge_max;
+  MergeFunction merge_min;
+  bool (*supported)(void);
+};
+
+static void merge_max_scalar(int *dst, const int *src, size_t count)
+{
+  for (size_t idx = 0; idx < count; idx++)
+    dst[idx] = (src[idx] > dst[idx]) ? src[idx] : dst[idx];
+}
+
+static void merge_min_scalar(int *dst, const int *src, size_t count)
+{
+  unsigned *udst = reinterpret_cast<unsigned*>(dst);
+  const unsigned *usrc = reinterpret_cast<const unsigned*>(src);
+  for (size_t idx = 0; idx < count; idx++)
+    udst[idx] = (usrc[idx] < udst[idx]) ? usrc[idx] : udst[idx];
+}
+
+static bool scalar_supported(void)
+{
+  return true;
+}
+
+#ifdef MERGE_X86
+__attribute__((target("sse4.1")))
+static void merge_max_sse41(int *dst, const int *src, size_t count)
+{
+  size_t idx = 0;
+  for ( ; (idx + 4) <= count; idx += 4)
+  {
+    __m128i ours = _mm_loadu_si128((const __m128i*)(dst + idx));
+    __m128i theirs = _mm_loadu_si128((const __m128i*)(src + idx));
+    _mm_storeu_si128((__m128i*)(dst + idx), _mm_max_epi32(ours, theirs));
+  }
+  merge_max_scalar(dst + idx, src + idx, count - idx);
+}
+
+__attribute__((target("sse4.1")))
+static void merge_min_sse41(int *dst, const int *src, size_t count)
+{
+  size_t idx = 0;
+  for ( ; (idx + 4) <= count; idx += 4)
+  {
+    __m128i ours = _mm_loadu_si128((const __m128i*)(dst + idx));
+    __m128i theirs = _mm_loadu_si128((const __m128i*)(src + idx));
+    _mm_storeu_si128((__m128i*)(dst + idx), _mm_min_epu32(ours, theirs));
+  }
+  merge_min_scalar(dst + idx, src + idx, count - idx);
+}
+
+static bool sse41_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse4.1");
+}
+
+__attribute__((target("avx2")))
+static void merge_max_avx2(int *dst, const int *src, size_t count)
+{
+  size_t idx = 0;
+  for ( ; (idx + 8) <= count; idx += 8)
+  {
+    __m256i ours = _mm256_loadu_si256((const __m256i*)(dst + idx));
+    __m256i theirs = _mm256_loadu_si256((const __m256i*)(src + idx));
+    _mm256_storeu_si256((__m256i*)(dst + idx),
+                        _mm256_max_epi32(ours, theirs));
+  }
+  merge_max_scalar(dst + idx, src + idx, count - idx);
+}
+
+__attribute__((target("avx2")))
+static void merge_min_avx2(int *dst, const int *src, size_t count)
+{
+  size_t idx = 0;
+  for ( ; (idx + 8) <= count; idx += 8)
+  {
+    __m256i ours = _mm256_loadu_si256((const __m256i*)(dst + idx));
+    __m256i theirs = _mm256_loadu_si256((const __m256i*)(src + idx));
+    _mm256_storeu_si256((__m256i*)(dst + idx),
+                        _mm256_min_epu32(ours, theirs));
+  }
+  merge_min_scalar(dst + idx, src + idx, count - idx);
+}
+
+static bool avx2_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// Ordered from the slowest to the fastest
+static const MergeKernel merge_kernels[] = {
+  { "scalar", merge_max_scalar, merge_min_scalar, scalar_supported },
+#ifdef MERGE_X86
+  { "sse4.1", merge_max_sse41, merge_min_sse41, sse41_supported },
+  { "avx2", merge_max_avx2, merge_min_avx2, avx2_supported },
+#endif
+};
+
+static const MergeKernel* find_fastest_kernel(void)
+{
+  const int total = sizeof(merge_kernels) / sizeof(merge_kernels[0]);
+  for (int idx = total-1; idx > 0; idx--)
+  {
+    if (merge_kernels[idx].supported())
+      return &merge_kernels[idx];
+  }
+  return &merge_kernels[0];
+}
+
+static const MergeKernel *current_kernel = find_fastest_kernel();
+
+void merge_max(int *dst, const int *src, size_t count)
+{
+  current_kernel->merge_max(dst, src, count);
+}
+
+void merge_min(int *dst, const int *src, size_t count)
+{
+  current_kernel->merge_min(dst, src, count);
+}
+
+const char* merge_kernel_name(void)
+{
+  return current_kernel->name;
+}
+
+bool select_merge_kernel(const char *name)
+{
+  const int total = sizeof(merge_kernels) / sizeof(merge_kernels[0]);
+  for (int idx = 0; idx < total; idx++)
+  {
+    if (strcmp(merge_kernels[idx].name, name) != 0)
+      continue;
+    if (!merge_kernels[idx].supported())
+      return false;
+    current_kernel = &merge_kernels[idx];
+    return true;
+  }
+  return false;
+}
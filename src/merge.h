@@ -0,0 +1,48 @@
+/*
+ * Copyright 2015 Stanford University and NVIDIA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __MERGE_H__
+#define __MERGE_H__
+
+#include <cstddef>
+
+// Element-wise merges of trace positions or barrier generations
+// where -1 means that there is no value. As a signed integer -1 is
+// smaller than every value and as an unsigned integer it is larger
+// than every value, so neither merge has to branch on it.
+
+// Keep the later of the two values in dst
+void merge_max(int *dst, const int *src, size_t count);
+// Keep the earlier of the two values in dst
+void merge_min(int *dst, const int *src, size_t count);
+
+inline int merge_max(int ours, int theirs)
+{
+  return (theirs > ours) ? theirs : ours;
+}
+
+inline int merge_min(int ours, int theirs)
+{
+  return (unsigned(theirs) < unsigned(ours)) ? theirs : ours;
+}
+
+// The name of the implementation picked for this processor
+const char* merge_kernel_name(void);
+// Pick an implementation by name ("scalar", "sse4.1" or "avx2"),
+// returns false if this processor does not support it
+bool select_merge_kernel(const char *name);
+
+#endif // __MERGE_H__
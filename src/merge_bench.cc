@@ -0,0 +1,89 @@
+/*
+ * Copyright 2015 Stanford University and NVIDIA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "merge.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <sys/time.h>
+
+// Times the frontier merges the way the transitive happens tasks use
+// them: every barrier merges the frontiers of the barriers it can reach
+// into its own, here each barrier reaches the last few before it.
+// Usage: merge_bench [threads] [barriers] [reachable]
+
+static unsigned long long current_time_in_micros(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return ((unsigned long long)tv.tv_sec * 1000000ULL) + tv.tv_usec;
+}
+
+static unsigned long long run_merges(std::vector<std::vector<int> > &frontiers,
+                                     int reachable, bool latest)
+{
+  const int threads = frontiers.front().size();
+  // Sparse frontiers like those of barriers on a few warps
+  for (unsigned bar = 0; bar < frontiers.size(); bar++)
+    for (int idx = 0; idx < threads; idx++)
+      frontiers[bar][idx] = (((idx / 32) % 4) == int(bar % 4)) ? int(bar) : -1;
+  unsigned long long start = current_time_in_micros();
+  for (unsigned bar = 1; bar < frontiers.size(); bar++)
+  {
+    for (int prev = 1; (prev <= reachable) && (prev <= int(bar)); prev++)
+    {
+      if (latest)
+        merge_max(&frontiers[bar].front(),
+                  &frontiers[bar-prev].front(), threads);
+      else
+        merge_min(&frontiers[bar].front(),
+                  &frontiers[bar-prev].front(), threads);
+    }
+  }
+  return (current_time_in_micros() - start);
+}
+
+int main(int argc, char **argv)
+{
+  const int threads = (argc > 1) ? atoi(argv[1]) : 1024;
+  const int barriers = (argc > 2) ? atoi(argv[2]) : 2048;
+  const int reachable = (argc > 3) ? atoi(argv[3]) : 16;
+  if ((threads < 1) || (barriers < 1) || (reachable < 1))
+  {
+    fprintf(stderr,"Usage: merge_bench [threads] [barriers] [reachable]\n");
+    return 1;
+  }
+  fprintf(stdout,"Merging frontiers of %d threads for %d barriers "
+                 "reaching %d barriers each\n", threads, barriers, reachable);
+  fprintf(stdout,"  Dispatched kernel: %s\n", merge_kernel_name());
+  std::vector<std::vector<int> > frontiers(barriers,
+                                           std::vector<int>(threads, -1));
+  const char *kernels[] = { "scalar", "sse4.1", "avx2" };
+  for (unsigned idx = 0; idx < (sizeof(kernels)/sizeof(kernels[0])); idx++)
+  {
+    if (!select_merge_kernel(kernels[idx]))
+    {
+      fprintf(stdout,"  %8s: not supported\n", kernels[idx]);
+      continue;
+    }
+    unsigned long long latest = run_merges(frontiers, reachable, true);
+    unsigned long long earliest = run_merges(frontiers, reachable, false);
+    fprintf(stdout,"  %8s: latest %8.3f ms  earliest %8.3f ms\n",
+            kernels[idx], latest * 1e-3, earliest * 1e-3);
+  }
+  return 0;
+}
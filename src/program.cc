@@ -20,9 +20,8 @@
 #include "program.h"
 #include "instruction.h"
 
-#include <fstream>
-#include <iostream>
 #include <vector>
+#include <algorithm>
 
 #include <cstdio>
 #include <cstring>
@@ -30,14 +29,77 @@
 #include <cstdlib>
 #include <cxxabi.h> // Demangling
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile(const char *file_name)
+  : fd(-1), data(NULL), size(0)
+{
+  fd = open(file_name, O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat info;
+  if ((fstat(fd, &info) != 0) || !S_ISREG(info.st_mode))
+  {
+    close(fd);
+    fd = -1;
+    return;
+  }
+  size = info.st_size;
+  // Can't map an empty file, but there is nothing to read anyway
+  if (size == 0)
+    return;
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED)
+  {
+    close(fd);
+    fd = -1;
+    size = 0;
+    return;
+  }
+  data = (const char*)mapping;
+  // We read the file once from front to back
+  madvise(mapping, size, MADV_SEQUENTIAL);
+}
+
+MappedFile::~MappedFile(void)
+{
+  if (data != NULL)
+    munmap((void*)data, size);
+  if (fd >= 0)
+    close(fd);
+}
+
+bool MappedFile::next_line(size_t &offset, const char *&line, 
+                           int &length) const
+{
+  if (offset >= size)
+    return false;
+  const char *start = data + offset;
+  const char *stop = (const char*)memchr(start, '\n', size - offset);
+  // Like std::getline, a final line without a newline is dropped
+  if (stop == NULL)
+    return false;
+  line = start;
+  length = stop - start;
+  offset += (length + 1);
+  return true;
+}
+
 Program::Program(Weft *w, std::string &name)
   : weft(w), kernel_name(name), 
     max_num_threads(-1), max_num_barriers(1),
-    current_cta(0)
+    current_cta(0), assigning_pc(-1), pending_count(0)
 {
   // Initialize values
   warp_synchronous = weft->initialize_program(this);
   max_num_threads = block_dim[0] * block_dim[1] * block_dim[2];
+  out = stdout;
+  err = stderr;
+  PTHREAD_SAFE_CALL( pthread_mutex_init(&count_lock, NULL) );
+  PTHREAD_SAFE_CALL( pthread_cond_init(&count_cond, NULL) );
 }
 
 Program::Program(const Program &rhs)
@@ -75,6 +137,8 @@ Program::~Program(void)
     }
   }
   cta_states.clear();
+  PTHREAD_SAFE_CALL( pthread_mutex_destroy(&count_lock) );
+  PTHREAD_SAFE_CALL( pthread_cond_destroy(&count_cond) );
 }
 
 Program& Program::operator=(const Program &rhs)
@@ -97,7 +161,7 @@ void Program::parse_ptx_file(const char *file_name, Weft *weft,
     weft->start_parsing_instrumentation();
 
   Program *current = NULL;
-  std::ifstream file(file_name);
+  MappedFile file(file_name);
   std::map<int,const char*> source_files;
   // First, let's get all the lines we care about
   if (!file.is_open())
@@ -109,12 +173,16 @@ void Program::parse_ptx_file(const char *file_name, Weft *weft,
   bool found = false;
   std::string line, kernel_name;
   int line_num = 1;
-  std::getline(file, line);
   int block_dim[3];
-  while (!file.eof())
+  size_t offset = 0;
+  const char *line_text;
+  int line_length;
+  while (file.next_line(offset, line_text, line_length))
   {
     if (current != NULL)
-      current->add_line(line, line_num);
+      current->add_line(LineView(line_text, line_length, line_num));
+    // Reuse the same buffer for the header checks below
+    line.assign(line_text, line_length);
     // Try parsing this as a file location
     parse_file_location(line, source_files);
     if (line.find(".entry") != std::string::npos)
@@ -202,7 +270,6 @@ void Program::parse_ptx_file(const char *file_name, Weft *weft,
       }
     }
     line_num++;
-    std::getline(file, line);
   }
   if (current == NULL)
   {
@@ -249,9 +316,9 @@ void Program::parse_ptx_file(const char *file_name, Weft *weft,
 
 void Program::report_statistics(void)
 {
-  fprintf(stdout,"WEFT INFO: Program Statistics for Kernel %s\n", kernel_name.c_str());
-  fprintf(stdout,"  Static Instructions: %ld\n", ptx_instructions.size());
-  fprintf(stdout,"  Instruction Counts\n");
+  fprintf(out,"WEFT INFO: Program Statistics for Kernel %s\n", kernel_name.c_str());
+  fprintf(out,"  Static Instructions: %ld\n", ptx_instructions.size());
+  fprintf(out,"  Instruction Counts\n");
   unsigned counts[PTX_LAST];
   for (unsigned idx = 0; idx < PTX_LAST; idx++)
     counts[idx] = 0;
@@ -262,10 +329,10 @@ void Program::report_statistics(void)
   {
     if (counts[idx] == 0)
       continue;
-    fprintf(stdout,"    Instruction %s: %d\n", 
-                   PTXInstruction::get_kind_name((PTXKind)idx), counts[idx]);
+    fprintf(out,"    Instruction %s: %d\n", 
+                PTXInstruction::get_kind_name((PTXKind)idx), counts[idx]);
   }
-  fprintf(stdout,"\n");
+  fprintf(out,"\n");
 }
 
 void Program::report_statistics(const std::vector<Thread*> &threads)
@@ -277,17 +344,17 @@ void Program::report_statistics(const std::vector<Thread*> &threads)
   {
     total_count += (*it)->accumulate_instruction_counts(instruction_counts);
   }
-  fprintf(stdout,"WEFT INFO: Program Statistics for Kernel %s\n", kernel_name.c_str());
-  fprintf(stdout,"  Dynamic Instructions: %d\n", total_count);
-  fprintf(stdout,"  Instruction Counts\n");
+  fprintf(out,"WEFT INFO: Program Statistics for Kernel %s\n", kernel_name.c_str());
+  fprintf(out,"  Dynamic Instructions: %d\n", total_count);
+  fprintf(out,"  Instruction Counts\n");
   for (unsigned idx = 0; idx < PTX_LAST; idx++)
   {
     if (instruction_counts[idx] == 0)
       continue;
-    fprintf(stdout,"    Instruction %s: %d\n", 
+    fprintf(out,"    Instruction %s: %d\n", 
        PTXInstruction::get_kind_name((PTXKind)idx), instruction_counts[idx]);
   }
-  fprintf(stdout,"\n");
+  fprintf(out,"\n");
 }
 
 bool Program::has_shuffles(void) const
@@ -304,13 +371,16 @@ bool Program::has_shuffles(void) const
 void Program::emulate_threads(void)
 {
   if (weft->print_verbose())
-    fprintf(stdout,"WEFT INFO: Emulating %d GPU threads "
-                   "for kernel %s...\n",
-                   max_num_threads, kernel_name.c_str());
+    fprintf(out,"WEFT INFO: Emulating %d GPU threads "
+                "for kernel %s...\n",
+                max_num_threads, kernel_name.c_str());
   
   if (weft->perform_instrumentation())
     start_instrumentation(EMULATE_THREADS_STAGE);
 
+  // Compute the values of the uniform registers for this CTA
+  evaluate_uniform_registers();
+
   SharedMemory *&shared_memory = cta_states[current_cta].shared_memory;
   assert(shared_memory == NULL);
   shared_memory = new SharedMemory(weft, this);
@@ -318,53 +388,21 @@ void Program::emulate_threads(void)
   assert(max_num_threads == (block_dim[0]*block_dim[1]*block_dim[2]));
   std::vector<Thread*> &threads = cta_states[current_cta].threads;
   threads.resize(max_num_threads, NULL);
+  // Threads are created by the worker that emulates them so that
+  // their state is first touched on the memory node of that worker.
   // If we are doing warp synchronous execution we 
   // execute all the threads in a warp together
   if (warp_synchronous) 
   {
     assert((max_num_threads % WARP_SIZE) == 0);
-    weft->initialize_count(max_num_threads/WARP_SIZE);
-    int tid = 0;
-    for (int z = 0; z < block_dim[2]; z++)
-    {
-      for (int y = 0; y < block_dim[1]; y++)
-      {
-        for (int x = 0; x < block_dim[0]; x++)
-        {
-          threads[tid] = new Thread(tid, x, y, z, this, shared_memory);
-          // Increment first
-          tid++;
-          // Only kick off a warp once we've generated all the threads
-          if ((tid % WARP_SIZE) == 0)
-          {
-            assert((tid-WARP_SIZE) >= 0);
-            EmulateWarp *task = 
-              new EmulateWarp(this, &(threads[tid-WARP_SIZE]));
-            weft->enqueue_task(task);
-          }
-        }
-      }
-    }
+    EmulateWarp warp_body(this, &threads.front());
+    weft->parallel_for(this, &warp_body, 0, max_num_threads/WARP_SIZE);
   }
   else
   {
-    weft->initialize_count(max_num_threads);
-    int tid = 0;
-    for (int z = 0; z < block_dim[2]; z++)
-    {
-      for (int y = 0; y < block_dim[1]; y++)
-      {
-        for (int x = 0; x < block_dim[0]; x++)
-        {
-          threads[tid] = new Thread(tid, x, y, z, this, shared_memory); 
-          EmulateThread *task = new EmulateThread(threads[tid]);
-          weft->enqueue_task(task);
-          tid++;
-        }
-      }
-    }
+    EmulateThread thread_body(this);
+    weft->parallel_for(this, &thread_body, 0, max_num_threads);
   }
-  weft->wait_until_done();
   // Get the maximum barrier ID from all threads
   for (int i = 0; i < max_num_threads; i++)
   {
@@ -372,10 +410,11 @@ void Program::emulate_threads(void)
     if ((local_max+1) > max_num_barriers)
       max_num_barriers = (local_max+1);
   }
+  shared_memory->collect_accesses(&threads.front(), max_num_threads);
   if (weft->print_verbose())
   {
-    fprintf(stdout,"WEFT INFO: Emulation found %d named barriers for kernel %s.\n",
-                    barrier_upper_bound(), kernel_name.c_str());
+    fprintf(out,"WEFT INFO: Emulation found %d named barriers for kernel %s.\n",
+                 barrier_upper_bound(), kernel_name.c_str());
     report_statistics();
   }
 
@@ -391,8 +430,8 @@ void Program::emulate_threads(void)
 void Program::construct_dependence_graph(void)
 {
   if (weft->print_verbose())
-    fprintf(stdout,"WEFT INFO: Constructing barrier dependence graph "
-                   "for kernel %s...\n", kernel_name.c_str());
+    fprintf(out,"WEFT INFO: Constructing barrier dependence graph "
+                "for kernel %s...\n", kernel_name.c_str());
 
   if (weft->perform_instrumentation())
     start_instrumentation(CONSTRUCT_BARRIER_GRAPH_STAGE);
@@ -406,13 +445,13 @@ void Program::construct_dependence_graph(void)
   // Validate the graph 
   int total_validation_tasks = graph->count_validation_tasks();
   if (weft->print_verbose())
-    fprintf(stdout,"WEFT INFO: Performing %d graph validation checks...\n",
-                              total_validation_tasks);
+    fprintf(out,"WEFT INFO: Performing %d graph validation checks...\n",
+                           total_validation_tasks);
   if (total_validation_tasks > 0)
   {
-    weft->initialize_count(total_validation_tasks);
+    initialize_count(total_validation_tasks);
     graph->enqueue_validation_tasks();
-    weft->wait_until_done();
+    wait_until_done();
     graph->check_for_validation_errors();
   }
 
@@ -423,41 +462,66 @@ void Program::construct_dependence_graph(void)
 void Program::compute_happens_relationships(void)
 {
   if (weft->print_verbose())
-    fprintf(stdout,"WEFT INFO: Computing happens-before/after "
-                   "relationships for kernel %s...\n", kernel_name.c_str());
+    fprintf(out,"WEFT INFO: Computing happens-before/after "
+                "relationships for kernel %s...\n", kernel_name.c_str());
 
   if (weft->perform_instrumentation())
     start_instrumentation(COMPUTE_HAPPENS_RELATIONSHIP_STAGE);
 
-  // First initialize all the data structures
+  // Threads that participate in the same barrier instances in the 
+  // same order with accesses in the same intervals between them have 
+  // identical happens relationships, so group them into classes and
+  // only compute happens relationships for one thread in each class
   std::vector<Thread*> &threads = cta_states[current_cta].threads;
-  weft->initialize_count(threads.size());
-  for (std::vector<Thread*>::const_iterator it = threads.begin();
-        it != threads.end(); it++)
-    weft->enqueue_task(
-        new InitializationTask(*it, threads.size(), max_num_barriers));
-  weft->wait_until_done();
+  std::vector<Thread*> representatives;
+  std::vector<std::pair<Thread*,Thread*> > followers;
+  {
+    std::map<std::vector<int>,Thread*> classes;
+    std::vector<int> signature;
+    for (std::vector<Thread*>::const_iterator it = threads.begin();
+          it != threads.end(); it++)
+    {
+      (*it)->compute_barrier_signature(signature);
+      std::map<std::vector<int>,Thread*>::const_iterator finder = 
+        classes.find(signature);
+      if (finder == classes.end())
+      {
+        classes[signature] = *it;
+        representatives.push_back(*it);
+      }
+      else
+        followers.push_back(std::pair<Thread*,Thread*>(*it, finder->second));
+    }
+  }
+  if (weft->print_verbose())
+    fprintf(out,"WEFT INFO: Found %d classes of threads with identical "
+                "barrier behavior in kernel %s.\n", 
+                int(representatives.size()), kernel_name.c_str());
+
+  // First initialize all the data structures
+  BarrierDependenceGraph *&graph = cta_states[current_cta].graph;
+  InitializeHappens initialize_happens(&representatives.front(), graph);
+  weft->parallel_for(this, &initialize_happens, 0, representatives.size());
+  for (std::vector<std::pair<Thread*,Thread*> >::const_iterator it = 
+        followers.begin(); it != followers.end(); it++)
+    it->first->share_happens(it->second);
 
   // Compute barrier reachability
   // There are twice as many tasks as barriers
-  BarrierDependenceGraph *&graph = cta_states[current_cta].graph;
   int total_barriers = graph->count_total_barriers();
-  weft->initialize_count(2*total_barriers);
+  initialize_count(2*total_barriers);
   graph->enqueue_reachability_tasks();
-  weft->wait_until_done();
+  wait_until_done();
 
   // Compute latest/earliest happens-before/after tasks
   // There are twice as many tasks as barriers
-  weft->initialize_count(2*total_barriers);
+  initialize_count(2*total_barriers);
   graph->enqueue_transitive_happens_tasks();
-  weft->wait_until_done();
+  wait_until_done();
 
   // Finally update all the happens relationships
-  weft->initialize_count(threads.size());
-  for (std::vector<Thread*>::const_iterator it = threads.begin();
-        it != threads.end(); it++)
-    weft->enqueue_task(new UpdateThreadTask(*it));
-  weft->wait_until_done();
+  UpdateHappens update_happens(&representatives.front());
+  weft->parallel_for(this, &update_happens, 0, representatives.size());
 
   if (weft->perform_instrumentation())
     stop_instrumentation(COMPUTE_HAPPENS_RELATIONSHIP_STAGE);
@@ -466,16 +530,14 @@ void Program::compute_happens_relationships(void)
 void Program::check_for_race_conditions(void)
 {
   if (weft->print_verbose())
-    fprintf(stdout,"WEFT INFO: Checking for race conditions in "
-                   "kernel %s...\n", kernel_name.c_str());
+    fprintf(out,"WEFT INFO: Checking for race conditions in "
+                "kernel %s...\n", kernel_name.c_str());
 
   if (weft->perform_instrumentation())
     start_instrumentation(CHECK_FOR_RACES_STAGE);
 
   SharedMemory *&shared_memory = cta_states[current_cta].shared_memory;
-  weft->initialize_count(shared_memory->count_addresses());
-  shared_memory->enqueue_race_checks();
-  weft->wait_until_done();
+  shared_memory->perform_race_checks();
   shared_memory->check_for_races();
 
   if (weft->perform_instrumentation())
@@ -484,15 +546,15 @@ void Program::check_for_race_conditions(void)
 
 void Program::print_statistics(void)
 {
-  fprintf(stdout,"WEFT STATISTICS for Kernel %s\n", kernel_name.c_str());
-  fprintf(stdout,"  CTA Thread Count:          %15d\n", max_num_threads);
-  fprintf(stdout,"  Shared Memory Locations:   %15d\n", count_addresses());
-  fprintf(stdout,"  Physical Named Barriers;   %15d\n", max_num_barriers);
-  fprintf(stdout,"  Dynamic Barrier Instances: %15d\n", count_total_barriers());
-  fprintf(stdout,"  Static Instructions:       %15d\n", count_instructions());
-  fprintf(stdout,"  Dynamic Instructions:      %15d\n", count_dynamic_instructions());
-  fprintf(stdout,"  Weft Statements:           %15d\n", count_weft_statements());   
-  fprintf(stdout,"  Total Race Tests:          %15ld\n",count_race_tests());
+  fprintf(out,"WEFT STATISTICS for Kernel %s\n", kernel_name.c_str());
+  fprintf(out,"  CTA Thread Count:          %15d\n", max_num_threads);
+  fprintf(out,"  Shared Memory Locations:   %15d\n", count_addresses());
+  fprintf(out,"  Physical Named Barriers;   %15d\n", max_num_barriers);
+  fprintf(out,"  Dynamic Barrier Instances: %15d\n", count_total_barriers());
+  fprintf(out,"  Static Instructions:       %15d\n", count_instructions());
+  fprintf(out,"  Dynamic Instructions:      %15d\n", count_dynamic_instructions());
+  fprintf(out,"  Weft Statements:           %15d\n", count_weft_statements());   
+  fprintf(out,"  Total Race Tests:          %15ld\n",count_race_tests());
 }
 
 void Program::print_files(void)
@@ -500,14 +562,8 @@ void Program::print_files(void)
   // We'll only dump the first CTA worth of threads for now
   assert(!cta_states.empty());
   std::vector<Thread*> &threads = cta_states[0].threads;
-  weft->initialize_count(max_num_threads);
-  for (std::vector<Thread*>::const_iterator it = threads.begin();
-        it != threads.end(); it++)
-  {
-    DumpThreadTask *dump_task = new DumpThreadTask(*it); 
-    weft->enqueue_task(dump_task);
-  }
-  weft->wait_until_done();
+  DumpThread dump_thread(&threads.front());
+  weft->parallel_for(this, &dump_thread, 0, threads.size());
 }
 
 int Program::count_dynamic_instructions(void)
@@ -570,35 +626,658 @@ size_t Program::count_race_tests(void)
   return result;
 }
 
+// Run the fall back emulate method and find the program counter
+static inline int emulate_instruction(const CompiledInstruction &code, 
+                                      Thread *thread)
+{
+  PTXInstruction *result = code.instruction->emulate(thread);
+  return (result == NULL) ? -1 : result->get_program_counter();
+}
+
+// Execute one pre-decoded instruction and return the next program counter.
+// Instructions with undefined sources still do nothing as in emulate.
+static inline int execute_instruction(const CompiledInstruction &code,
+                                      Thread *thread)
+{
+  int64_t a, b, c;
+  bool p, q;
+  switch (code.opcode)
+  {
+    case COMPILED_EMULATE:
+      return emulate_instruction(code, thread);
+    case COMPILED_NOP:
+      break;
+    case COMPILED_MOVE:
+      {
+        if (thread->get_value(code.src[0], a))
+          thread->set_value(code.dst, a);
+        break;
+      }
+    case COMPILED_RIGHT_SHIFT:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+          thread->set_value(code.dst, a >> b);
+        break;
+      }
+    case COMPILED_LEFT_SHIFT:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+          thread->set_value(code.dst, a << b);
+        break;
+      }
+    case COMPILED_AND:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+          thread->set_value(code.dst, a & b);
+        break;
+      }
+    case COMPILED_OR:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+          thread->set_value(code.dst, a | b);
+        break;
+      }
+    case COMPILED_XOR:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+          thread->set_value(code.dst, a ^ b);
+        break;
+      }
+    case COMPILED_NOT:
+      {
+        if (thread->get_value(code.src[0], a))
+          thread->set_value(code.dst, !a);
+        break;
+      }
+    case COMPILED_ADD:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+          thread->set_value(code.dst, a + b);
+        break;
+      }
+    case COMPILED_SUB:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+          thread->set_value(code.dst, a - b);
+        break;
+      }
+    case COMPILED_NEGATE:
+      {
+        if (thread->get_value(code.src[0], a))
+          thread->set_value(code.dst, ~a);
+        break;
+      }
+    case COMPILED_MULTIPLY:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+          thread->set_value(code.dst, a * b);
+        break;
+      }
+    case COMPILED_MAD:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b) &&
+            thread->get_value(code.src[2], c))
+          thread->set_value(code.dst, a * b + c);
+        break;
+      }
+    case COMPILED_BFE:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b) &&
+            thread->get_value(code.src[2], c))
+        {
+          int index = b & 0xff;
+          int length = c & 0xff;
+          int64_t mask = 0;
+          for (int i = index; i < (index+length); i++)
+            mask |= (1 << i);
+          thread->set_value(code.dst, (a & mask) >> index);
+        }
+        break;
+      }
+    case COMPILED_SET_PREDICATE:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b))
+        {
+          switch (code.flags)
+          {
+            case COMP_GT:
+              {
+                p = (a > b);
+                break;
+              }
+            case COMP_GE:
+              {
+                p = (a >= b);
+                break;
+              }
+            case COMP_EQ:
+              {
+                p = (a == b);
+                break;
+              }
+            case COMP_NE:
+              {
+                p = (a != b);
+                break;
+              }
+            case COMP_LE:
+              {
+                p = (a <= b);
+                break;
+              }
+            case COMP_LT:
+              {
+                p = (a < b);
+                break;
+              }
+            default:
+              assert(false);
+          }
+          thread->set_pred(code.dst, p);
+        }
+        break;
+      }
+    case COMPILED_SELECT_PREDICATE:
+      {
+        if (thread->get_value(code.src[0], a) && 
+            thread->get_value(code.src[1], b) &&
+            thread->get_pred(code.src[2], p))
+          thread->set_value(code.dst, (p != bool(code.flags)) ? a : b);
+        break;
+      }
+    case COMPILED_AND_PREDICATE:
+      {
+        if (thread->get_pred(code.src[0], p) && 
+            thread->get_pred(code.src[1], q))
+          thread->set_pred(code.dst, p && q);
+        break;
+      }
+    case COMPILED_OR_PREDICATE:
+      {
+        if (thread->get_pred(code.src[0], p) && 
+            thread->get_pred(code.src[1], q))
+          thread->set_pred(code.dst, p || q);
+        break;
+      }
+    case COMPILED_XOR_PREDICATE:
+      {
+        if (thread->get_pred(code.src[0], p) && 
+            thread->get_pred(code.src[1], q))
+          thread->set_pred(code.dst, p != q);
+        break;
+      }
+    case COMPILED_NOT_PREDICATE:
+      {
+        if (thread->get_pred(code.src[0], p))
+          thread->set_pred(code.dst, !p);
+        break;
+      }
+    case COMPILED_BRANCH:
+      {
+        // Let emulate report undefined predicates
+        if (!thread->has_pred(code.src[0]))
+          return emulate_instruction(code, thread);
+        thread->get_pred(code.src[0], p);
+        if (p != bool(code.flags))
+          return code.target;
+        break;
+      }
+    case COMPILED_UNIFORM_BRANCH:
+      return code.target;
+    case COMPILED_EXIT:
+      return -1;
+    case COMPILED_UNIFORM:
+      break;
+    default:
+      assert(false);
+  }
+  return code.next;
+}
+
 int Program::emulate(Thread *thread)
 {
   int dynamic_instructions = 0;
-  PTXInstruction *pc = ptx_instructions.front();
+  const CompiledInstruction *code = &compiled_instructions.front();
+  int pc = 0;
   bool profile = weft->print_verbose();
   if (profile)
   {
-    while (pc != NULL)
+    while (pc >= 0)
     {
-      thread->profile_instruction(pc);
-      pc = pc->emulate(thread);
+      thread->profile_instruction(code[pc].instruction);
+      pc = execute_instruction(code[pc], thread);
       dynamic_instructions++;
     }
   }
   else
   {
-    while (pc != NULL)
+    while (pc >= 0)
     {
-      pc = pc->emulate(thread);
+      pc = execute_instruction(code[pc], thread);
       dynamic_instructions++;
     }
   }
   return dynamic_instructions;
 }
 
+void Program::get_shared_declarations(
+                              std::vector<PTXSharedDecl*> &decls) const
+{
+  for (std::map<std::string,int>::const_iterator it = 
+        shared_declarations.begin(); it != shared_declarations.end(); it++)
+    decls.push_back(ptx_instructions[it->second]->as_shared_decl());
+}
+
+void Program::evaluate_uniform_registers(void)
+{
+  uniform_values.clear();
+  if (uniform_instructions.empty())
+    return;
+  // Evaluate the uniform instructions once for the current CTA 
+  // with a scratch thread that has seen all the shared declarations
+  Thread thread(0, 0, 0, 0, this, NULL);
+  thread.initialize();
+  for (std::map<std::string,int>::const_iterator it = 
+        shared_declarations.begin(); it != shared_declarations.end(); it++)
+    ptx_instructions[it->second]->emulate(&thread);
+  for (unsigned idx = 0; idx < uniform_instructions.size(); idx++)
+    execute_instruction(uniform_instructions[idx], &thread);
+  for (unsigned idx = 0; idx < uniform_instructions.size(); idx++)
+  {
+    const int slot = uniform_instructions[idx].dst;
+    int64_t value;
+    bool defined = thread.get_value(slot, value);
+    assert(defined);
+    uniform_values.push_back(std::pair<int,int64_t>(slot, value));
+  }
+  thread.cleanup();
+}
+
+// Lane-wise operations for the warp interpreter
+struct MoveOp { 
+  static inline int64_t apply(int64_t a) { return a; } };
+struct NotOp { 
+  static inline int64_t apply(int64_t a) { return !a; } };
+struct NegateOp { 
+  static inline int64_t apply(int64_t a) { return ~a; } };
+struct RightShiftOp { 
+  static inline int64_t apply(int64_t a, int64_t b) { return a >> b; } };
+struct LeftShiftOp { 
+  static inline int64_t apply(int64_t a, int64_t b) { return a << b; } };
+struct AndOp { 
+  static inline int64_t apply(int64_t a, int64_t b) { return a & b; } };
+struct OrOp { 
+  static inline int64_t apply(int64_t a, int64_t b) { return a | b; } };
+struct XorOp { 
+  static inline int64_t apply(int64_t a, int64_t b) { return a ^ b; } };
+struct AddOp { 
+  static inline int64_t apply(int64_t a, int64_t b) { return a + b; } };
+struct SubOp { 
+  static inline int64_t apply(int64_t a, int64_t b) { return a - b; } };
+struct MultiplyOp { 
+  static inline int64_t apply(int64_t a, int64_t b) { return a * b; } };
+struct GreaterOp { 
+  static inline bool apply(int64_t a, int64_t b) { return a > b; } };
+struct GreaterEqualOp { 
+  static inline bool apply(int64_t a, int64_t b) { return a >= b; } };
+struct EqualOp { 
+  static inline bool apply(int64_t a, int64_t b) { return a == b; } };
+struct NotEqualOp { 
+  static inline bool apply(int64_t a, int64_t b) { return a != b; } };
+struct LessEqualOp { 
+  static inline bool apply(int64_t a, int64_t b) { return a <= b; } };
+struct LessOp { 
+  static inline bool apply(int64_t a, int64_t b) { return a < b; } };
+struct MadOp {
+  static inline int64_t apply(int64_t a, int64_t b, int64_t c) 
+    { return a * b + c; } };
+struct BitFieldExtractOp {
+  static inline int64_t apply(int64_t a, int64_t b, int64_t c)
+  {
+    int index = b & 0xff;
+    int length = c & 0xff;
+    int64_t mask = 0;
+    for (int i = index; i < (index+length); i++)
+      mask |= (1 << i);
+    return (a & mask) >> index;
+  }
+};
+
+#define FULL_WARP_MASK  (0xFFFFFFFF)
+
+template<typename OP>
+static inline void warp_unary(RegisterFile &regs, 
+                              const CompiledInstruction &code, uint32_t enabled)
+{
+  const int64_t *a = &regs.values[code.src[0] * WARP_SIZE];
+  int64_t *dst = &regs.values[code.dst * WARP_SIZE];
+  if (enabled == FULL_WARP_MASK)
+  {
+    for (int i = 0; i < WARP_SIZE; i++)
+      dst[i] = OP::apply(a[i]);
+  }
+  else
+  {
+    for (int i = 0; i < WARP_SIZE; i++)
+      if (enabled & (1U << i))
+        dst[i] = OP::apply(a[i]);
+  }
+  regs.valid[code.dst] |= enabled;
+}
+
+template<typename OP>
+static inline void warp_binary(RegisterFile &regs, 
+                               const CompiledInstruction &code, uint32_t enabled)
+{
+  const int64_t *a = &regs.values[code.src[0] * WARP_SIZE];
+  const int64_t *b = &regs.values[code.src[1] * WARP_SIZE];
+  int64_t *dst = &regs.values[code.dst * WARP_SIZE];
+  if (enabled == FULL_WARP_MASK)
+  {
+    for (int i = 0; i < WARP_SIZE; i++)
+      dst[i] = OP::apply(a[i], b[i]);
+  }
+  else
+  {
+    for (int i = 0; i < WARP_SIZE; i++)
+      if (enabled & (1U << i))
+        dst[i] = OP::apply(a[i], b[i]);
+  }
+  regs.valid[code.dst] |= enabled;
+}
+
+template<typename OP>
+static inline void warp_ternary(RegisterFile &regs, 
+                                const CompiledInstruction &code, uint32_t enabled)
+{
+  const int64_t *a = &regs.values[code.src[0] * WARP_SIZE];
+  const int64_t *b = &regs.values[code.src[1] * WARP_SIZE];
+  const int64_t *c = &regs.values[code.src[2] * WARP_SIZE];
+  int64_t *dst = &regs.values[code.dst * WARP_SIZE];
+  for (int i = 0; i < WARP_SIZE; i++)
+    if (enabled & (1U << i))
+      dst[i] = OP::apply(a[i], b[i], c[i]);
+  regs.valid[code.dst] |= enabled;
+}
+
+static inline void warp_set_predicate(RegisterFile &regs, int pred,
+                                      uint32_t bits, uint32_t enabled)
+{
+  regs.predicates[pred] = (regs.predicates[pred] & ~enabled) | (bits & enabled);
+  regs.defined[pred] |= enabled;
+}
+
+template<typename OP>
+static inline void warp_compare(RegisterFile &regs, 
+                                const CompiledInstruction &code, uint32_t enabled)
+{
+  const int64_t *a = &regs.values[code.src[0] * WARP_SIZE];
+  const int64_t *b = &regs.values[code.src[1] * WARP_SIZE];
+  uint32_t bits = 0;
+  for (int i = 0; i < WARP_SIZE; i++)
+    if (OP::apply(a[i], b[i]))
+      bits |= (1U << i);
+  warp_set_predicate(regs, code.dst, bits, enabled);
+}
+
+// Execute an ALU instruction for all the enabled lanes of a warp at once 
+// using the structure-of-arrays register file. Returns false for any
+// instructions that have to go through emulate_warp.
+static inline bool execute_warp_instruction(const CompiledInstruction &code,
+                                            RegisterFile &regs, 
+                                            uint32_t enabled, Thread **threads)
+{
+  // Figure out which sources we need to have defined
+  uint32_t defined = FULL_WARP_MASK;
+  switch (code.opcode)
+  {
+    case COMPILED_MAD:
+    case COMPILED_BFE:
+      defined &= regs.valid[code.src[2]];
+      // fall through
+    case COMPILED_RIGHT_SHIFT:
+    case COMPILED_LEFT_SHIFT:
+    case COMPILED_AND:
+    case COMPILED_OR:
+    case COMPILED_XOR:
+    case COMPILED_ADD:
+    case COMPILED_SUB:
+    case COMPILED_MULTIPLY:
+    case COMPILED_SET_PREDICATE:
+      defined &= regs.valid[code.src[1]];
+      // fall through
+    case COMPILED_MOVE:
+    case COMPILED_NOT:
+    case COMPILED_NEGATE:
+      defined &= regs.valid[code.src[0]];
+      break;
+    case COMPILED_SELECT_PREDICATE:
+      defined &= regs.valid[code.src[0]] & regs.valid[code.src[1]] &
+                 regs.defined[code.src[2]];
+      break;
+    case COMPILED_AND_PREDICATE:
+    case COMPILED_OR_PREDICATE:
+    case COMPILED_XOR_PREDICATE:
+      defined &= regs.defined[code.src[1]];
+      // fall through
+    case COMPILED_NOT_PREDICATE:
+      defined &= regs.defined[code.src[0]];
+      break;
+    case COMPILED_UNIFORM:
+      return true;
+    default:
+      return false;
+  }
+  // If any enabled lanes have undefined sources then do each 
+  // lane on its own so that we report the same warnings
+  if ((defined & enabled) != enabled)
+  {
+    for (int i = 0; i < WARP_SIZE; i++)
+      if (enabled & (1U << i))
+        execute_instruction(code, threads[i]);
+    return true;
+  }
+  switch (code.opcode)
+  {
+    case COMPILED_MOVE:
+      {
+        warp_unary<MoveOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_NOT:
+      {
+        warp_unary<NotOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_NEGATE:
+      {
+        warp_unary<NegateOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_RIGHT_SHIFT:
+      {
+        warp_binary<RightShiftOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_LEFT_SHIFT:
+      {
+        warp_binary<LeftShiftOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_AND:
+      {
+        warp_binary<AndOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_OR:
+      {
+        warp_binary<OrOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_XOR:
+      {
+        warp_binary<XorOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_ADD:
+      {
+        warp_binary<AddOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_SUB:
+      {
+        warp_binary<SubOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_MULTIPLY:
+      {
+        warp_binary<MultiplyOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_MAD:
+      {
+        warp_ternary<MadOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_BFE:
+      {
+        warp_ternary<BitFieldExtractOp>(regs, code, enabled);
+        break;
+      }
+    case COMPILED_SET_PREDICATE:
+      {
+        switch (code.flags)
+        {
+          case COMP_GT:
+            {
+              warp_compare<GreaterOp>(regs, code, enabled);
+              break;
+            }
+          case COMP_GE:
+            {
+              warp_compare<GreaterEqualOp>(regs, code, enabled);
+              break;
+            }
+          case COMP_EQ:
+            {
+              warp_compare<EqualOp>(regs, code, enabled);
+              break;
+            }
+          case COMP_NE:
+            {
+              warp_compare<NotEqualOp>(regs, code, enabled);
+              break;
+            }
+          case COMP_LE:
+            {
+              warp_compare<LessEqualOp>(regs, code, enabled);
+              break;
+            }
+          case COMP_LT:
+            {
+              warp_compare<LessOp>(regs, code, enabled);
+              break;
+            }
+          default:
+            assert(false);
+        }
+        break;
+      }
+    case COMPILED_SELECT_PREDICATE:
+      {
+        const int64_t *a = &regs.values[code.src[0] * WARP_SIZE];
+        const int64_t *b = &regs.values[code.src[1] * WARP_SIZE];
+        int64_t *dst = &regs.values[code.dst * WARP_SIZE];
+        uint32_t select = regs.predicates[code.src[2]];
+        if (code.flags)
+          select = ~select;
+        for (int i = 0; i < WARP_SIZE; i++)
+          if (enabled & (1U << i))
+            dst[i] = (select & (1U << i)) ? a[i] : b[i];
+        regs.valid[code.dst] |= enabled;
+        break;
+      }
+    case COMPILED_AND_PREDICATE:
+      {
+        warp_set_predicate(regs, code.dst, regs.predicates[code.src[0]] &
+                           regs.predicates[code.src[1]], enabled);
+        break;
+      }
+    case COMPILED_OR_PREDICATE:
+      {
+        warp_set_predicate(regs, code.dst, regs.predicates[code.src[0]] |
+                           regs.predicates[code.src[1]], enabled);
+        break;
+      }
+    case COMPILED_XOR_PREDICATE:
+      {
+        warp_set_predicate(regs, code.dst, regs.predicates[code.src[0]] ^
+                           regs.predicates[code.src[1]], enabled);
+        break;
+      }
+    case COMPILED_NOT_PREDICATE:
+      {
+        warp_set_predicate(regs, code.dst, 
+                           ~regs.predicates[code.src[0]], enabled);
+        break;
+      }
+    default:
+      assert(false);
+  }
+  return true;
+}
+
+static inline uint32_t compute_enabled_lanes(const ThreadState *thread_state)
+{
+  uint32_t result = 0;
+  for (int i = 0; i < WARP_SIZE; i++)
+    if (thread_state[i].status == THREAD_ENABLED)
+      result |= (1U << i);
+  return result;
+}
+
+static inline void update_dynamic_counts(int *dynamic_instructions,
+                                         uint32_t enabled, int count)
+{
+  for (int i = 0; i < WARP_SIZE; i++)
+    if (enabled & (1U << i))
+      dynamic_instructions[i] += count;
+}
+
+Thread* Program::create_thread(int tid)
+{
+  // Threads are numbered with x varying fastest
+  const int x = tid % block_dim[0];
+  const int y = (tid / block_dim[0]) % block_dim[1];
+  const int z = tid / (block_dim[0] * block_dim[1]);
+  CTAState &state = cta_states[current_cta];
+  assert(state.threads[tid] == NULL);
+  Thread *thread = new Thread(tid, x, y, z, this, state.shared_memory);
+  state.threads[tid] = thread;
+  return thread;
+}
+
 void Program::emulate_warp(Thread **threads)
 {
+  // The warp interpreter relies on one 32-bit mask for all the lanes
+  assert(WARP_SIZE == 32);
+  // Give all the threads a lane in a structure-of-arrays register
+  // file so that ALU instructions can run across the whole warp
+  RegisterFile registers(register_count(), predicate_count(), WARP_SIZE);
+  for (int i = 0; i < WARP_SIZE; i++)
+    threads[i]->initialize(registers, i);
   // Execute all the threads in lock-step
-  PTXInstruction *pc = ptx_instructions.front();  
   ThreadState thread_state[WARP_SIZE];
   for (int i = 0; i < WARP_SIZE; i++)
     thread_state[i] = ThreadState();
@@ -608,35 +1287,41 @@ void Program::emulate_warp(Thread **threads)
   int shared_access_id = 0;
   SharedStore store;
   bool profile = weft->print_verbose();
-  if (profile)
+  const CompiledInstruction *code = &compiled_instructions.front();
+  int pc = 0;
+  uint32_t enabled = compute_enabled_lanes(thread_state);
+  // Count instructions in runs where the enabled lanes don't change
+  int executed = 0;
+  while (pc >= 0)
   {
-    while (pc != NULL)
+    if (profile)
     {
       for (int i = 0; i < WARP_SIZE; i++)
       {
-        if (thread_state[i].status == THREAD_ENABLED)
-        {
-          threads[i]->profile_instruction(pc);
-          dynamic_instructions[i]++;
-        }
+        if (enabled & (1U << i))
+          threads[i]->profile_instruction(code[pc].instruction);
       }
-      pc = pc->emulate_warp(threads, thread_state, 
-                            shared_access_id, store);
     }
-  }
-  else
-  {
-    while (pc != NULL)
+    executed++;
+    if (execute_warp_instruction(code[pc], registers, enabled, threads))
     {
-      for (int i = 0; i < WARP_SIZE; i++)
-      {
-        if (thread_state[i].status == THREAD_ENABLED)
-          dynamic_instructions[i]++;
-      }
-      pc = pc->emulate_warp(threads, thread_state, 
-                            shared_access_id, store);
+      pc = code[pc].next;
+      continue;
+    }
+    // Everything else goes through emulate_warp which can 
+    // change the set of enabled threads
+    PTXInstruction *next = code[pc].instruction->emulate_warp(threads, 
+                                thread_state, shared_access_id, store);
+    pc = (next == NULL) ? -1 : next->get_program_counter();
+    const uint32_t now_enabled = compute_enabled_lanes(thread_state);
+    if (now_enabled != enabled)
+    {
+      update_dynamic_counts(dynamic_instructions, enabled, executed);
+      enabled = now_enabled;
+      executed = 0;
     }
   }
+  update_dynamic_counts(dynamic_instructions, enabled, executed);
   for (int i = 0; i < WARP_SIZE; i++)
     threads[i]->set_dynamic_instructions(dynamic_instructions[i]);
 }
@@ -646,9 +1331,9 @@ void Program::get_kernel_prefix(char *buffer, size_t count)
   strncpy(buffer, kernel_name.c_str(), count);
 }
 
-void Program::add_line(const std::string &line, int line_num)
+void Program::add_line(const LineView &line)
 {
-  lines.push_back(std::pair<std::string,int>(line, line_num));
+  lines.push_back(line);
 }
 
 void Program::set_block_dim(const int *array)
@@ -699,21 +1384,525 @@ void Program::verify(void)
   print_statistics();
 }
 
+void Program::initialize_count(unsigned count)
+{
+  PTHREAD_SAFE_CALL( pthread_mutex_lock(&count_lock) ); 
+  assert(pending_count == 0);
+  pending_count = count;
+  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&count_lock) );
+}
+
+void Program::wait_until_done(void)
+{
+  PTHREAD_SAFE_CALL( pthread_mutex_lock(&count_lock) );
+  while (__atomic_load_n(&pending_count, __ATOMIC_ACQUIRE) > 0)
+  {
+    PTHREAD_SAFE_CALL( pthread_cond_wait(&count_cond, &count_lock) );
+  }
+  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&count_lock) );
+}
+
+void Program::enqueue_task(WeftTask *task)
+{
+  // Tasks report back to the program that launched them so that 
+  // stages from different programs can share the same thread pool
+  task->owner = this;
+  weft->enqueue_task(task);
+}
+
+void Program::spawn_task(WeftTask *task)
+{
+  // The task doing the spawning has not completed yet 
+  // so the count cannot have already reached zero
+  __sync_add_and_fetch(&pending_count, 1);
+  enqueue_task(task);
+}
+
+void Program::complete_task(void)
+{
+  // Only the last task needs the lock to wake up the waiter
+  const int remaining = __sync_sub_and_fetch(&pending_count, 1);
+  assert(remaining >= 0);
+  if (remaining == 0)
+  {
+    PTHREAD_SAFE_CALL( pthread_mutex_lock(&count_lock) );
+    PTHREAD_SAFE_CALL( pthread_cond_signal(&count_cond) );
+    PTHREAD_SAFE_CALL( pthread_mutex_unlock(&count_lock) );
+  }
+}
+
+void Program::buffer_output(void)
+{
+  assert((out == stdout) && (err == stderr));
+  FILE *out_file = tmpfile();
+  FILE *err_file = tmpfile();
+  if ((out_file == NULL) || (err_file == NULL))
+  {
+    fprintf(stderr,"WEFT WARNING: Unable to buffer the output for kernel %s, "
+                   "output may be interleaved with other kernels\n", 
+                   kernel_name.c_str());
+    if (out_file != NULL)
+      fclose(out_file);
+    if (err_file != NULL)
+      fclose(err_file);
+    return;
+  }
+  out = out_file;
+  err = err_file;
+}
+
+static void replay_file(FILE *from, FILE *to)
+{
+  char buffer[4096];
+  rewind(from);
+  size_t bytes;
+  while ((bytes = fread(buffer, 1, sizeof(buffer), from)) > 0)
+    fwrite(buffer, 1, bytes, to);
+  fflush(to);
+  fclose(from);
+}
+
+void Program::flush_output(void)
+{
+  if (out != stdout)
+  {
+    replay_file(out, stdout);
+    out = stdout;
+  }
+  if (err != stderr)
+  {
+    replay_file(err, stderr);
+    err = stderr;
+  }
+}
+
+int Program::get_register_slot(int64_t reg)
+{
+  int result;
+  std::map<int64_t,int>::const_iterator finder = register_slots.find(reg);
+  if (finder == register_slots.end())
+  {
+    result = register_names.size();
+    register_slots[reg] = result;
+    register_names.push_back(reg);
+  }
+  else
+    result = finder->second;
+  if (assigning_pc >= 0)
+    register_uses.push_back(std::pair<int,int>(result, assigning_pc));
+  return result;
+}
+
+int Program::get_destination_slot(int64_t reg)
+{
+  const int result = get_register_slot(reg);
+  // Undo recording this as a use and record a definition instead
+  if (assigning_pc >= 0)
+  {
+    register_uses.pop_back();
+    register_definitions.push_back(std::pair<int,int>(result, assigning_pc));
+  }
+  return result;
+}
+
+int Program::get_constant_slot(int64_t value)
+{
+  std::map<int64_t,int>::const_iterator finder = constant_slots.find(value);
+  if (finder != constant_slots.end())
+    return finder->second;
+  // Constants are never undefined so their names are never printed
+  int result = register_names.size();
+  constant_slots[value] = result;
+  register_names.push_back(0);
+  return result;
+}
+
+void Program::initialize_constants(Thread *thread) const
+{
+  for (std::map<int64_t,int>::const_iterator it = 
+        constant_slots.begin(); it != constant_slots.end(); it++)
+    thread->set_value(it->second, it->first);
+}
+
+void Program::initialize_uniforms(Thread *thread) const
+{
+  for (std::vector<std::pair<int,int64_t> >::const_iterator it = 
+        uniform_values.begin(); it != uniform_values.end(); it++)
+    thread->set_value(it->first, it->second);
+}
+
+int Program::get_predicate_slot(int64_t pred)
+{
+  std::map<int64_t,int>::const_iterator finder = predicate_slots.find(pred);
+  if (finder != predicate_slots.end())
+    return finder->second;
+  int result = predicate_names.size();
+  predicate_slots[pred] = result;
+  predicate_names.push_back(pred);
+  return result;
+}
+
+int Program::find_register_slot(int64_t reg) const
+{
+  std::map<int64_t,int>::const_iterator finder = register_slots.find(reg);
+  if (finder == register_slots.end())
+    return -1;
+  return finder->second;
+}
+
+void Program::compile_instructions(void)
+{
+  compiled_instructions.resize(ptx_instructions.size());
+  for (unsigned idx = 0; idx < ptx_instructions.size(); idx++)
+  {
+    PTXInstruction *instruction = ptx_instructions[idx];
+    CompiledInstruction &code = compiled_instructions[idx];
+    code.instruction = instruction;
+    PTXInstruction *next = instruction->get_next();
+    code.next = (next == NULL) ? -1 : next->get_program_counter();
+    instruction->compile(this, code);
+  }
+}
+
+static inline void find_successors(const CompiledInstruction &code,
+                                   std::vector<int> &successors)
+{
+  successors.clear();
+  switch (code.opcode)
+  {
+    case COMPILED_EXIT:
+      break;
+    case COMPILED_UNIFORM_BRANCH:
+      {
+        successors.push_back(code.target);
+        break;
+      }
+    case COMPILED_BRANCH:
+      {
+        // Predicated exits have no target
+        if (code.target >= 0)
+          successors.push_back(code.target);
+        // fall through
+      }
+    default:
+      if (code.next >= 0)
+        successors.push_back(code.next);
+  }
+}
+
+static inline int intersect_dominators(int a, int b, 
+                                       const std::vector<int> &idom,
+                                       const std::vector<int> &order_index)
+{
+  while (a != b)
+  {
+    while (order_index[a] > order_index[b])
+      a = idom[a];
+    while (order_index[b] > order_index[a])
+      b = idom[b];
+  }
+  return a;
+}
+
+static inline bool dominates(int a, int b, 
+                             const std::vector<std::pair<int,int> > &intervals)
+{
+  // A dominates B if B is in the subtree of A in the dominator tree
+  return ((intervals[a].first <= intervals[b].first) &&
+          (intervals[b].second <= intervals[a].second));
+}
+
+void Program::find_uniform_registers(void)
+{
+  // Many registers hold values like shared memory base addresses, 
+  // block dimensions, and constants that are the same for every
+  // thread in a CTA. A register is uniform if it has a single static
+  // definition by a pure ALU operation whose sources are constants, 
+  // CTA-wide special registers, or other uniform registers, and that
+  // definition dominates all the uses of the register. Such 
+  // definitions are evaluated once per CTA before emulation and 
+  // become no-ops in the interpreters.
+  const int num_instructions = compiled_instructions.size();
+  const int num_registers = register_count();
+  if (num_instructions == 0)
+    return;
+  // Store the predecessors of each instruction in one flat list,
+  // there are at most two successors so we recompute those as needed
+  std::vector<int> successors;
+  std::vector<int> predecessor_offsets(num_instructions+1, 0);
+  std::vector<int> predecessors;
+  {
+    for (int pc = 0; pc < num_instructions; pc++)
+    {
+      find_successors(compiled_instructions[pc], successors);
+      for (unsigned idx = 0; idx < successors.size(); idx++)
+        predecessor_offsets[successors[idx]+1]++;
+    }
+    for (int pc = 0; pc < num_instructions; pc++)
+      predecessor_offsets[pc+1] += predecessor_offsets[pc];
+    predecessors.resize(predecessor_offsets[num_instructions]);
+    std::vector<int> fill(predecessor_offsets.begin(), 
+                          predecessor_offsets.end()-1);
+    for (int pc = 0; pc < num_instructions; pc++)
+    {
+      find_successors(compiled_instructions[pc], successors);
+      for (unsigned idx = 0; idx < successors.size(); idx++)
+        predecessors[fill[successors[idx]]++] = pc;
+    }
+  }
+  // Compute a reverse post-order of the reachable instructions
+  std::vector<int> order;
+  std::vector<int> order_index(num_instructions, -1);
+  {
+    std::vector<char> visited(num_instructions, 0);
+    std::vector<std::pair<int,unsigned> > stack;
+    visited[0] = 1;
+    stack.push_back(std::pair<int,unsigned>(0, 0));
+    while (!stack.empty())
+    {
+      std::pair<int,unsigned> &top = stack.back();
+      find_successors(compiled_instructions[top.first], successors);
+      if (top.second < successors.size())
+      {
+        int next = successors[top.second++];
+        if (!visited[next])
+        {
+          visited[next] = 1;
+          stack.push_back(std::pair<int,unsigned>(next, 0));
+        }
+      }
+      else
+      {
+        order.push_back(top.first);
+        stack.pop_back();
+      }
+    }
+    std::reverse(order.begin(), order.end());
+    for (unsigned idx = 0; idx < order.size(); idx++)
+      order_index[order[idx]] = idx;
+  }
+  // Compute immediate dominators (Cooper, Harvey, and Kennedy)
+  std::vector<int> idom(num_instructions, -1);
+  idom[0] = 0;
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (unsigned idx = 1; idx < order.size(); idx++)
+    {
+      const int pc = order[idx];
+      int new_idom = -1;
+      for (int p = predecessor_offsets[pc]; 
+            p < predecessor_offsets[pc+1]; p++)
+      {
+        const int pred = predecessors[p];
+        if (idom[pred] < 0)
+          continue;
+        if (new_idom < 0)
+          new_idom = pred;
+        else
+          new_idom = intersect_dominators(pred, new_idom, idom, order_index);
+      }
+      if (idom[pc] != new_idom)
+      {
+        idom[pc] = new_idom;
+        changed = true;
+      }
+    }
+  }
+  // Number the dominator tree so that dominance checks are 
+  // constant time, walking up the tree is quadratic on long
+  // straight-line programs
+  std::vector<std::pair<int/*enter*/,int/*exit*/> > 
+    dom_intervals(num_instructions, std::pair<int,int>(-1, -1));
+  {
+    // Reuse the predecessor storage for the dominator tree children
+    std::vector<int> &child_offsets = predecessor_offsets;
+    std::vector<int> &children = predecessors;
+    std::fill(child_offsets.begin(), child_offsets.end(), 0);
+    for (unsigned idx = 1; idx < order.size(); idx++)
+      child_offsets[idom[order[idx]]+1]++;
+    for (int pc = 0; pc < num_instructions; pc++)
+      child_offsets[pc+1] += child_offsets[pc];
+    std::vector<int> fill(child_offsets.begin(), 
+                          child_offsets.end()-1);
+    for (unsigned idx = 1; idx < order.size(); idx++)
+      children[fill[idom[order[idx]]]++] = order[idx];
+    int counter = 0;
+    std::vector<std::pair<int,int> > stack;
+    dom_intervals[0].first = counter++;
+    stack.push_back(std::pair<int,int>(0, child_offsets[0]));
+    while (!stack.empty())
+    {
+      std::pair<int,int> &top = stack.back();
+      if (top.second < child_offsets[top.first+1])
+      {
+        int next = children[top.second++];
+        dom_intervals[next].first = counter++;
+        stack.push_back(std::pair<int,int>(next, child_offsets[next]));
+      }
+      else
+      {
+        dom_intervals[top.first].second = counter++;
+        stack.pop_back();
+      }
+    }
+  }
+  // Find the registers with a single reachable definition that 
+  // dominates all of their reachable uses
+  std::vector<int> definition(num_registers, -1);
+  std::vector<int> definition_count(num_registers, 0);
+  for (unsigned idx = 0; idx < register_definitions.size(); idx++)
+  {
+    definition[register_definitions[idx].first] = 
+      register_definitions[idx].second;
+    definition_count[register_definitions[idx].first]++;
+  }
+  std::vector<char> candidate(num_registers, 0);
+  for (int slot = 0; slot < num_registers; slot++)
+    candidate[slot] = (definition_count[slot] == 1) && 
+                      (order_index[definition[slot]] >= 0);
+  for (unsigned idx = 0; idx < register_uses.size(); idx++)
+  {
+    const int slot = register_uses[idx].first;
+    const int pc = register_uses[idx].second;
+    if (!candidate[slot] || (order_index[pc] < 0))
+      continue;
+    if ((pc == definition[slot]) || !dominates(definition[slot], pc, dom_intervals))
+      candidate[slot] = 0;
+  }
+  // Constants and special registers that are the same for 
+  // every thread in the CTA are uniform to start with
+  std::vector<char> uniform(num_registers, 0);
+  for (std::map<int64_t,int>::const_iterator it = 
+        constant_slots.begin(); it != constant_slots.end(); it++)
+    uniform[it->second] = 1;
+  const int64_t uniform_specials[] = { WEFT_NTID_X_REG, WEFT_NTID_Y_REG, 
+    WEFT_NTID_Z_REG, WEFT_NWARP_REG, WEFT_CTA_X_REG, WEFT_CTA_Y_REG, 
+    WEFT_CTA_Z_REG, WEFT_NCTA_X_REG, WEFT_NCTA_Y_REG, WEFT_NCTA_Z_REG };
+  for (unsigned idx = 0; 
+        idx < (sizeof(uniform_specials)/sizeof(int64_t)); idx++)
+  {
+    const int slot = find_register_slot(uniform_specials[idx]);
+    if ((slot >= 0) && (definition_count[slot] == 0))
+      uniform[slot] = 1;
+  }
+  // Now iterate until we stop finding uniform registers, the 
+  // order we find them in is a valid order for evaluating them
+  changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (int slot = 0; slot < num_registers; slot++)
+    {
+      if (!candidate[slot] || uniform[slot])
+        continue;
+      const int pc = definition[slot];
+      const CompiledInstruction &code = compiled_instructions[pc];
+      int num_sources;
+      switch (code.opcode)
+      {
+        case COMPILED_MOVE:
+        case COMPILED_NOT:
+        case COMPILED_NEGATE:
+          {
+            num_sources = 1;
+            break;
+          }
+        case COMPILED_RIGHT_SHIFT:
+        case COMPILED_LEFT_SHIFT:
+        case COMPILED_AND:
+        case COMPILED_OR:
+        case COMPILED_XOR:
+        case COMPILED_ADD:
+        case COMPILED_SUB:
+        case COMPILED_MULTIPLY:
+          {
+            num_sources = 2;
+            break;
+          }
+        case COMPILED_MAD:
+        case COMPILED_BFE:
+          {
+            num_sources = 3;
+            break;
+          }
+        case COMPILED_EMULATE:
+          {
+            // Moves of shared memory addresses are uniform if the
+            // declaration always executes before the move
+            num_sources = -1;
+            if (!code.instruction->is_move())
+              break;
+            const std::string &name = 
+              code.instruction->as_move()->get_shared_source();
+            std::map<std::string,int>::const_iterator finder = 
+              shared_declarations.find(name);
+            if ((finder != shared_declarations.end()) &&
+                (order_index[finder->second] >= 0) &&
+                dominates(finder->second, pc, dom_intervals))
+              num_sources = 0;
+            break;
+          }
+        default:
+          num_sources = -1;
+      }
+      if (num_sources < 0)
+      {
+        candidate[slot] = 0;
+        continue;
+      }
+      bool all_uniform = true;
+      for (int idx = 0; idx < num_sources; idx++)
+      {
+        if (!uniform[code.src[idx]])
+        {
+          all_uniform = false;
+          break;
+        }
+      }
+      if (!all_uniform)
+        continue;
+      uniform[slot] = 1;
+      uniform_instructions.push_back(code);
+      changed = true;
+    }
+  }
+  // Turn all the uniform instructions into no-ops
+  for (unsigned idx = 0; idx < uniform_instructions.size(); idx++)
+  {
+    const int pc = uniform_instructions[idx].instruction->get_program_counter();
+    compiled_instructions[pc].opcode = COMPILED_UNIFORM;
+  }
+  // We no longer need the definitions and uses
+  std::vector<std::pair<int,int> >().swap(register_definitions);
+  std::vector<std::pair<int,int> >().swap(register_uses);
+}
+
 void Program::convert_to_instructions(
                 const std::map<int,const char*> &source_files)
 {
-  // Make a first pass and create all the instructions
-  // Track all the basic block program counters
+  // Interpret all the lines first, each line only depends on its own
+  // text so chunks of lines can be interpreted on the thread pool
+  parsed_lines.resize(lines.size());
+  ParseLines parse_body(this);
+  weft->parallel_for(this, &parse_body, 0, lines.size(), MIN_PARSE_CHUNK);
+  // Then make a serial pass to chain the instructions together
+  // in order and record source locations and labels
   std::map<std::string,PTXLabel*> labels;
   PTXInstruction *previous = NULL;
   int current_source_file = -1;
   int current_source_line = -1;
-  for (std::vector<std::pair<std::string,int> >::const_iterator it = 
-        lines.begin(); it != lines.end(); it++)
+  for (std::vector<ParsedLine>::const_iterator it = 
+        parsed_lines.begin(); it != parsed_lines.end(); it++)
   {
-    if (parse_source_location(it->first, current_source_file, current_source_line))
+    if (it->location)
+    {
+      current_source_file = it->source_file;
+      current_source_line = it->source_line;
       continue;
-    PTXInstruction *next = PTXInstruction::interpret(it->first, it->second);
+    }
+    PTXInstruction *next = it->instruction;
     // Skip any empty lines
     if (next == NULL)
       continue;
@@ -724,16 +1913,20 @@ void Program::convert_to_instructions(
       assert(finder != source_files.end());
       next->set_source_location(finder->second, current_source_line);
     }
+    next->set_program_counter(ptx_instructions.size());
     ptx_instructions.push_back(next);
     if (next->is_label())
     {
       PTXLabel *label = next->as_label();
       label->update_labels(labels);
     }
+    if (next->is_shared_decl())
+      next->as_shared_decl()->assign_address();
     if (previous != NULL)
       previous->set_next(next);
     previous = next;
   } 
+  std::vector<ParsedLine>().swap(parsed_lines);
   // Then make a second pass to fill in the pointers
   for (std::vector<PTXInstruction*>::const_iterator it = 
         ptx_instructions.begin(); it != ptx_instructions.end(); it++)
@@ -749,6 +1942,22 @@ void Program::convert_to_instructions(
       barrier->update_count(max_num_threads);
     }
   }
+  // Then make a third pass to map all the registers onto dense
+  // slot indices so that threads can use flat register files
+  for (std::vector<PTXInstruction*>::const_iterator it = 
+        ptx_instructions.begin(); it != ptx_instructions.end(); it++)
+  {
+    assigning_pc = (*it)->get_program_counter();
+    (*it)->assign_slots(this);
+    if ((*it)->is_shared_decl())
+      shared_declarations[(*it)->as_shared_decl()->get_name()] = assigning_pc;
+  }
+  assigning_pc = -1;
+  // Now that we have slots we can build the pre-decoded
+  // form of the program for the scalar interpreter
+  compile_instructions();
+  // Find any registers that we only need to compute once per CTA
+  find_uniform_registers();
   // Check for shuffles, if we have shuffles then make sure
   // that we have enabled warp-synchronous execution
   if (!warp_synchronous && has_shuffles())
@@ -762,6 +1971,29 @@ void Program::convert_to_instructions(
   lines.clear();
 }
 
+void Program::parse_lines(int start, int stop)
+{
+  std::string line;
+  std::vector<std::string> tokens;
+  for (int idx = start; idx < stop; idx++)
+  {
+    const LineView &view = lines[idx];
+    // Only one line of the file is ever copied out of the mapping
+    line.assign(view.text, view.length);
+    // Each line is split exactly once for all the parsers
+    tokens.clear();
+    split(tokens, line.c_str());
+    ParsedLine &parsed = parsed_lines[idx];
+    if (parse_source_location(tokens, parsed.source_file, parsed.source_line))
+    {
+      parsed.location = true;
+      continue;
+    }
+    parsed.instruction = 
+      PTXInstruction::interpret(line, tokens, view.line_number);
+  }
+}
+
 /*static*/
 bool Program::parse_file_location(const std::string &line,
                                   std::map<int,const char*> &source_files)
@@ -782,14 +2014,11 @@ bool Program::parse_file_location(const std::string &line,
 }
 
 /*static*/
-bool Program::parse_source_location(const std::string &line,
+bool Program::parse_source_location(const std::vector<std::string> &tokens,
                                     int &source_file, int &source_line)
 {
-  if ((line.find(".loc") != std::string::npos) &&
-      (line.find(".local") == std::string::npos))
+  if (!tokens.empty() && (tokens[0] == ".loc"))
   {
-    std::vector<std::string> tokens;
-    split(tokens, line.c_str());
     assert(tokens.size() == 4);
     source_file = atoi(tokens[1].c_str());
     source_line = atoi(tokens[2].c_str());
@@ -801,6 +2030,7 @@ bool Program::parse_source_location(const std::string &line,
 void Program::start_instrumentation(ProgramStage stage)
 {
   timing[stage] = weft->get_current_time_in_micros();
+  trace_usage[stage] = count_trace_bytes();
 }
 
 void Program::stop_instrumentation(ProgramStage stage)
@@ -809,6 +2039,22 @@ void Program::stop_instrumentation(ProgramStage stage)
   unsigned long long start = timing[stage];
   timing[stage] = stop - start;
   memory_usage[stage] = weft->get_memory_usage();
+  trace_usage[stage] = count_trace_bytes() - trace_usage[stage];
+}
+
+size_t Program::count_trace_bytes(void) const
+{
+  if (current_cta >= cta_states.size())
+    return 0;
+  size_t result = 0;
+  const std::vector<Thread*> &threads = cta_states[current_cta].threads;
+  for (std::vector<Thread*>::const_iterator it = threads.begin();
+        it != threads.end(); it++)
+  {
+    if ((*it) != NULL)
+      result += (*it)->count_trace_bytes();
+  }
+  return result;
 }
 
 void Program::report_instrumentation(size_t &accumulated_memory)
@@ -820,57 +2066,129 @@ void Program::report_instrumentation(size_t &accumulated_memory)
   fprintf(stdout,"WEFT INSTRUMENTATION FOR KERNEL %s\n", kernel_name.c_str());
   unsigned long long total_time = 0;
   size_t total_memory = 0;
+  size_t total_trace = 0;
   for (int i = 0; i < TOTAL_STAGES; i++)
   {
     double time = double(timing[i]) * 1e-3;
     size_t memory = memory_usage[i] - accumulated_memory;
 #ifdef __MACH__
-    fprintf(stdout,"  %50s: %10.3lf ms %12ld MB\n",
-            stage_names[i], time, memory / (1024 * 1024));
+    fprintf(stdout,"  %50s: %10.3lf ms %12ld MB %12ld KB trace\n",
+            stage_names[i], time, memory / (1024 * 1024), 
+            trace_usage[i] / 1024);
 #else
-    fprintf(stdout,"  %50s: %10.3lf ms %12ld MB\n",
-            stage_names[i], time, memory / 1024);
+    fprintf(stdout,"  %50s: %10.3lf ms %12ld MB %12ld KB trace\n",
+            stage_names[i], time, memory / 1024, trace_usage[i] / 1024);
 #endif
     total_time += timing[i];
     total_memory += memory;
+    total_trace += trace_usage[i];
     accumulated_memory += memory;
   }
 #ifdef __MACH__
-  fprintf(stdout,"  %50s: %10.3lf ms %12ld MB\n",
-          "Total", double(total_time) * 1e-3, total_memory / (1024*1024));
+  fprintf(stdout,"  %50s: %10.3lf ms %12ld MB %12ld KB trace\n",
+          "Total", double(total_time) * 1e-3, total_memory / (1024*1024),
+          total_trace / 1024);
 #else
-  fprintf(stdout,"  %50s: %10.3lf ms %12ld MB\n",
-          "Total", double(total_time) * 1e-3, total_memory / 1024);
+  fprintf(stdout,"  %50s: %10.3lf ms %12ld MB %12ld KB trace\n",
+          "Total", double(total_time) * 1e-3, total_memory / 1024,
+          total_trace / 1024);
 #endif
 }
 
 Thread::Thread(unsigned tid, int tidx, int tidy, int tidz,
                Program *p, SharedMemory *m)
   : thread_id(tid), tid_x(tidx), tid_y(tidy), tid_z(tidz),
-    program(p), shared_memory(m), 
-    max_barrier_name(-1), dynamic_instructions(0)
+    program(p), shared_memory(m), local_registers(NULL),
+    register_values(NULL), register_valid(NULL), predicate_values(NULL), 
+    predicate_defined(NULL), register_lanes(1), register_lane(0),
+    max_barrier_name(-1), dynamic_instructions(0), total_barriers(0)
 {
   dynamic_counts.resize(PTX_LAST, 0);
 }
 
 Thread::~Thread(void)
 {
-  // Clean up our instructions
-  for (std::vector<WeftInstruction*>::iterator it = 
-        instructions.begin(); it != instructions.end(); it++)
-  {
-    delete (*it);
-  }
-  instructions.clear();
+  // Clean up our happens, the arena frees the memory in bulk
   for (std::deque<Happens*>::iterator it = 
         all_happens.begin(); it != all_happens.end(); it++)
   {
-    delete (*it);
+    (*it)->~Happens();
   }
   all_happens.clear();
 }
 
+ThreadArena::ThreadArena(void)
+  : next(NULL), remaining(0), allocated_bytes(0), reserved_bytes(0)
+{
+}
+
+ThreadArena::~ThreadArena(void)
+{
+  for (std::vector<char*>::iterator it = chunks.begin();
+        it != chunks.end(); it++)
+  {
+    free(*it);
+  }
+  chunks.clear();
+}
+
+void ThreadArena::allocate_chunk(size_t size)
+{
+  // Start small since many threads only do a few accesses
+  // and double the chunk size as the thread grows
+  const size_t min_chunk_size = 1024;
+  const size_t max_chunk_size = 1024 * 1024;
+  size_t chunk_size = chunks.empty() ? min_chunk_size : (2 * reserved_bytes);
+  if (chunk_size > max_chunk_size)
+    chunk_size = max_chunk_size;
+  if (chunk_size < size)
+    chunk_size = size;
+  // Any space left in the current chunk is abandoned
+  next = (char*)malloc(chunk_size);
+  assert(next != NULL);
+  chunks.push_back(next);
+  remaining = chunk_size;
+  reserved_bytes += chunk_size;
+}
+
+RegisterFile::RegisterFile(int num_registers, int num_predicates, int l)
+  : lanes(l)
+{
+  // Always have at least one word so we never index an empty vector
+  values.resize(num_registers * lanes + 1, 0);
+  valid.resize((num_registers * lanes) / 32 + 1, 0);
+  predicates.resize((num_predicates * lanes) / 32 + 1, 0);
+  defined.resize((num_predicates * lanes) / 32 + 1, 0);
+}
+
 void Thread::initialize(void)
+{
+  // Make our own register file with a single lane
+  assert(local_registers == NULL);
+  local_registers = new RegisterFile(program->register_count(),
+                                     program->predicate_count(), 1);
+  bind_registers(*local_registers, 0);
+  initialize_registers();
+}
+
+void Thread::initialize(RegisterFile &warp_registers, int lane)
+{
+  // Use our lane of the register file for our warp
+  bind_registers(warp_registers, lane);
+  initialize_registers();
+}
+
+void Thread::bind_registers(RegisterFile &registers, int lane)
+{
+  register_values = &registers.values[0];
+  register_valid = &registers.valid[0];
+  predicate_values = &registers.predicates[0];
+  predicate_defined = &registers.defined[0];
+  register_lanes = registers.lanes;
+  register_lane = lane;
+}
+
+void Thread::initialize_registers(void)
 {
   int block_dim[3];
   int block_id[3];
@@ -878,24 +2196,27 @@ void Thread::initialize(void)
   program->fill_block_dim(block_dim);
   program->fill_block_id(block_id);
   program->fill_grid_dim(grid_dim);
+  program->initialize_constants(this);
   // Before starting emulation fill in the special
   // values for particular registers
-  register_store[WEFT_TID_X_REG] = tid_x;
-  register_store[WEFT_TID_Y_REG] = tid_y;
-  register_store[WEFT_TID_Z_REG] = tid_z;
-  register_store[WEFT_NTID_X_REG] = block_dim[0];
-  register_store[WEFT_NTID_Y_REG] = block_dim[1];
-  register_store[WEFT_NTID_Z_REG] = block_dim[2];
-  register_store[WEFT_LANE_REG] = (thread_id % WARP_SIZE);
-  register_store[WEFT_WARP_REG] = (thread_id / WARP_SIZE);
-  register_store[WEFT_NWARP_REG] = 
-    (block_dim[0] * block_dim[1] * block_dim[2] + (WARP_SIZE-1)) / WARP_SIZE;
-  register_store[WEFT_CTA_X_REG] = block_id[0];
-  register_store[WEFT_CTA_Y_REG] = block_id[1];
-  register_store[WEFT_CTA_Z_REG] = block_id[2];
-  register_store[WEFT_NCTA_X_REG] = grid_dim[0];
-  register_store[WEFT_NCTA_Y_REG] = grid_dim[1];
-  register_store[WEFT_NCTA_Z_REG] = grid_dim[2];
+  initialize_special_register(WEFT_TID_X_REG, tid_x);
+  initialize_special_register(WEFT_TID_Y_REG, tid_y);
+  initialize_special_register(WEFT_TID_Z_REG, tid_z);
+  initialize_special_register(WEFT_NTID_X_REG, block_dim[0]);
+  initialize_special_register(WEFT_NTID_Y_REG, block_dim[1]);
+  initialize_special_register(WEFT_NTID_Z_REG, block_dim[2]);
+  initialize_special_register(WEFT_LANE_REG, (thread_id % WARP_SIZE));
+  initialize_special_register(WEFT_WARP_REG, (thread_id / WARP_SIZE));
+  initialize_special_register(WEFT_NWARP_REG,
+    (block_dim[0] * block_dim[1] * block_dim[2] + (WARP_SIZE-1)) / WARP_SIZE);
+  initialize_special_register(WEFT_CTA_X_REG, block_id[0]);
+  initialize_special_register(WEFT_CTA_Y_REG, block_id[1]);
+  initialize_special_register(WEFT_CTA_Z_REG, block_id[2]);
+  initialize_special_register(WEFT_NCTA_X_REG, grid_dim[0]);
+  initialize_special_register(WEFT_NCTA_Y_REG, grid_dim[1]);
+  initialize_special_register(WEFT_NCTA_Z_REG, grid_dim[2]);
+  // Uniform registers were already computed for the whole CTA
+  program->initialize_uniforms(this);
 }
 
 void Thread::emulate(void)
@@ -907,8 +2228,15 @@ void Thread::cleanup(void)
 {
   // Once we are done we can clean up all our data structures
   shared_locations.clear();
-  register_store.clear();
-  predicate_store.clear();
+  if (local_registers != NULL)
+  {
+    delete local_registers;
+    local_registers = NULL;
+  }
+  register_values = NULL;
+  register_valid = NULL;
+  predicate_values = NULL;
+  predicate_defined = NULL;
   globals.clear();
 }
 
@@ -970,53 +2298,57 @@ bool Thread::get_global_value(int64_t addr, int64_t &value)
   return false;
 }
 
-void Thread::set_value(int64_t reg, int64_t value)
+void Thread::initialize_special_register(int64_t reg, int64_t value)
 {
-  register_store[reg] = value;
+  // Special registers only get slots if the program reads them
+  const int slot = program->find_register_slot(reg);
+  if (slot >= 0)
+    set_value(slot, value);
 }
 
-bool Thread::get_value(int64_t reg, int64_t &value)
+bool Thread::report_undefined_register(int64_t reg)
 {
-  std::map<int64_t,int64_t>::const_iterator finder = 
-    register_store.find(reg);
-  if (finder == register_store.end()) {
-    if (program->weft->report_warnings())
-    {
-      char buffer[11];
-      PTXInstruction::decompress_identifier(reg, buffer, 11);
-      fprintf(stderr,"WEFT WARNING: Unable to find register %s\n", buffer);
-    }
-    return false;
+  if (program->weft->report_warnings())
+  {
+    char buffer[11];
+    PTXInstruction::decompress_identifier(
+        program->get_register_name(reg), buffer, 11);
+    fprintf(stderr,"WEFT WARNING: Unable to find register %s\n", buffer);
   }
-  value = finder->second;
-  return true;
+  return false;
 }
 
-void Thread::set_pred(int64_t pred, bool value)
+bool Thread::report_undefined_predicate(int64_t pred)
 {
-  predicate_store[pred] = value;
+  if (program->weft->report_warnings())
+  {
+    char buffer[11];
+    PTXInstruction::decompress_identifier(
+        program->get_predicate_name(pred), buffer, 11);
+    fprintf(stderr,"WEFT WARNING: Unable to find predicate %s\n", buffer);
+  }
+  return false;
 }
 
-bool Thread::get_pred(int64_t pred, bool &value)
+void Thread::add_shared_access(PTXInstruction *access, bool write,
+                               int address, int log_width, int access_id)
 {
-  std::map<int64_t,bool>::const_iterator finder = 
-    predicate_store.find(pred);
-  if (finder == predicate_store.end()) {
-    if (program->weft->report_warnings())
-    {
-      char buffer[11];
-      PTXInstruction::decompress_identifier(pred, buffer, 11);
-      fprintf(stderr,"WEFT WARNING: Unable to find predicate %s\n", buffer);
-    }
-    return false;
-  }
-  value = finder->second;
-  return true;
+  // The trace is our log of accesses, the shared memory
+  // buckets them by address once emulation is done
+  instructions.push_back(WeftInstruction(
+        write ? WEFT_SHARED_WRITE : WEFT_SHARED_READ,
+        access->get_program_counter(), address, access_id, 
+        total_barriers, log_width));
 }
 
-void Thread::add_instruction(WeftInstruction *instruction)
+void Thread::add_barrier(PTXInstruction *barrier, bool sync, 
+                         int name, int count)
 {
-  instructions.push_back(instruction);
+  // The generation is filled in when we build the barrier graph
+  instructions.push_back(WeftInstruction(
+        sync ? WEFT_BARRIER_SYNC : WEFT_BARRIER_ARRIVE,
+        barrier->get_program_counter(), name, count, -1/*generation*/));
+  total_barriers++;
 }
 
 void Thread::update_max_barrier_name(int name)
@@ -1058,25 +2390,19 @@ void Thread::dump_weft_thread(void)
     fprintf(stderr, "WEFT WARNING: Failed to open file %s\n", file_name);
     return ;
   }
-  for (std::vector<WeftInstruction*>::const_iterator it = 
+  for (std::vector<WeftInstruction>::const_iterator it = 
         instructions.begin(); it != instructions.end(); it++)
   {
-    (*it)->print_instruction(weft_file);
+    it->print_instruction(weft_file);
   }
   assert(fclose(weft_file) == 0);
 }
 
-void Thread::update_shared_memory(WeftAccess *access)
+void Thread::initialize_happens(BarrierDependenceGraph *graph)
 {
-  shared_memory->update_accesses(access);
-}
-
-void Thread::initialize_happens(int total_threads,
-                                int max_num_barriers)
-{
-  initialize_happens_instances(total_threads); 
-  compute_barriers_before(max_num_barriers);
-  compute_barriers_after(max_num_barriers);
+  initialize_happens_instances(); 
+  compute_barriers_before(graph);
+  compute_barriers_after(graph);
 }
 
 void Thread::update_happens_relationships(void)
@@ -1088,51 +2414,81 @@ void Thread::update_happens_relationships(void)
   }
 }
 
-void Thread::initialize_happens_instances(int total_threads)
+void Thread::compute_barrier_signature(std::vector<int> &signature) const
 {
-  // First create
-  Happens *next = NULL;  
-  for (std::vector<WeftInstruction*>::const_iterator it = 
+  // Record the barrier instances we participate in and 
+  // where the intervals of accesses between them are
+  signature.clear();
+  bool in_interval = false;
+  for (std::vector<WeftInstruction>::const_iterator it = 
         instructions.begin(); it != instructions.end(); it++)
   {
-    // Don't make happens for barriers
-    if ((*it)->is_barrier())
+    if (it->is_barrier())
     {
-      next = NULL;
-      continue;
+      assert(it->get_generation() >= 0);
+      signature.push_back(it->is_sync() ? 1 : 2);
+      signature.push_back(it->get_name());
+      signature.push_back(it->get_generation());
+      in_interval = false;
     }
-    if (next == NULL)
+    else if (!in_interval)
     {
-      next = new Happens(total_threads);
-      all_happens.push_back(next);
+      signature.push_back(0);
+      in_interval = true;
     }
-    (*it)->initialize_happens(next);
   }
 }
 
-void Thread::compute_barriers_before(int max_num_barriers)
+void Thread::share_happens(const Thread *representative)
+{
+  // Use the happens for the same intervals in the representative
+  // thread, it still owns them so we don't add them to all_happens
+  assert(total_barriers == representative->total_barriers);
+  interval_happens = representative->interval_happens;
+}
+
+void Thread::initialize_happens_instances(void)
 {
-  std::vector<WeftBarrier*> before_barriers(max_num_barriers, NULL);
+  // Make a happens for each interval between barriers with accesses
+  interval_happens.resize(total_barriers+1, NULL);
+  for (std::vector<WeftInstruction>::const_iterator it = 
+        instructions.begin(); it != instructions.end(); it++)
+  {
+    // Don't make happens for barriers
+    if (it->is_barrier())
+      continue;
+    Happens *&happens = interval_happens[it->get_interval()];
+    if (happens == NULL)
+    {
+      happens = new (arena) Happens();
+      all_happens.push_back(happens);
+    }
+  }
+}
+
+void Thread::compute_barriers_before(BarrierDependenceGraph *graph)
+{
+  std::vector<BarrierInstance*> before_barriers(graph->max_num_barriers, NULL);
   bool has_update = false;
-  for (std::vector<WeftInstruction*>::const_iterator it = 
+  for (std::vector<WeftInstruction>::const_iterator it = 
         instructions.begin(); it != instructions.end(); it++)
   {
     // We only count syncs in the set of barriers before
     // because they are the only instructions which can 
     // establish a happens-before relationship. On the
     // contrary, arrives can always establish a happens-after.
-    if ((*it)->is_sync())
+    if (it->is_sync())
     {
-      WeftBarrier *bar = (*it)->as_barrier(); 
-      assert(bar->name < max_num_barriers);
-      before_barriers[bar->name] = bar;
+      assert(it->get_name() < graph->max_num_barriers);
+      before_barriers[it->get_name()] = 
+        graph->get_instance(it->get_name(), it->get_generation());
       has_update = true;
     }
-    else if ((*it)->is_arrive())
+    else if (it->is_arrive())
       has_update = true; // set to true to update next happens
     else if (has_update)
     {
-      Happens *happens = (*it)->get_happens();
+      Happens *happens = get_happens(*it);
       assert(happens != NULL);
       happens->update_barriers_before(before_barriers);
       has_update = false;
@@ -1140,23 +2496,23 @@ void Thread::compute_barriers_before(int max_num_barriers)
   }
 }
 
-void Thread::compute_barriers_after(int max_num_barriers)
+void Thread::compute_barriers_after(BarrierDependenceGraph *graph)
 {
-  std::vector<WeftBarrier*> after_barriers(max_num_barriers, NULL);
+  std::vector<BarrierInstance*> after_barriers(graph->max_num_barriers, NULL);
   bool has_update = false;
-  for (std::vector<WeftInstruction*>::reverse_iterator it = 
+  for (std::vector<WeftInstruction>::const_reverse_iterator it = 
         instructions.rbegin(); it != instructions.rend(); it++)
   {
-    if ((*it)->is_barrier())
+    if (it->is_barrier())
     {
-      WeftBarrier *bar = (*it)->as_barrier();
-      assert(bar->name < max_num_barriers);
-      after_barriers[bar->name] = bar;
+      assert(it->get_name() < graph->max_num_barriers);
+      after_barriers[it->get_name()] = 
+        graph->get_instance(it->get_name(), it->get_generation());
       has_update = true;
     }
     else if (has_update)
     {
-      Happens *happens = (*it)->get_happens();
+      Happens *happens = get_happens(*it);
       assert(happens != NULL);
       happens->update_barriers_after(after_barriers);
       has_update = false;
@@ -1178,64 +2534,84 @@ bool SharedStore::read(int64_t addr, int64_t &value)
   return true;
 }
 
-EmulateThread::EmulateThread(Thread *t)
-  : WeftTask(), thread(t)
+EmulateThread::EmulateThread(Program *p)
+  : ParallelBody(), program(p)
 {
 }
 
-void EmulateThread::execute(void)
+void EmulateThread::execute(int start, int stop)
 {
-  thread->initialize();
-  thread->emulate();
-  thread->cleanup();
+  for (int tid = start; tid < stop; tid++)
+  {
+    Thread *thread = program->create_thread(tid);
+    thread->initialize();
+    thread->emulate();
+    thread->cleanup();
+  }
 }
 
-EmulateWarp::EmulateWarp(Program *p, Thread **start)
-  : WeftTask(), program(p), threads(start)
+EmulateWarp::EmulateWarp(Program *p, Thread **t)
+  : ParallelBody(), program(p), threads(t)
 {
 }
 
-void EmulateWarp::execute(void)
+void EmulateWarp::execute(int start, int stop)
 {
-  // Initialize all the threads
-  for (int i = 0; i < WARP_SIZE; i++)
-    threads[i]->initialize();
+  for (int warp = start; warp < stop; warp++)
+  {
+    Thread **warp_threads = threads + (warp * WARP_SIZE);
+    for (int i = 0; i < WARP_SIZE; i++)
+      program->create_thread(warp * WARP_SIZE + i);
+    // Have the program simulate all the threads together,
+    // it initializes them with lanes of a warp register file
+    program->emulate_warp(warp_threads);
+
+    // Cleanup all the threads
+    for (int i = 0; i < WARP_SIZE; i++)
+      warp_threads[i]->cleanup();
+  }
+}
 
-  // Have the program simulate all the threads together
-  program->emulate_warp(threads);
+InitializeHappens::InitializeHappens(Thread **t, BarrierDependenceGraph *g)
+  : ParallelBody(), threads(t), graph(g)
+{
+}
 
-  // Cleanup all the threads
-  for (int i = 0; i < WARP_SIZE; i++)
-    threads[i]->cleanup();
+void InitializeHappens::execute(int start, int stop)
+{
+  for (int idx = start; idx < stop; idx++)
+    threads[idx]->initialize_happens(graph);
 }
 
-InitializationTask::InitializationTask(Thread *t, int total, int max_barriers)
-  : WeftTask(), thread(t), total_threads(total), max_num_barriers(max_barriers)
+UpdateHappens::UpdateHappens(Thread **t)
+  : ParallelBody(), threads(t)
 {
 }
 
-void InitializationTask::execute(void)
+void UpdateHappens::execute(int start, int stop)
 {
-  thread->initialize_happens(total_threads, max_num_barriers);
+  for (int idx = start; idx < stop; idx++)
+    threads[idx]->update_happens_relationships();
 }
 
-UpdateThreadTask::UpdateThreadTask(Thread *t)
-  : WeftTask(), thread(t)
+ParseLines::ParseLines(Program *p)
+  : ParallelBody(), program(p)
 {
 }
 
-void UpdateThreadTask::execute(void)
+void ParseLines::execute(int start, int stop)
 {
-  thread->update_happens_relationships();
+  program->parse_lines(start, stop);
 }
 
-DumpThreadTask::DumpThreadTask(Thread *t)
-  : WeftTask(), thread(t)
+DumpThread::DumpThread(Thread **t)
+  : ParallelBody(), threads(t)
 {
 }
 
-void DumpThreadTask::execute(void)
+void DumpThread::execute(int start, int stop)
 {
-  thread->dump_weft_thread();
+  for (int idx = start; idx < stop; idx++)
+    threads[idx]->dump_weft_thread();
 }
 
@@ -21,8 +21,13 @@
 #include <map>
 #include <deque>
 #include <vector>
+#include <new>
+#include <cstdio>
 #include <cassert>
 #include <stdint.h>
+#include <pthread.h>
+
+#include "instruction.h"
 
 enum ThreadStatus {
   THREAD_ENABLED,
@@ -40,12 +45,56 @@ enum ProgramStage {
 
 class Weft;
 class Thread;
+class WeftTask;
 class Happens;
 class PTXLabel;
-class WeftAccess;
 class SharedMemory;
 class PTXInstruction;
-class WeftInstruction;
+class PTXSharedDecl;
+class BarrierDependenceGraph;
+
+// A view of one line of a mapped PTX file
+struct LineView {
+public:
+  LineView(const char *t, int len, int num)
+    : text(t), length(len), line_number(num) { }
+public:
+  const char *text;
+  int length;
+  int line_number;
+};
+
+// The result of interpreting one line of PTX, lines 
+// with source locations do not produce an instruction
+struct ParsedLine {
+public:
+  ParsedLine(void)
+    : instruction(NULL), location(false), 
+      source_file(-1), source_line(-1) { }
+public:
+  PTXInstruction *instruction;
+  bool location;
+  int source_file;
+  int source_line;
+};
+
+// A read-only memory mapping of a PTX file, lines are handed out
+// as views into the mapping so the text is never copied
+class MappedFile {
+public:
+  MappedFile(const char *file_name);
+  MappedFile(const MappedFile &rhs) { assert(false); }
+  ~MappedFile(void);
+public:
+  MappedFile& operator=(const MappedFile &rhs) { assert(false); return *this; }
+public:
+  inline bool is_open(void) const { return (fd >= 0); }
+  bool next_line(size_t &offset, const char *&line, int &length) const;
+protected:
+  int fd;
+  const char *data;
+  size_t size;
+};
 
 struct ThreadState {
 public:
@@ -83,8 +132,15 @@ public:
   inline int count_instructions(void) const { return ptx_instructions.size(); }
   inline int barrier_upper_bound(void) const { return max_num_barriers; }
   inline int thread_count(void) const { return max_num_threads; }
+  inline int register_count(void) const { return register_names.size(); }
+  inline int predicate_count(void) const { return predicate_names.size(); }
   inline bool assume_warp_synchronous(void) const { return warp_synchronous; }
   inline const char* get_name(void) const { return kernel_name.c_str(); }
+  inline PTXInstruction* get_instruction(int pc) const
+    { return ptx_instructions[pc]; }
+  inline Thread* get_thread(int tid) const
+    { return cta_states[current_cta].threads[tid]; }
+  void get_shared_declarations(std::vector<PTXSharedDecl*> &decls) const;
 protected:
   void emulate_threads(void);
   void construct_dependence_graph(void);
@@ -98,11 +154,13 @@ protected:
   int count_addresses(void);
   size_t count_race_tests(void);
 public:
+  Thread* create_thread(int tid);
   int emulate(Thread *thread);
   void emulate_warp(Thread **threads);
   void get_kernel_prefix(char *buffer, size_t count);
 public:
-  void add_line(const std::string &line, int line_num);
+  void add_line(const LineView &line);
+  void parse_lines(int start, int stop);
   void set_block_dim(const int *array);
   void add_block_id(const int *array);
   void set_grid_dim(const int *array);
@@ -110,19 +168,49 @@ public:
   void fill_block_id(int *array) const;
   void fill_grid_dim(int *array) const;
   void verify(void);
+public:
+  void initialize_count(unsigned count);
+  void wait_until_done(void);
+  void enqueue_task(WeftTask *task);
+  void spawn_task(WeftTask *task);
+  void complete_task(void);
+public:
+  void buffer_output(void);
+  void flush_output(void);
+public:
+  int get_register_slot(int64_t reg);
+  int get_destination_slot(int64_t reg);
+  int find_register_slot(int64_t reg) const;
+  inline int64_t get_register_name(int slot) const
+    { return register_names[slot]; }
+  int get_constant_slot(int64_t value);
+  void initialize_constants(Thread *thread) const;
+  void initialize_uniforms(Thread *thread) const;
+  int get_predicate_slot(int64_t pred);
+  inline int64_t get_predicate_name(int slot) const
+    { return predicate_names[slot]; }
 protected:
   void convert_to_instructions(const std::map<int,const char*> &source_files);
+  void compile_instructions(void);
+  void find_uniform_registers(void);
+  void evaluate_uniform_registers(void);
   static bool parse_file_location(const std::string &line,
                                   std::map<int,const char*> &source_files);
-  static bool parse_source_location(const std::string &line,
+  static bool parse_source_location(const std::vector<std::string> &tokens,
                                     int &source_file, int &source_line);
 protected:
   void start_instrumentation(ProgramStage stage);
   void stop_instrumentation(ProgramStage stage);
+  size_t count_trace_bytes(void) const;
 public:
   void report_instrumentation(size_t &accumulated_memory);
 public:
   Weft *const weft;
+  // Where results for this kernel are reported, these are temporary 
+  // files when kernels are verified in parallel so that their 
+  // output can be replayed in the order of the kernels in the file
+  FILE *out;
+  FILE *err;
 protected:
   std::string kernel_name;
   int max_num_threads;
@@ -135,14 +223,108 @@ protected:
   unsigned current_cta;
   std::vector<CTAState> cta_states;
 protected:
-  std::vector<std::pair<std::string,int> > lines;
+  // Views into the mapped file which is only valid while parsing
+  std::vector<LineView> lines;
+  std::vector<ParsedLine> parsed_lines;
   std::vector<PTXInstruction*> ptx_instructions;
+  std::vector<CompiledInstruction> compiled_instructions;
+protected:
+  // Dense slot indices for all the registers named in the program
+  std::map<int64_t/*register*/,int/*slot*/> register_slots;
+  std::vector<int64_t/*register*/> register_names;
+  // Immediates get read-only register slots after all the registers
+  std::map<int64_t/*value*/,int/*slot*/> constant_slots;
+  // Register definitions and uses recorded while assigning slots
+  int assigning_pc;
+  std::vector<std::pair<int/*slot*/,int/*pc*/> > register_definitions;
+  std::vector<std::pair<int/*slot*/,int/*pc*/> > register_uses;
+  std::map<std::string,int/*pc*/> shared_declarations;
+  // Instructions whose results are the same for every thread in a 
+  // CTA in the order to evaluate them, and their values for this CTA
+  std::vector<CompiledInstruction> uniform_instructions;
+  std::vector<std::pair<int/*slot*/,int64_t/*value*/> > uniform_values;
+  // Predicates get their own dense numbering for the predicate bitsets
+  std::map<int64_t/*predicate*/,int/*slot*/> predicate_slots;
+  std::vector<int64_t/*predicate*/> predicate_names;
 protected:
   // Instrumentation
   unsigned long long timing[TOTAL_STAGES];
   size_t memory_usage[TOTAL_STAGES];
+  size_t trace_usage[TOTAL_STAGES];
+protected:
+  // Tasks still outstanding for the current stage of this program
+  pthread_mutex_t count_lock;
+  pthread_cond_t count_cond;
+  int pending_count;
 };
 
+// Storage for the registers and predicates of one or more threads.
+// Warp-synchronous execution uses WARP_SIZE lanes so that each
+// register is stored as lane-contiguous values and each register
+// and predicate has one 32-bit word with a bit for every lane.
+class RegisterFile {
+public:
+  RegisterFile(int num_registers, int num_predicates, int lanes);
+  RegisterFile(const RegisterFile &rhs) : lanes(0) { assert(false); }
+  ~RegisterFile(void) { }
+public:
+  RegisterFile& operator=(const RegisterFile &rhs) 
+    { assert(false); return *this; }
+public:
+  const int lanes;
+  std::vector<int64_t/*value*/>     values;
+  std::vector<uint32_t/*lanes*/>    valid;
+  std::vector<uint32_t/*lanes*/>    predicates;
+  std::vector<uint32_t/*lanes*/>    defined;
+};
+
+// A bump-pointer allocator for the happens relationships
+// of a single thread. Memory is handed out from chunks
+// that grow geometrically and is only released in bulk when the 
+// arena is destroyed, so objects allocated here must have their
+// destructors invoked explicitly. Each thread is only ever emulated
+// and analyzed by one task at a time so there is no locking.
+class ThreadArena {
+public:
+  ThreadArena(void);
+  ThreadArena(const ThreadArena &rhs) { assert(false); }
+  ~ThreadArena(void);
+public:
+  ThreadArena& operator=(const ThreadArena &rhs) 
+    { assert(false); return *this; }
+public:
+  inline void* allocate(size_t size)
+  {
+    // Keep everything pointer aligned
+    size = (size + (sizeof(void*)-1)) & ~(sizeof(void*)-1);
+    if (size > remaining)
+      allocate_chunk(size);
+    void *result = next;
+    next += size;
+    remaining -= size;
+    allocated_bytes += size;
+    return result;
+  }
+  inline size_t get_allocated_bytes(void) const { return allocated_bytes; }
+  inline size_t get_reserved_bytes(void) const { return reserved_bytes; }
+protected:
+  void allocate_chunk(size_t size);
+protected:
+  std::vector<char*> chunks;
+  char *next;
+  size_t remaining;
+  size_t allocated_bytes;
+  size_t reserved_bytes;
+};
+
+inline void* operator new(size_t size, ThreadArena &arena)
+{
+  return arena.allocate(size);
+}
+
+// Only called if a constructor throws, the arena reclaims it later
+inline void operator delete(void *ptr, ThreadArena &arena) { }
+
 class Thread {
 public:
   struct GlobalDataInfo {
@@ -161,6 +343,7 @@ public:
   Thread& operator=(const Thread &rhs) { assert(false); return *this; }
 public:
   void initialize(void);
+  void initialize(RegisterFile &warp_registers, int lane);
   void emulate(void);
   void cleanup(void);
 public:
@@ -171,37 +354,103 @@ public:
   bool get_global_location(const char *name, int64_t &addr);
   bool get_global_value(int64_t addr, int64_t &value);
 public:
-  void set_value(int64_t reg, int64_t value);
-  bool get_value(int64_t reg, int64_t &value);
+  // Registers are named by the dense slot indices that were assigned
+  // by Program::convert_to_instructions. Values and valid/defined bits
+  // are indexed by (slot * lanes + lane) in the bound register file.
+  inline void set_value(int64_t reg, int64_t value)
+  {
+    const unsigned index = reg * register_lanes + register_lane;
+    register_values[index] = value;
+    register_valid[index >> 5] |= (1U << (index & 31));
+  }
+  inline bool get_value(int64_t reg, int64_t &value)
+  {
+    const unsigned index = reg * register_lanes + register_lane;
+    if (!(register_valid[index >> 5] & (1U << (index & 31))))
+    {
+      value = 0;
+      return report_undefined_register(reg);
+    }
+    value = register_values[index];
+    return true;
+  }
 public:
-  void set_pred(int64_t pred, bool value);
-  bool get_pred(int64_t pred, bool &value);
+  inline void set_pred(int64_t pred, bool value)
+  {
+    const unsigned index = pred * register_lanes + register_lane;
+    const uint32_t bit = (1U << (index & 31));
+    if (value)
+      predicate_values[index >> 5] |= bit;
+    else
+      predicate_values[index >> 5] &= ~bit;
+    predicate_defined[index >> 5] |= bit;
+  }
+  inline bool has_pred(int64_t pred) const
+  {
+    const unsigned index = pred * register_lanes + register_lane;
+    return ((predicate_defined[index >> 5] & (1U << (index & 31))) != 0);
+  }
+  inline bool get_pred(int64_t pred, bool &value)
+  {
+    if (!has_pred(pred))
+    {
+      value = false;
+      return report_undefined_predicate(pred);
+    }
+    const unsigned index = pred * register_lanes + register_lane;
+    value = ((predicate_values[index >> 5] & (1U << (index & 31))) != 0);
+    return true;
+  }
+  // Only valid for threads bound to a warp register file
+  inline void get_warp_pred(int64_t pred, uint32_t &values, 
+                            uint32_t &defined) const
+  {
+    assert(register_lanes == 32);
+    values = predicate_values[pred];
+    defined = predicate_defined[pred];
+  }
 public:
-  void add_instruction(WeftInstruction *instruction);
+  void add_shared_access(PTXInstruction *access, bool write, 
+                         int address, int log_width, int access_id = -1);
+  void add_barrier(PTXInstruction *barrier, bool sync, int name, int count);
   void update_max_barrier_name(int name);
   inline int get_max_barrier_name(void) const { return max_barrier_name; }
 public:
   void profile_instruction(PTXInstruction *instruction);
   int accumulate_instruction_counts(std::vector<int> &total_counts);
   void dump_weft_thread(void);
-public:
-  void update_shared_memory(WeftAccess *access);
 public:
   inline size_t get_program_size(void) const { return instructions.size(); }
-  inline WeftInstruction* get_instruction(int idx)
-    { return ((unsigned(idx) < instructions.size()) ? instructions[idx] : NULL); } 
+  inline const WeftInstruction* get_instruction(int idx) const
+    { return ((unsigned(idx) < instructions.size()) ? &instructions[idx] : NULL); } 
+  inline void set_barrier_generation(int idx, int generation)
+    { instructions[idx].set_generation(generation); }
+  inline Happens* get_happens(const WeftInstruction &access) const
+    { return interval_happens[access.get_interval()]; }
   inline int count_dynamic_instructions(void) const 
     { return dynamic_instructions; }
   inline int count_weft_statements(void) const
     { return instructions.size(); }
   inline void set_dynamic_instructions(int count) { dynamic_instructions = count; }
 public:
-  void initialize_happens(int total_threads, int max_num_barriers);
+  inline size_t count_trace_bytes(void) const 
+    { return (instructions.capacity() * sizeof(WeftInstruction) + 
+              arena.get_allocated_bytes()); }
+public:
+  void initialize_happens(BarrierDependenceGraph *graph);
   void update_happens_relationships(void);
+  void compute_barrier_signature(std::vector<int> &signature) const;
+  void share_happens(const Thread *representative);
+protected:
+  void initialize_happens_instances(void);
+  void compute_barriers_before(BarrierDependenceGraph *graph);
+  void compute_barriers_after(BarrierDependenceGraph *graph);
 protected:
-  void initialize_happens_instances(int total_threads);
-  void compute_barriers_before(int max_num_barriers);
-  void compute_barriers_after(int max_num_barriers);
+  void bind_registers(RegisterFile &registers, int lane);
+  void initialize_registers(void);
+  void initialize_special_register(int64_t reg, int64_t value);
+  bool report_undefined_register(int64_t reg);
+  bool report_undefined_predicate(int64_t pred);
 public:
   const unsigned thread_id;
   const int tid_x, tid_y, tid_z;
@@ -209,16 +458,31 @@ public:
   SharedMemory *const shared_memory;
 protected:
   std::map<std::string,int64_t/*addr*/>           shared_locations;
-  std::map<int64_t/*register*/,int64_t/*value*/>  register_store;
-  std::map<int64_t/*predicate*/,bool/*value*/>    predicate_store;
   std::vector<GlobalDataInfo>                     globals;
+protected:
+  // Either our own register file or a lane in a warp register file
+  RegisterFile                                    *local_registers;
+  int64_t                                         *register_values;
+  uint32_t                                        *register_valid;
+  uint32_t                                        *predicate_values;
+  uint32_t                                        *predicate_defined;
+  int                                             register_lanes;
+  int                                             register_lane;
 protected:
   int max_barrier_name;
   int dynamic_instructions;
-  std::vector<WeftInstruction*>                   instructions;
+  int total_barriers;
+  std::vector<WeftInstruction>                    instructions;
   std::vector<int>                                dynamic_counts;
 protected:
+  // The Happens objects we own and the one for each interval
+  // between barriers indexed by the number of barriers before it,
+  // intervals without accesses have no Happens object
   std::deque<Happens*>                            all_happens;
+  std::vector<Happens*>                           interval_happens;
+protected:
+  // Backing storage for all_happens
+  ThreadArena                                     arena;
 };
 
 class SharedStore {
@@ -20,183 +20,415 @@
 #include "program.h"
 #include "instruction.h"
 
-Happens::Happens(int total_threads)
-  : initialized(false)
+#include <algorithm>
+#include <functional>
+
+// Rough cost of the binary searches for one group and thread relative
+// to testing a single pair of segments directly
+#define SWEEP_SEARCH_COST 4
+
+Happens::Happens(void)
+  : happens_before(NULL), happens_after(NULL)
 {
-  happens_before.resize(total_threads, -1);
-  happens_after.resize(total_threads, -1);
 }
 
-void Happens::update_barriers_before(const std::vector<WeftBarrier*> &before)
+void Happens::update_barriers_before(
+                                  const std::vector<BarrierInstance*> &before)
 {
+  // Only keep the barriers that are actually set
   assert(latest_before.empty());
-  latest_before = before;
+  for (std::vector<BarrierInstance*>::const_iterator it = 
+        before.begin(); it != before.end(); it++)
+    if ((*it) != NULL)
+      latest_before.push_back(*it);
 }
 
-void Happens::update_barriers_after(const std::vector<WeftBarrier*> &after)
+void Happens::update_barriers_after(
+                                  const std::vector<BarrierInstance*> &after)
 {
   assert(earliest_after.empty());
-  earliest_after = after;
+  for (std::vector<BarrierInstance*>::const_iterator it = 
+        after.begin(); it != after.end(); it++)
+    if ((*it) != NULL)
+      earliest_after.push_back(*it);
 }
 
-void Happens::update_happens_relationships(void)
+// Most barriers are ordered with each other so one of them usually
+// subsumes all the others and we can use its positions directly, 
+// only if none of them does do we need the graph to merge them
+static const Frontier* summarize_barriers(
+                          const std::vector<BarrierInstance*> &barriers,
+                          bool latest)
 {
-  for (std::vector<WeftBarrier*>::const_iterator it = 
-        latest_before.begin(); it != latest_before.end(); it++)
+  const Frontier *candidate = NULL;
+  for (std::vector<BarrierInstance*>::const_iterator it = 
+        barriers.begin(); it != barriers.end(); it++)
   {
-    if ((*it) == NULL)
+    const Frontier &values = latest ? (*it)->get_latest_before() 
+                                    : (*it)->get_earliest_after();
+    if (values.empty())
       continue;
-    (*it)->get_instance()->update_latest_before(happens_after);
+    if ((candidate == NULL) || values.subsumes(*candidate, latest))
+      candidate = &values;
   }
-  for (std::vector<WeftBarrier*>::const_iterator it = 
-        earliest_after.begin(); it != earliest_after.end(); it++)
+  if (candidate == NULL)
+    return NULL;
+  for (std::vector<BarrierInstance*>::const_iterator it = 
+        barriers.begin(); it != barriers.end(); it++)
   {
-    if ((*it) == NULL)
+    const Frontier &values = latest ? (*it)->get_latest_before() 
+                                    : (*it)->get_earliest_after();
+    if (values.empty() || (&values == candidate))
       continue;
-    (*it)->get_instance()->update_earliest_after(happens_before);
+    if (!candidate->subsumes(values, latest))
+    {
+      BarrierDependenceGraph *graph = barriers.front()->graph;
+      return latest ? graph->merge_latest_before(barriers) 
+                    : graph->merge_earliest_after(barriers);
+    }
   }
+  return candidate;
 }
 
-bool Happens::has_happens(int thread, int line_number)
+void Happens::update_happens_relationships(void)
 {
-  if (happens_before[thread] <= line_number)
-    return true;
-  if (happens_after[thread] >= line_number)
-    return true;
-  return false;
+  happens_after = summarize_barriers(latest_before, true/*latest*/);
+  happens_before = summarize_barriers(earliest_after, false/*latest*/);
+  // We no longer need the barriers
+  std::vector<BarrierInstance*>().swap(latest_before);
+  std::vector<BarrierInstance*>().swap(earliest_after);
+}
+
+bool Happens::find_unordered(int thread, int &after, int &before) const
+{
+  // Accesses of the thread at positions at or after happens_before
+  // and at or before happens_after are ordered with us, which leaves
+  // the open interval (after,before) unordered unless there is no
+  // known position before which nothing is ordered
+  if (happens_before == NULL)
+    return false;
+  before = happens_before->get(thread);
+  if (before == -1)
+    return false;
+  after = (happens_after == NULL) ? -1 : happens_after->get(thread);
+  return true;
 }
 
 Address::Address(const int addr, SharedMemory *mem)
   : address(addr), memory(mem), total_races(0)
 {
-  PTHREAD_SAFE_CALL( pthread_mutex_init(&address_lock,NULL) );
 }
 
 Address::~Address(void)
 {
-  PTHREAD_SAFE_CALL( pthread_mutex_destroy(&address_lock) );
 }
 
-void Address::add_access(WeftAccess *access)
+void Address::add_access(int thread_id, int index)
 {
-  PTHREAD_SAFE_CALL( pthread_mutex_lock(&address_lock) );
-  accesses.push_back(access);
-  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&address_lock) );
+  // Only the worker bucketing the shard of this address adds accesses
+  accesses.push_back(std::pair<int,int>(thread_id, index));
+}
+
+// The accesses of one thread to an address in its sorted accesses
+struct ThreadAccesses {
+public:
+  ThreadAccesses(int t, unsigned s, unsigned ws)
+    : thread(t), start(s), stop(s), write_start(ws), write_stop(ws) { }
+public:
+  int thread;
+  unsigned start, stop;
+  unsigned write_start, write_stop;
+};
+
+// The accesses of one thread between two barriers to an address
+struct AccessSegment {
+public:
+  AccessSegment(int t, int p, Happens *h, unsigned s)
+    : thread(t), position(p), happens(h), 
+      start(s), stop(s), write(false) { }
+public:
+  int thread, position;
+  Happens *happens;
+  unsigned start, stop;
+  bool write;
+};
+
+// An access grouped with all the others using the same happens
+struct HappensAccess {
+public:
+  HappensAccess(Happens *h, const std::pair<int,int> &a, bool r)
+    : happens(h), access(a), read(r) { }
+public:
+  inline bool operator<(const HappensAccess &rhs) const
+  {
+    if (happens != rhs.happens)
+      return std::less<Happens*>()(happens, rhs.happens);
+    return (access < rhs.access);
+  }
+public:
+  Happens *happens;
+  std::pair<int,int> access;
+  bool read;
+};
+
+static inline bool is_warp_synchronous(const WeftInstruction *first_access,
+                                       const std::pair<int,int> &first,
+                                       const WeftInstruction *second_access,
+                                       const std::pair<int,int> &second)
+{
+  // Check to see if the threads are in the same warp
+  int local_wid = first.first/WARP_SIZE;
+  int other_wid = second.first/WARP_SIZE;
+  if (local_wid != other_wid)
+    return false;
+  // We should only be here if we assumed warp synchronous
+  // execution and therefore access IDs are non-negative.
+  assert(first_access->get_access_id() >= 0);
+  assert(second_access->get_access_id() >= 0);
+  // If they are in the same warp, check to see if they have
+  // the same access_id.  If they do, then we cannot use 
+  // warp-synchronous execution to avoid the race test.
+  // If they come from different access IDs then we know
+  // they can't have happened at the same time because
+  // warps execute in lock step.
+  return (first_access->get_access_id() != second_access->get_access_id());
 }
 
 void Address::perform_race_tests(void)
 {
-  if (memory->program->assume_warp_synchronous())
+  Program *program = memory->program;
+  const bool warp_synchronous = program->assume_warp_synchronous();
+  // Sort the accesses by thread and then by position in the trace, 
+  // the accesses of a thread which are unordered with an interval
+  // of another thread then form one contiguous range that we can 
+  // find with a binary search instead of testing every pair
+  std::sort(accesses.begin(), accesses.end());
+  std::vector<std::pair<int,int> > writes;
+  std::vector<ThreadAccesses> threads;
+  // Consecutive accesses of a thread with the same happens are in the
+  // same segment between two barriers so the happens ordering of any
+  // other access with them is the same for the entire segment
+  std::vector<AccessSegment> segments;
+  std::vector<bool> reads(accesses.size(), false);
+  for (unsigned idx = 0; idx < accesses.size(); idx++)
+  {
+    const std::pair<int,int> &access = accesses[idx];
+    if (threads.empty() || (threads.back().thread != access.first))
+      threads.push_back(ThreadAccesses(access.first, idx, writes.size()));
+    ThreadAccesses &current = threads.back();
+    current.stop = idx + 1;
+    Thread *thread = program->get_thread(access.first);
+    const WeftInstruction *instruction = thread->get_instruction(access.second);
+    const bool read = instruction->is_read();
+    Happens *happens = thread->get_happens(*instruction);
+    assert(happens != NULL);
+    if (segments.empty() || (segments.back().thread != access.first) ||
+        (segments.back().happens != happens))
+      segments.push_back(AccessSegment(access.first, access.second,
+                                       happens, idx));
+    AccessSegment &segment = segments.back();
+    segment.stop = idx + 1;
+    if (!read)
+    {
+      writes.push_back(access);
+      current.write_stop = writes.size();
+      segment.write = true;
+    }
+    reads[idx] = read;
+  }
+  // The sweep costs a search per group and thread, when there are
+  // few accesses in each segment it is cheaper to test segment pairs
+  std::vector<Happens*> distinct(segments.size());
+  for (unsigned idx = 0; idx < segments.size(); idx++)
+    distinct[idx] = segments[idx].happens;
+  std::sort(distinct.begin(), distinct.end());
+  const size_t total_groups = 
+    std::unique(distinct.begin(), distinct.end()) - distinct.begin();
+  const size_t segment_pairs = 
+    segments.size() * (segments.size() - 1) / 2;
+  if ((total_groups * threads.size() * SWEEP_SEARCH_COST) >= 
+      segment_pairs)
   {
-    for (unsigned idx1 = 0; idx1 < accesses.size(); idx1++)
+    // Segments are sorted by thread so skip past the other 
+    // segments of our own thread which can never race with us
+    unsigned next_thread = 0;
+    for (unsigned idx = 0; idx < segments.size(); idx++)
     {
-      WeftAccess *first = accesses[idx1];
-      if (first->is_read())
+      const AccessSegment &first = segments[idx];
+      if (next_thread <= idx)
       {
-        for (unsigned idx2 = idx1+1; idx2 < accesses.size(); idx2++)
-        {
-          WeftAccess *second = accesses[idx2]; 
-          // Check for both reads
-          if (second->is_read())
-            continue;
-          // Check for warp-synchronous
-          if (first->is_warp_synchronous(second))
-            continue;
-          if (!first->has_happens_relationship(second))
-            record_race(first, second);
-        }
+        next_thread = idx + 1;
+        while ((next_thread < segments.size()) && 
+               (segments[next_thread].thread == first.thread))
+          next_thread++;
       }
-      else
+      for (unsigned idx2 = next_thread; idx2 < segments.size(); idx2++)
       {
-        for (unsigned idx2 = idx1+1; idx2 < accesses.size(); idx2++)
+        const AccessSegment &second = segments[idx2];
+        // Check for both segments only reading
+        if (!first.write && !second.write)
+          continue;
+        // One test for the whole segment pair 
+        int after, before;
+        if (!first.happens->find_unordered(second.thread, after, before))
+          continue;
+        if ((second.position <= after) || (second.position >= before))
+          continue;
+        // Only now expand to the access pairs to report the races
+        for (unsigned one = first.start; one < first.stop; one++)
         {
-          WeftAccess *second = accesses[idx2];
-          // Check for warp-synchronous
-          if (first->is_warp_synchronous(second))
-            continue;
-          if (!first->has_happens_relationship(second))
-            record_race(first, second);
+          for (unsigned two = second.start; two < second.stop; two++)
+          {
+            // Check for both reads
+            if (reads[one] && reads[two])
+              continue;
+            // Check for warp-synchronous
+            if (warp_synchronous && 
+                is_warp_synchronous(
+                  program->get_thread(accesses[one].first)->
+                    get_instruction(accesses[one].second), accesses[one],
+                  program->get_thread(accesses[two].first)->
+                    get_instruction(accesses[two].second), accesses[two]))
+              continue;
+            record_race(accesses[one], accesses[two]);
+          }
         }
       }
     }
+    return;
   }
-  else
+  // Accesses in the same interval of threads with the same barrier 
+  // behavior share a happens and are all unordered with the same
+  // accesses of any other thread so we only search once for them
+  std::vector<HappensAccess> groups;
+  groups.reserve(accesses.size());
+  for (unsigned idx = 0; idx < segments.size(); idx++)
+  {
+    const AccessSegment &segment = segments[idx];
+    for (unsigned idx2 = segment.start; idx2 < segment.stop; idx2++)
+      groups.push_back(HappensAccess(segment.happens, 
+                                     accesses[idx2], reads[idx2]));
+  }
+  std::sort(groups.begin(), groups.end());
+  unsigned group_start = 0;
+  while (group_start < groups.size())
   {
-    // For every pair of addresses, check to see if we can 
-    // establish a happens before or a happens after relationship
-    for (unsigned idx1 = 0; idx1 < accesses.size(); idx1++)
+    Happens *happens = groups[group_start].happens;
+    unsigned group_stop = group_start + 1;
+    while ((group_stop < groups.size()) && 
+           (groups[group_stop].happens == happens))
+      group_stop++;
+    // Happens relationships are symmetric so we only test each access
+    // in the group against the threads after its own thread, the
+    // group is sorted by thread so those accesses are a prefix
+    unsigned prefix = group_start;
+    for (std::vector<ThreadAccesses>::const_iterator it = 
+          threads.begin(); it != threads.end(); it++)
     {
-      WeftAccess *first = accesses[idx1];
-      if (first->is_read())
+      const int second_thread = it->thread;
+      while ((prefix < group_stop) && 
+             (groups[prefix].access.first < second_thread))
+        prefix++;
+      if (prefix == group_start)
+        continue;
+      int after, before;
+      if (!happens->find_unordered(second_thread, after, before))
+        continue;
+      const std::pair<int,int> lower_bound(second_thread, after+1);
+      const std::pair<int,int> upper_bound(second_thread, before);
+      const unsigned lower = std::lower_bound(
+          accesses.begin() + it->start, 
+          accesses.begin() + it->stop, lower_bound) - accesses.begin();
+      const unsigned upper = std::lower_bound(
+          accesses.begin() + lower, 
+          accesses.begin() + it->stop, upper_bound) - accesses.begin();
+      if (lower == upper)
+        continue;
+      // Reads only race with the unordered writes
+      const unsigned write_lower = std::lower_bound(
+          writes.begin() + it->write_start,
+          writes.begin() + it->write_stop, lower_bound) - writes.begin();
+      const unsigned write_upper = std::lower_bound(
+          writes.begin() + write_lower,
+          writes.begin() + it->write_stop, upper_bound) - writes.begin();
+      for (unsigned idx = group_start; idx < prefix; idx++)
       {
-        for (unsigned idx2 = idx1+1; idx2 < accesses.size(); idx2++)
+        const HappensAccess &first = groups[idx];
+        const std::vector<std::pair<int,int> > &candidates = 
+          first.read ? writes : accesses;
+        const unsigned start = first.read ? write_lower : lower;
+        const unsigned stop = first.read ? write_upper : upper;
+        for (unsigned idx2 = start; idx2 < stop; idx2++)
         {
-          WeftAccess *second = accesses[idx2]; 
-          // Check for both reads
-          if (second->is_read())
+          const std::pair<int,int> &second = candidates[idx2];
+          // Check for warp-synchronous
+          if (warp_synchronous && 
+              is_warp_synchronous(
+                program->get_thread(first.access.first)->
+                  get_instruction(first.access.second), first.access,
+                program->get_thread(second.first)->
+                  get_instruction(second.second), second))
             continue;
-          if (!first->has_happens_relationship(second))
-            record_race(first, second);
-        }
-      }
-      else
-      {
-        for (unsigned idx2 = idx1+1; idx2 < accesses.size(); idx2++)
-        {
-          WeftAccess *second = accesses[idx2];
-          if (!first->has_happens_relationship(second))
-            record_race(first, second);
+          record_race(first.access, second);
         }
       }
     }
+    group_start = group_stop;
   }
 }
 
-void Address::record_race(WeftAccess *one, WeftAccess *two)
+void Address::record_race(const std::pair<int,int> &first, 
+                          const std::pair<int,int> &second)
 {
+  Program *program = memory->program;
+  Thread *one_thread = program->get_thread(first.first);
+  Thread *two_thread = program->get_thread(second.first);
+  PTXInstruction *one = program->get_instruction(
+      one_thread->get_instruction(first.second)->get_program_counter());
+  PTXInstruction *two = program->get_instruction(
+      two_thread->get_instruction(second.second)->get_program_counter());
   // Alternative race reporting
   //printf("Race between threads %d and %d on instructions "
   //       "%d and %d (PTX %d and %d)\n",
-  //       one->thread->thread_id, two->thread->thread_id,
-  //       one->thread_line_number, two->thread_line_number,
-  //       one->instruction->line_number, two->instruction->line_number);
+  //       one_thread->thread_id, two_thread->thread_id,
+  //       first.second, second.second,
+  //       one->line_number, two->line_number);
   total_races++;
   // Save the races based on the PTX instructions
-  int ptx_one = one->instruction->line_number;
-  int ptx_two = two->instruction->line_number;
+  int ptx_one = one->line_number;
+  int ptx_two = two->line_number;
   if (ptx_one <= ptx_two)
   {
-    std::pair<PTXInstruction*,PTXInstruction*> 
-                            key(one->instruction, two->instruction);
-    if (one->thread->thread_id <= two->thread->thread_id)
+    std::pair<PTXInstruction*,PTXInstruction*> key(one, two);
+    if (one_thread->thread_id <= two_thread->thread_id)
       ptx_races[key].insert(
-          std::pair<Thread*,Thread*>(one->thread, two->thread));
+          std::pair<Thread*,Thread*>(one_thread, two_thread));
     else
       ptx_races[key].insert(
-          std::pair<Thread*,Thread*>(two->thread, one->thread));
+          std::pair<Thread*,Thread*>(two_thread, one_thread));
   }
   else
   {
-    std::pair<PTXInstruction*,PTXInstruction*> 
-                            key(two->instruction, one->instruction);
-    if (one->thread->thread_id <= two->thread->thread_id)
+    std::pair<PTXInstruction*,PTXInstruction*> key(two, one);
+    if (one_thread->thread_id <= two_thread->thread_id)
       ptx_races[key].insert(
-          std::pair<Thread*,Thread*>(one->thread, two->thread));
+          std::pair<Thread*,Thread*>(one_thread, two_thread));
     else
       ptx_races[key].insert(
-          std::pair<Thread*,Thread*>(two->thread, one->thread));
+          std::pair<Thread*,Thread*>(two_thread, one_thread));
   }
 }
 
 int Address::report_races(std::map<
             std::pair<PTXInstruction*,PTXInstruction*>,size_t> &all_races)
 {
+  FILE *err = memory->program->err;
   if (total_races > 0)
   { 
     if (memory->weft->print_detail())
     {
-      fprintf(stderr,"WEFT INFO: Found %d races on address %d!\n",
-                      total_races, address);
+      fprintf(err,"WEFT INFO: Found %d races on address %d!\n",
+                   total_races, address);
       for (std::map<std::pair<PTXInstruction*,PTXInstruction*>,std::set<
                     std::pair<Thread*,Thread*> > >::const_iterator it = 
             ptx_races.begin(); it != ptx_races.end(); it++)
@@ -207,26 +439,26 @@ int Address::report_races(std::map<
         {
           assert(two->source_file != NULL);
           if (one == two)
-            fprintf(stderr,"\tThere are %ld races between different threads "
-                  "on line %d of %s with address %d\n", it->second.size(),
-                  one->source_line_number, one->source_file, address);
+            fprintf(err,"\tThere are %ld races between different threads "
+               "on line %d of %s with address %d\n", it->second.size(),
+               one->source_line_number, one->source_file, address);
           else
-            fprintf(stderr,"\tThere are %ld races between line %d of %s "
-                    " and line %d of %s with address %d\n", it->second.size(),
-                    one->source_line_number, one->source_file,
-                    two->source_line_number, two->source_file, address);
+            fprintf(err,"\tThere are %ld races between line %d of %s "
+                 " and line %d of %s with address %d\n", it->second.size(),
+                 one->source_line_number, one->source_file,
+                 two->source_line_number, two->source_file, address);
         }
         else
         {
           assert(two->source_file == NULL);
           if (one == two)
-            fprintf(stderr,"\tThere are %ld races between different threads "
-                   "on PTX line %d with address %d\n", it->second.size(),
-                   one->line_number, address);
+            fprintf(err,"\tThere are %ld races between different threads "
+                "on PTX line %d with address %d\n", it->second.size(),
+                one->line_number, address);
           else
-            fprintf(stderr,"\tThere are %ld races between PTX line %d "
-                    " and PTX line %d with address %d\n", it->second.size(),
-                    one->line_number, two->line_number, address);
+            fprintf(err,"\tThere are %ld races between PTX line %d "
+                 " and PTX line %d with address %d\n", it->second.size(),
+                 one->line_number, two->line_number, address);
         }
         const std::set<std::pair<Thread*,Thread*> > &threads = it->second;
         for (std::set<std::pair<Thread*,Thread*> >::const_iterator 
@@ -235,9 +467,9 @@ int Address::report_races(std::map<
         {
           Thread *first = thread_it->first;
           Thread *second = thread_it->second;
-          fprintf(stderr,"\t\t... between thread (%d,%d,%d) and (%d,%d,%d)\n",
-                  first->tid_x, first->tid_y, first->tid_z,
-                  second->tid_x, second->tid_y, second->tid_z);
+          fprintf(err,"\t\t... between thread (%d,%d,%d) and (%d,%d,%d)\n",
+               first->tid_x, first->tid_y, first->tid_z,
+               second->tid_x, second->tid_y, second->tid_z);
         }
       }
     }
@@ -268,38 +500,176 @@ size_t Address::count_race_tests(void)
 }
 
 SharedMemory::SharedMemory(Weft *w, Program *p)
-  : weft(w), program(p)
+  : weft(w), program(p), granularity(w->race_check_granularity()),
+    total_chunks(0), slots_per_shard(0)
 {
-  PTHREAD_SAFE_CALL( pthread_mutex_init(&memory_lock,NULL) );
+  // Lay out the declared shared allocations in one table with a
+  // slot for each granule of bytes that we check for races together
+  std::vector<PTXSharedDecl*> decls;
+  program->get_shared_declarations(decls);
+  int total_slots = 0;
+  for (std::vector<PTXSharedDecl*>::const_iterator it = 
+        decls.begin(); it != decls.end(); it++)
+  {
+    if ((*it)->get_size() <= 0)
+      continue;
+    const unsigned index = (*it)->get_address() / SDDRINC;
+    if (index >= region_lookup.size())
+      region_lookup.resize(index+1, -1);
+    region_lookup[index] = regions.size();
+    SharedRegion region;
+    region.base = (*it)->get_address();
+    region.size = (*it)->get_size();
+    region.slot = total_slots;
+    regions.push_back(region);
+    total_slots += (region.size + granularity - 1) / granularity;
+  }
+  address_table.resize(total_slots, NULL);
 }
 
 SharedMemory::~SharedMemory(void)
 {
-  for (std::map<int,Address*>::iterator it = addresses.begin();
+  for (std::vector<Address*>::iterator it = addresses.begin();
         it != addresses.end(); it++)
   {
-    delete it->second;
+    delete (*it);
   }
   addresses.clear();
-  PTHREAD_SAFE_CALL( pthread_mutex_destroy(&memory_lock) );
 }
 
-void SharedMemory::update_accesses(WeftAccess *access)
+int SharedMemory::find_slot(int address) const
 {
-  Address *address;
-  // These lookups need to be thread safe
-  PTHREAD_SAFE_CALL( pthread_mutex_lock(&memory_lock) );
-  std::map<int,Address*>::const_iterator finder = 
-    addresses.find(access->address);
-  if (finder == addresses.end())
+  if (address < 0)
+    return -1;
+  const unsigned index = address / SDDRINC;
+  if ((index >= region_lookup.size()) || (region_lookup[index] < 0))
+    return -1;
+  const SharedRegion &region = regions[region_lookup[index]];
+  const int offset = address - region.base;
+  return (offset < region.size) ? (region.slot + offset/granularity) : -1;
+}
+
+static inline bool address_less(const Address *one, const Address *two)
+{
+  return (one->address < two->address);
+}
+
+void SharedMemory::collect_accesses(Thread **threads, int total_threads)
+{
+  // The trace of each thread already names all of its accesses so
+  // emulation doesn't touch the shared memory at all, instead we 
+  // log the accesses of chunks of threads by shard in one parallel
+  // pass and then bucket each shard by address in another
+  assert(addresses.empty());
+  total_chunks = (total_threads < ACCESS_SHARDS) ? 
+                  total_threads : ACCESS_SHARDS;
+  if (total_chunks == 0)
+    return;
+  // Each shard owns a contiguous range of slots in the table 
+  // as well as the overflow addresses that hash to it
+  slots_per_shard = (address_table.size() + ACCESS_SHARDS - 1) / ACCESS_SHARDS;
+  access_logs.resize(total_chunks * 2 * ACCESS_SHARDS);
+  overflow_addresses.resize(ACCESS_SHARDS);
+  LogAccesses log_body(this, threads, total_threads, total_chunks);
+  weft->parallel_for(program, &log_body, 0, total_chunks);
+  BucketAccesses bucket_body(this);
+  weft->parallel_for(program, &bucket_body, 0, ACCESS_SHARDS);
+  // The table is already in address order so we only 
+  // need to sort the overflow addresses and merge them in
+  std::vector<Address*> table_addresses, overflow;
+  for (std::vector<Address*>::const_iterator it = 
+        address_table.begin(); it != address_table.end(); it++)
+    if ((*it) != NULL)
+      table_addresses.push_back(*it);
+  for (int shard = 0; shard < ACCESS_SHARDS; shard++)
+    overflow.insert(overflow.end(), overflow_addresses[shard].begin(),
+                    overflow_addresses[shard].end());
+  std::sort(overflow.begin(), overflow.end(), address_less);
+  addresses.resize(table_addresses.size() + overflow.size());
+  std::merge(table_addresses.begin(), table_addresses.end(),
+             overflow.begin(), overflow.end(), 
+             addresses.begin(), address_less);
+  access_logs.clear();
+  overflow_addresses.clear();
+}
+
+void SharedMemory::log_accesses(int chunk, Thread **threads, 
+                                int start, int stop)
+{
+  std::vector<SharedAccess> *logs = &access_logs[chunk * 2 * ACCESS_SHARDS];
+  for (int tid = start; tid < stop; tid++)
+  {
+    Thread *thread = threads[tid];
+    const int total_instructions = thread->get_program_size();
+    for (int idx = 0; idx < total_instructions; idx++)
+    {
+      const WeftInstruction *instruction = thread->get_instruction(idx);
+      if (!instruction->is_access())
+        continue;
+      // Log the access with every granule of bytes that it touches
+      const int first = instruction->get_address() & ~(granularity-1);
+      const int last = (instruction->get_address() + 
+          instruction->get_width() - 1) & ~(granularity-1);
+      for (int address = first; address <= last; address += granularity)
+      {
+        const int slot = find_slot(address);
+        const int shard = (slot >= 0) ? (slot / slots_per_shard) :
+          (ACCESS_SHARDS + int(unsigned(address) % ACCESS_SHARDS));
+        logs[shard].push_back(SharedAccess(address, thread->thread_id, idx));
+      }
+    }
+  }
+}
+
+void SharedMemory::bucket_accesses(int shard)
+{
+  // The logs of the chunks are in thread order and the logs for each
+  // thread are in trace order so the accesses of every slot end up 
+  // sorted without needing to sort them
+  for (int chunk = 0; chunk < total_chunks; chunk++)
   {
-    address = new Address(access->address, this);
-    addresses[access->address] = address;
+    std::vector<SharedAccess> &log = 
+      access_logs[chunk * 2 * ACCESS_SHARDS + shard];
+    for (std::vector<SharedAccess>::const_iterator it = 
+          log.begin(); it != log.end(); it++)
+    {
+      Address *&address = address_table[find_slot(it->address)];
+      if (address == NULL)
+        address = new Address(it->address, this);
+      address->add_access(it->thread, it->index);
+    }
+    // Free the log as soon as we are done with it
+    std::vector<SharedAccess>().swap(log);
+  }
+  // Overflow addresses are gathered and sorted instead
+  std::vector<SharedAccess> accesses;
+  size_t total_accesses = 0;
+  for (int chunk = 0; chunk < total_chunks; chunk++)
+    total_accesses += 
+      access_logs[(chunk * 2 + 1) * ACCESS_SHARDS + shard].size();
+  if (total_accesses == 0)
+    return;
+  accesses.reserve(total_accesses);
+  for (int chunk = 0; chunk < total_chunks; chunk++)
+  {
+    std::vector<SharedAccess> &log = 
+      access_logs[(chunk * 2 + 1) * ACCESS_SHARDS + shard];
+    accesses.insert(accesses.end(), log.begin(), log.end());
+    std::vector<SharedAccess>().swap(log);
+  }
+  std::sort(accesses.begin(), accesses.end());
+  std::vector<Address*> &result = overflow_addresses[shard];
+  Address *current = NULL;
+  for (std::vector<SharedAccess>::const_iterator it = 
+        accesses.begin(); it != accesses.end(); it++)
+  {
+    if ((current == NULL) || (current->address != it->address))
+    {
+      current = new Address(it->address, this);
+      result.push_back(current);
+    }
+    current->add_access(it->thread, it->index);
   }
-  else
-    address = finder->second;
-  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&memory_lock) );
-  address->add_access(access);
 }
 
 int SharedMemory::count_addresses(void) const
@@ -307,23 +677,24 @@ int SharedMemory::count_addresses(void) const
   return addresses.size();
 }
 
-void SharedMemory::enqueue_race_checks(void)
+void SharedMemory::perform_race_checks(void)
 {
-  for (std::map<int,Address*>::const_iterator it = addresses.begin();
-        it != addresses.end(); it++)
-  {
-    weft->enqueue_task(new RaceCheckTask(it->second));
-  }
+  if (addresses.empty())
+    return;
+  CheckRaces check_races(&addresses.front());
+  weft->parallel_for(program, &check_races, 0, addresses.size());
 }
 
 void SharedMemory::check_for_races(void)
 {
+  FILE *out = program->out;
+  FILE *err = program->err;
   int total_races = 0;
   std::map<std::pair<PTXInstruction*,PTXInstruction*>,size_t> all_races;
-  for (std::map<int,Address*>::const_iterator it = 
+  for (std::vector<Address*>::const_iterator it = 
         addresses.begin(); it != addresses.end(); it++)
   {
-    total_races += it->second->report_races(all_races);
+    total_races += (*it)->report_races(all_races);
   }
   if (total_races > 0)
   {
@@ -338,61 +709,89 @@ void SharedMemory::check_for_races(void)
         {
           assert(two->source_file != NULL);
           if (one == two)
-            fprintf(stderr,"\tFound races between %ld pairs of "
-                           "threads on line %d of %s\n", it->second,
-                           one->source_line_number, one->source_file);
+            fprintf(err,"\tFound races between %ld pairs of "
+                        "threads on line %d of %s\n", it->second,
+                        one->source_line_number, one->source_file);
           else
-            fprintf(stderr,"\tFound races between %ld pairs of threads "
-                           "on line %d of %s and line %d of %s\n", it->second,
-                           one->source_line_number, one->source_file,
-                           two->source_line_number, two->source_file);
+            fprintf(err,"\tFound races between %ld pairs of threads "
+                        "on line %d of %s and line %d of %s\n", it->second,
+                        one->source_line_number, one->source_file,
+                        two->source_line_number, two->source_file);
         }
         else
         {
           assert(two->source_file == NULL);
           if (one == two)
-            fprintf(stderr,"\tFound races between %ld pairs of "
-                           "threads on PTX line number %d\n",
-                           it->second, one->line_number);
+            fprintf(err,"\tFound races between %ld pairs of "
+                        "threads on PTX line number %d\n",
+                        it->second, one->line_number);
           else
-            fprintf(stderr,"\tFound races between %ld pairs of threads on "
-                           "PTX line %d and PTX line %d\n", it->second,
-                           one->line_number, two->line_number);
+            fprintf(err,"\tFound races between %ld pairs of threads on "
+                        "PTX line %d and PTX line %d\n", it->second,
+                        one->line_number, two->line_number);
         }
       }
-      fprintf(stderr,"WEFT INFO: Found %d total races in kernel %s!\n"
-                     "           Run with '-d' flag to see detailed per-thread "
-                     "and per-address races\n", total_races, program->get_name());
+      fprintf(err,"WEFT INFO: Found %d total races in kernel %s!\n"
+                  "           Run with '-d' flag to see detailed per-thread "
+                  "and per-address races\n", total_races, program->get_name());
     }
     else
-      fprintf(stderr,"WEFT INFO: Found %d total races in kernel %s!\n", 
-                     total_races, program->get_name());
-    fprintf(stderr,"WEFT INFO: RACES DETECTED IN KERNEL %s!\n", 
-                     program->get_name());
+      fprintf(err,"WEFT INFO: Found %d total races in kernel %s!\n", 
+                  total_races, program->get_name());
+    fprintf(err,"WEFT INFO: RACES DETECTED IN KERNEL %s!\n", 
+                  program->get_name());
   }
   else
-    fprintf(stdout,"WEFT INFO: No races detected in kernel %s!\n", 
-                    program->get_name());
+    fprintf(out,"WEFT INFO: No races detected in kernel %s!\n", 
+                 program->get_name());
 }
 
 size_t SharedMemory::count_race_tests(void)
 {
   size_t result = 0;
-  for (std::map<int,Address*>::const_iterator it = addresses.begin();
+  for (std::vector<Address*>::const_iterator it = addresses.begin();
         it != addresses.end(); it++)
   {
-    result += it->second->count_race_tests();
+    result += (*it)->count_race_tests();
   }
   return result;
 }
 
-RaceCheckTask::RaceCheckTask(Address *addr)
-  : address(addr)
+LogAccesses::LogAccesses(SharedMemory *m, Thread **t, 
+                         int threads, int chunks)
+  : ParallelBody(), memory(m), threads(t), 
+    total_threads(threads), total_chunks(chunks)
+{
+}
+
+void LogAccesses::execute(int start, int stop)
+{
+  // Each chunk is a fixed range of threads so every log has one writer
+  for (int chunk = start; chunk < stop; chunk++)
+    memory->log_accesses(chunk, threads, 
+        (long(chunk) * total_threads) / total_chunks,
+        (long(chunk+1) * total_threads) / total_chunks);
+}
+
+BucketAccesses::BucketAccesses(SharedMemory *m)
+  : ParallelBody(), memory(m)
+{
+}
+
+void BucketAccesses::execute(int start, int stop)
+{
+  for (int shard = start; shard < stop; shard++)
+    memory->bucket_accesses(shard);
+}
+
+CheckRaces::CheckRaces(Address **addrs)
+  : ParallelBody(), addresses(addrs)
 {
 }
 
-void RaceCheckTask::execute(void)
+void CheckRaces::execute(int start, int stop)
 {
-  address->perform_race_tests();
+  for (int idx = start; idx < stop; idx++)
+    addresses[idx]->perform_race_tests();
 }
 
@@ -27,30 +27,54 @@
 class Weft;
 class Thread;
 class Program;
-class WeftAccess;
-class WeftBarrier;
+class Frontier;
 class SharedMemory;
+class BarrierInstance;
+class WeftInstruction;
 class PTXInstruction;
 
 class Happens {
 public:
-  Happens(int total_threads);
+  Happens(void);
   Happens(const Happens &rhs) { assert(false); }
   ~Happens(void) { }
 public:
   Happens& operator=(const Happens &rhs) { assert(false); return *this; }
 public:
-  void update_barriers_before(const std::vector<WeftBarrier*> &before);
-  void update_barriers_after(const std::vector<WeftBarrier*> &after);
+  void update_barriers_before(const std::vector<BarrierInstance*> &before);
+  void update_barriers_after(const std::vector<BarrierInstance*> &after);
 public:
   void update_happens_relationships(void);
-  bool has_happens(int thread, int line_number);
+  bool find_unordered(int thread, int &after, int &before) const;
 protected:
-  bool initialized;
-  std::vector<WeftBarrier*> latest_before;
-  std::vector<WeftBarrier*> earliest_after;
-  std::vector<int> happens_before;
-  std::vector<int> happens_after;
+  // The barriers that are set until we compute our relationships
+  std::vector<BarrierInstance*> latest_before;
+  std::vector<BarrierInstance*> earliest_after;
+  // Positions for each thread which belong either to the barrier 
+  // instance that subsumes all the others or to the graph which 
+  // shares them between all happens with the same barriers
+  const Frontier *happens_before;
+  const Frontier *happens_after;
+};
+
+// A shared memory access logged by a thread during emulation
+struct SharedAccess {
+public:
+  SharedAccess(int addr, int t, int idx)
+    : address(addr), thread(t), index(idx) { }
+public:
+  inline bool operator<(const SharedAccess &rhs) const
+  {
+    if (address != rhs.address)
+      return (address < rhs.address);
+    if (thread != rhs.thread)
+      return (thread < rhs.thread);
+    return (index < rhs.index);
+  }
+public:
+  int address;
+  int thread;
+  int index;
 };
 
 class Address {
@@ -61,19 +85,20 @@ public:
 public:
   Address& operator=(const Address &rhs) { assert(false); return *this; }
 public:
-  void add_access(WeftAccess *access);
+  void add_access(int thread_id, int index);
   void perform_race_tests(void);
   int report_races(std::map<
       std::pair<PTXInstruction*,PTXInstruction*>,size_t> &all_races);
   size_t count_race_tests(void);
 protected:
-  void record_race(WeftAccess *one, WeftAccess *two);
+  void record_race(const std::pair<int,int> &one, 
+                   const std::pair<int,int> &two);
 public:
   const int address;
   SharedMemory *const memory;
 protected:
-  pthread_mutex_t address_lock;
-  std::vector<WeftAccess*> accesses;
+  // Accesses named by their thread and index in the thread's trace
+  std::vector<std::pair<int/*thread*/,int/*index*/> > accesses;
 protected:
   int total_races;
   std::map<std::pair<PTXInstruction*,PTXInstruction*>,
@@ -83,23 +108,48 @@ protected:
 class SharedMemory {
 public:
   SharedMemory(Weft *weft, Program *program);
-  SharedMemory(const SharedMemory &rhs) : weft(NULL), program(NULL) { assert(false); }
+  SharedMemory(const SharedMemory &rhs) : weft(NULL), program(NULL),
+    granularity(0) { assert(false); }
   ~SharedMemory(void);
 public:
   SharedMemory& operator=(const SharedMemory &rhs) 
     { assert(false); return *this; }
 public:
-  void update_accesses(WeftAccess *access);
+  void collect_accesses(Thread **threads, int total_threads);
+  void log_accesses(int chunk, Thread **threads, int start, int stop);
+  void bucket_accesses(int shard);
   int count_addresses(void) const;
-  void enqueue_race_checks(void);
+  void perform_race_checks(void);
   void check_for_races(void);
   size_t count_race_tests(void);
+protected:
+  int find_slot(int address) const;
 public:
   Weft *const weft;
   Program *const program;
+  // Bytes of each address that we check for races
+  const int granularity;
+protected:
+  // A declared shared allocation and its first slot in the table
+  struct SharedRegion {
+  public:
+    int base, size, slot;
+  };
+  std::vector<SharedRegion> regions;
+  // The region for each multiple of SDDRINC if there is one
+  std::vector<int> region_lookup;
+  // Addresses in the declared allocations are indexed directly in the
+  // table, any others overflow into sorted lists for each shard
+  std::vector<Address*> address_table;
+  std::vector<std::vector<Address*> > overflow_addresses;
+  // All the addresses with accesses in address order
+  std::vector<Address*> addresses;
 protected:
-  pthread_mutex_t memory_lock;
-  std::map<int/*address*/,Address*> addresses;
+  // Logs of accesses for each chunk of threads and shard of addresses
+  // which are only ever written by one worker at a time so that no
+  // locks are needed to bucket the accesses by their address
+  int total_chunks, slots_per_shard;
+  std::vector<std::vector<SharedAccess> > access_logs;
 };
 
 #endif // __RACE_H__
@@ -30,6 +30,10 @@
 #include <sys/time.h>
 #include <sys/resource.h>
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 #ifdef __MACH__
 #include "mach/clock.h"
 #include "mach/mach.h"
@@ -39,7 +43,10 @@ Weft::Weft(int argc, char **argv)
   : file_name(NULL), thread_pool_size(1), 
     verbose(false), detailed(false), instrument(false), 
     warnings(false), warp_synchronous(false), print_files(false),
-    worker_threads(NULL), pending_count(0)
+    parallel_kernels(false), warp_frontiers(false), 
+    affinity(NO_AFFINITY), race_granularity(4),
+    worker_threads(NULL), workers(NULL), flushed_kernels(0), 
+    next_node_queue(0), shared_tasks(0), queued_tasks(0), sleeping_workers(0)
 {
   for (int i = 0; i < 3; i++)
     block_dim[i] = 1;
@@ -65,23 +72,93 @@ Weft::~Weft(void)
 void Weft::verify(void)
 {
   Program::parse_ptx_file(file_name, this, programs);
-  for (std::vector<Program*>::const_iterator it = programs.begin();
-        it != programs.end(); it++)
+  if (parallel_kernels && (programs.size() > 1))
+    verify_kernels_in_parallel();
+  else
   {
-    Program *program = *it;
-    program->verify(); 
+    for (std::vector<Program*>::const_iterator it = programs.begin();
+          it != programs.end(); it++)
+    {
+      Program *program = *it;
+      program->verify(); 
+    }
   }
   if (instrument)
     report_instrumentation();
 }
 
-void Weft::report_error(int error_code, const char *message)
+void Weft::verify_kernels_in_parallel(void)
+{
+  // Each kernel gets its own thread to drive its stages, all the
+  // tasks for the stages are executed by the shared thread pool
+  finished_kernels.resize(programs.size(), false);
+  pthread_t *kernel_threads = 
+    (pthread_t*)malloc(programs.size() * sizeof(pthread_t));
+  for (unsigned idx = 0; idx < programs.size(); idx++)
+  {
+    programs[idx]->buffer_output();
+    PTHREAD_SAFE_CALL( pthread_create(kernel_threads+idx, NULL,
+                                      Weft::kernel_loop, programs[idx]) );
+  }
+  for (unsigned idx = 0; idx < programs.size(); idx++)
+  {
+    PTHREAD_SAFE_CALL( pthread_join(kernel_threads[idx], NULL) );
+  }
+  free(kernel_threads);
+  assert(flushed_kernels == programs.size());
+}
+
+void Weft::complete_kernel(Program *program)
+{
+  PTHREAD_SAFE_CALL( pthread_mutex_lock(&kernel_lock) );
+  for (unsigned idx = 0; idx < programs.size(); idx++)
+  {
+    if (programs[idx] != program)
+      continue;
+    finished_kernels[idx] = true;
+    break;
+  }
+  // Replay the output of any kernels that are now done in file order
+  while ((flushed_kernels < programs.size()) && 
+         finished_kernels[flushed_kernels])
+    programs[flushed_kernels++]->flush_output();
+  PTHREAD_SAFE_CALL( pthread_cond_broadcast(&kernel_cond) );
+  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&kernel_lock) );
+}
+
+void Weft::flush_kernels(Program *program)
+{
+  // Wait for all the kernels before this one to finish so that
+  // their output is reported before the output of this kernel
+  PTHREAD_SAFE_CALL( pthread_mutex_lock(&kernel_lock) );
+  while (flushed_kernels < programs.size())
+  {
+    Program *next = programs[flushed_kernels];
+    if ((next != program) && !finished_kernels[flushed_kernels])
+    {
+      PTHREAD_SAFE_CALL( pthread_cond_wait(&kernel_cond, &kernel_lock) );
+      continue;
+    }
+    next->flush_output();
+    flushed_kernels++;
+    if (next == program)
+      break;
+  }
+  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&kernel_lock) );
+}
+
+void Weft::report_error(int error_code, const char *message, Program *program)
 {
   assert(error_code != WEFT_SUCCESS);
+  if ((program != NULL) && !finished_kernels.empty())
+    flush_kernels(program);
   fprintf(stderr,"WEFT ERROR %d: %s!\n", error_code, message);
   fprintf(stderr,"WEFT WILL NOW EXIT...\n");
   fflush(stderr);
-  stop_threadpool();
+  // Other kernels may still be using the thread pool when verifying 
+  // kernels in parallel, in which case exiting will clean it up
+  if (finished_kernels.empty())
+    stop_threadpool();
   exit(error_code);
 }
 
@@ -89,12 +166,31 @@ void Weft::parse_inputs(int argc, char **argv)
 {
   for (int i = 1; i < argc; i++)
   {
+    if (!strcmp(argv[i],"-a"))
+    {
+      std::string policy(argv[++i]);
+      if (policy == "core")
+        affinity = CORE_AFFINITY;
+      else if (policy == "node")
+        affinity = NODE_AFFINITY;
+      else if (policy == "none")
+        affinity = NO_AFFINITY;
+      else
+        fprintf(stderr,"WEFT WARNING: Ignoring invalid input for worker "
+                       "affinity \"-a %s\"!\n", policy.c_str());
+      continue;
+    }
     if (!strcmp(argv[i],"-b"))
     {
       std::string block(argv[++i]);
       parse_triple(block, block_id, "-b", "CTA ID");
       continue;
     }
+    if (!strcmp(argv[i],"-c"))
+    {
+      warp_frontiers = true;
+      continue;
+    }
     if (!strcmp(argv[i],"-d"))
     {
       detailed = true;
@@ -116,6 +212,11 @@ void Weft::parse_inputs(int argc, char **argv)
       instrument = true;
       continue;
     }
+    if (!strcmp(argv[i],"-k"))
+    {
+      parallel_kernels = true;
+      continue;
+    }
     if (!strcmp(argv[i],"-n"))
     {
       std::string threads(argv[++i]);
@@ -127,6 +228,17 @@ void Weft::parse_inputs(int argc, char **argv)
       print_files = true;
       continue;
     }
+    if (!strcmp(argv[i],"-r"))
+    {
+      int granularity = atoi(argv[++i]);
+      if ((granularity >= 1) && (granularity <= MAX_RACE_GRANULARITY) &&
+          ((granularity & (granularity-1)) == 0))
+        race_granularity = granularity;
+      else
+        fprintf(stderr,"WEFT WARNING: Ignoring invalid input for race "
+                       "granularity \"-r %s\"!\n", argv[i]);
+      continue;
+    }
     if (!strcmp(argv[i],"-s"))
     {
       warp_synchronous = true;
@@ -171,6 +283,13 @@ void Weft::parse_inputs(int argc, char **argv)
     fprintf(stdout,"  Grid dimensions: (%d,%d,%d)\n",
                       grid_dim[0], grid_dim[1], grid_dim[2]);
     fprintf(stdout,"  Thread Pool Size: %d\n", thread_pool_size);
+    fprintf(stdout,"  Parallel Kernels: %s\n", (parallel_kernels ? "yes" : "no"));
+    fprintf(stdout,"  Worker Affinity: %s\n", 
+            (affinity == CORE_AFFINITY) ? "core" :
+            (affinity == NODE_AFFINITY) ? "node" : "none");
+    fprintf(stdout,"  Race Granularity: %d bytes\n", race_granularity);
+    fprintf(stdout,"  Warp Happens Frontiers: %s\n", 
+                      (warp_frontiers ? "yes" : "no"));
     fprintf(stdout,"  Verbose: %s\n", (verbose ? "yes" : "no"));
     fprintf(stdout,"  Detailed: %s\n", (detailed ? "yes" : "no"));
     fprintf(stdout,"  Instrument: %s\n", (instrument ? "yes" : "no"));
@@ -234,8 +353,12 @@ void Weft::report_usage(int error, const char *error_str)
   fprintf(stderr,"WEFT ERROR %d: %s!\nWEFT WILL NOW EXIT...\n", 
           error, error_str);
   fprintf(stderr,"Usage: Weft [args]\n");
+  fprintf(stderr,"  -a: pin worker threads to processors (default none)\n");
+  fprintf(stderr,"      'core' pins each worker to one core, 'node' to one memory node\n");
   fprintf(stderr,"  -b: specify the CTA id to simulate (default 0x0x0)\n");
   fprintf(stderr,"      can be an integer or an x-separated tuple e.g. 0x0x1 or 1x2\n");
+  fprintf(stderr,"  -c: track happens relationships for each warp instead of each thread\n");
+  fprintf(stderr,"      only warps whose lanes diverge on barriers are tracked per thread\n");
   fprintf(stderr,"  -d: print detailed information for error reporting\n");
   fprintf(stderr,"      this includes line numbers for blocked threads under deadlock and\n");
   fprintf(stderr,"      and per-thread and per-address information for races\n");
@@ -244,9 +367,13 @@ void Weft::report_usage(int error, const char *error_str)
   fprintf(stderr,"      can be an integer or an x-separated tuple e.g. 32x32x2 or 32x1\n");
   fprintf(stderr,"      Weft will still only simulate a single CTA specified by '-b'\n");
   fprintf(stderr,"  -i: instrument execution\n");
+  fprintf(stderr,"  -k: verify all the kernels in the file in parallel\n");
+  fprintf(stderr,"      output for each kernel is still reported in file order\n");
   fprintf(stderr,"  -n: number of threads per CTA\n");
   fprintf(stderr,"      can be an integer or an x-separated tuple e.g. 64x2 or 32x8x1\n");
   fprintf(stderr,"  -p: print individual Weft thread files (one file per thread!)\n");
+  fprintf(stderr,"  -r: bytes of shared memory to check for races together (default 4)\n");
+  fprintf(stderr,"      must be a power of two no larger than %d\n", MAX_RACE_GRANULARITY);
   fprintf(stderr,"  -s: assume warp-synchronous execution\n");
   fprintf(stderr,"  -t: thread pool size\n");
   fprintf(stderr,"  -v: print verbose output\n");
@@ -296,17 +423,41 @@ void Weft::report_instrumentation(void)
 void Weft::start_threadpool(void)
 {
   assert(thread_pool_size > 0);
-  PTHREAD_SAFE_CALL( pthread_mutex_init(&count_lock, NULL) );
-  PTHREAD_SAFE_CALL( pthread_cond_init(&count_cond, NULL) );
+  PTHREAD_SAFE_CALL( pthread_mutex_init(&kernel_lock, NULL) );
+  PTHREAD_SAFE_CALL( pthread_cond_init(&kernel_cond, NULL) );
   PTHREAD_SAFE_CALL( pthread_mutex_init(&queue_lock, NULL) );
   PTHREAD_SAFE_CALL( pthread_cond_init(&queue_cond, NULL) );
+  PTHREAD_SAFE_CALL( pthread_key_create(&worker_key, NULL) );
+  discover_topology();
+  const int total_nodes = node_cpus.size();
+  node_queues.resize(total_nodes);
+  if (verbose && (affinity != NO_AFFINITY))
+    fprintf(stdout,"WEFT INFO: Pinning %d workers to %s across %d memory "
+                   "nodes\n", thread_pool_size, 
+                   (affinity == CORE_AFFINITY) ? "cores" : "nodes", total_nodes);
   assert(worker_threads == NULL);
   worker_threads = (pthread_t*)malloc(thread_pool_size * sizeof(pthread_t));
+  workers = new WeftWorker[thread_pool_size];
   threadpool_finished = false;
   for (int i = 0; i < thread_pool_size; i++)
+  {
+    workers[i].weft = this;
+    workers[i].index = i;
+    // Deal workers out to the nodes in turn so that 
+    // every node gets its share of the bandwidth
+    workers[i].node = i % total_nodes;
+    if (affinity == CORE_AFFINITY)
+    {
+      const std::vector<int> &cpus = node_cpus[workers[i].node];
+      workers[i].cpu = cpus[(i / total_nodes) % cpus.size()];
+    }
+  }
+  // Workers look at each other when stealing so only start
+  // them once all of them have been set up
+  for (int i = 0; i < thread_pool_size; i++)
   {
     PTHREAD_SAFE_CALL( pthread_create(worker_threads+i, NULL, 
-                                      Weft::worker_loop, this) );
+                                      Weft::worker_loop, workers+i) );
   }
 }
 
@@ -323,46 +474,256 @@ void Weft::stop_threadpool(void)
   }
   free(worker_threads);
   worker_threads = NULL;
-  PTHREAD_SAFE_CALL( pthread_mutex_destroy(&count_lock) );
-  PTHREAD_SAFE_CALL( pthread_cond_destroy(&count_cond) );
+  delete [] workers;
+  workers = NULL;
+  PTHREAD_SAFE_CALL( pthread_key_delete(worker_key) );
+  PTHREAD_SAFE_CALL( pthread_mutex_destroy(&kernel_lock) );
+  PTHREAD_SAFE_CALL( pthread_cond_destroy(&kernel_cond) );
   PTHREAD_SAFE_CALL( pthread_mutex_destroy(&queue_lock) );
   PTHREAD_SAFE_CALL( pthread_cond_destroy(&queue_cond) );
 }
 
-void Weft::initialize_count(unsigned count)
+// Parse a processor or node list like "0-3,8,10-11"
+static void parse_id_list(const char *list, std::vector<int> &ids)
 {
-  PTHREAD_SAFE_CALL( pthread_mutex_lock(&count_lock) ); 
-  assert(pending_count == 0);
-  pending_count = count;
-  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&count_lock) );
+  while (*list != '\0')
+  {
+    char *end;
+    const long first = strtol(list, &end, 10);
+    if (end == list)
+      break;
+    long last = first;
+    if (*end == '-')
+    {
+      list = end + 1;
+      last = strtol(list, &end, 10);
+    }
+    for (long id = first; id <= last; id++)
+      ids.push_back(id);
+    list = end;
+    if (*list == ',')
+      list++;
+  }
+}
+
+#ifdef __linux__
+static bool read_id_list(const char *path, std::vector<int> &ids)
+{
+  FILE *file = fopen(path, "r");
+  if (file == NULL)
+    return false;
+  char buffer[4096];
+  const bool success = (fgets(buffer, sizeof(buffer), file) != NULL);
+  fclose(file);
+  if (success)
+    parse_id_list(buffer, ids);
+  return success;
 }
+#endif
 
-void Weft::wait_until_done(void)
+void Weft::discover_topology(void)
 {
-  PTHREAD_SAFE_CALL( pthread_mutex_lock(&count_lock) );
-  if (pending_count > 0)
+  node_cpus.clear();
+  if (affinity != NO_AFFINITY)
   {
-    PTHREAD_SAFE_CALL( pthread_cond_wait(&count_cond, &count_lock) );
+#ifdef __linux__
+    // Only the processors we are allowed to run on count
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+      std::vector<int> nodes;
+      read_id_list("/sys/devices/system/node/online", nodes);
+      for (unsigned idx = 0; idx < nodes.size(); idx++)
+      {
+        char path[128];
+        snprintf(path, 127, "/sys/devices/system/node/node%d/cpulist", 
+                 nodes[idx]);
+        std::vector<int> cpus, usable;
+        read_id_list(path, cpus);
+        for (unsigned i = 0; i < cpus.size(); i++)
+        {
+          if ((cpus[i] < CPU_SETSIZE) && CPU_ISSET(cpus[i], &allowed))
+            usable.push_back(cpus[i]);
+        }
+        if (!usable.empty())
+          node_cpus.push_back(usable);
+      }
+      // Without any NUMA information everything is one node
+      if (node_cpus.empty())
+      {
+        node_cpus.resize(1);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+          if (CPU_ISSET(cpu, &allowed))
+            node_cpus[0].push_back(cpu);
+        }
+      }
+    }
+    else
+    {
+      fprintf(stderr,"WEFT WARNING: Unable to find the processors for "
+                     "worker threads, workers will not be pinned\n");
+      affinity = NO_AFFINITY;
+    }
+#else
+    fprintf(stderr,"WEFT WARNING: Pinning worker threads is not supported "
+                   "on this platform, workers will not be pinned\n");
+    affinity = NO_AFFINITY;
+#endif
+  }
+  if (node_cpus.empty())
+    node_cpus.resize(1);
+  // Only use as many nodes as we have workers to put on them
+  if (int(node_cpus.size()) > thread_pool_size)
+    node_cpus.resize(thread_pool_size);
+}
+
+void Weft::pin_worker(WeftWorker *worker)
+{
+  if (affinity == NO_AFFINITY)
+    return;
+#ifdef __linux__
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  if (affinity == CORE_AFFINITY)
+    CPU_SET(worker->cpu, &cpus);
+  else
+  {
+    const std::vector<int> &node = node_cpus[worker->node];
+    for (unsigned idx = 0; idx < node.size(); idx++)
+      CPU_SET(node[idx], &cpus);
   }
-  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&count_lock) );
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  if (ret != 0)
+    fprintf(stderr,"WEFT WARNING: Unable to pin worker %d (%s)\n",
+                   worker->index, strerror(ret));
+#endif
 }
 
 void Weft::enqueue_task(WeftTask *task)
 {
-  PTHREAD_SAFE_CALL( pthread_mutex_lock(&queue_lock) );
-  queue.push_back(task); 
-  PTHREAD_SAFE_CALL( pthread_cond_signal(&queue_cond) );
-  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&queue_lock) );
+  // Workers push onto their own deque, everyone else
+  // has to go through the shared queue
+  WeftWorker *worker = (WeftWorker*)pthread_getspecific(worker_key);
+  if (worker != NULL)
+    worker->deque.push(task);
+  else
+  {
+    PTHREAD_SAFE_CALL( pthread_mutex_lock(&queue_lock) );
+    // Tasks without a preferred node are spread around
+    const unsigned node = (task->node >= 0) ? unsigned(task->node) : 
+                                              next_node_queue++;
+    node_queues[node % node_queues.size()].push_back(task);
+    __sync_add_and_fetch(&shared_tasks, 1);
+    PTHREAD_SAFE_CALL( pthread_mutex_unlock(&queue_lock) );
+  }
+  // The full barrier here pairs with the one in dequeue_task so
+  // either we see the sleeping worker or it sees this task
+  __sync_add_and_fetch(&queued_tasks, 1);
+  if (__atomic_load_n(&sleeping_workers, __ATOMIC_SEQ_CST) > 0)
+  {
+    PTHREAD_SAFE_CALL( pthread_mutex_lock(&queue_lock) );
+    PTHREAD_SAFE_CALL( pthread_cond_signal(&queue_cond) );
+    PTHREAD_SAFE_CALL( pthread_mutex_unlock(&queue_lock) );
+  }
 }
 
-WeftTask* Weft::dequeue_task(void)
+void Weft::parallel_for(Program *program, ParallelBody *body,
+                        int start, int stop, int grain)
 {
-  WeftTask *result = NULL;
-  bool done = false;
-  while (!done)
+  if (start >= stop)
+    return;
+  // Bound the number of ranges so that tiny bodies are still cheap
+  const int max_ranges = RANGES_PER_WORKER * thread_pool_size;
+  const int min_grain = (stop - start + max_ranges - 1) / max_ranges;
+  if (grain < min_grain)
+    grain = min_grain;
+  // Not worth involving the thread pool for a single range
+  if ((stop - start) <= grain)
   {
+    body->execute(start, stop);
+    return;
+  }
+  // Give each memory node a contiguous slice of the range so that
+  // loops over the same indices in different stages touch the same
+  // data from the same node, work only moves when it is stolen
+  const long long total = stop - start;
+  long long slices = node_queues.size();
+  if (slices > total)
+    slices = total;
+  program->initialize_count(slices);
+  for (long long node = 0; node < slices; node++)
+  {
+    const int slice_start = start + int((total * node) / slices);
+    const int slice_stop = start + int((total * (node + 1)) / slices);
+    RangeTask *task = new RangeTask(body, slice_start, slice_stop, grain);
+    task->node = node;
+    program->enqueue_task(task);
+  }
+  program->wait_until_done();
+}
+
+WeftTask* Weft::find_task(WeftWorker *worker)
+{
+  // Our own deque first since those tasks are the most recent
+  WeftTask *result = worker->deque.pop();
+  if (result != NULL)
+    return result;
+  // Then look at our own node before going to other nodes
+  // so that tasks run close to the memory they touched before
+  for (int pass = 0; pass < 2; pass++)
+  {
+    const bool local = (pass == 0);
+    if (__atomic_load_n(&shared_tasks, __ATOMIC_RELAXED) > 0)
+    {
+      PTHREAD_SAFE_CALL( pthread_mutex_lock(&queue_lock) );
+      for (unsigned idx = 0; idx < node_queues.size(); idx++)
+      {
+        if ((int(idx) == worker->node) != local)
+          continue;
+        std::deque<WeftTask*> &queue = node_queues[idx];
+        if (queue.empty())
+          continue;
+        result = queue.front();
+        queue.pop_front();
+        __sync_sub_and_fetch(&shared_tasks, 1);
+        break;
+      }
+      PTHREAD_SAFE_CALL( pthread_mutex_unlock(&queue_lock) );
+      if (result != NULL)
+        return result;
+    }
+    // Try stealing from the other workers
+    for (int i = 1; i < thread_pool_size; i++)
+    {
+      WeftWorker &victim = workers[(worker->index + i) % thread_pool_size];
+      if ((victim.node == worker->node) != local)
+        continue;
+      result = victim.deque.steal();
+      if (result != NULL)
+        return result;
+    }
+  }
+  return NULL;
+}
+
+WeftTask* Weft::dequeue_task(WeftWorker *worker)
+{
+  while (true)
+  {
+    WeftTask *result = find_task(worker);
+    if (result != NULL)
+    {
+      __sync_sub_and_fetch(&queued_tasks, 1);
+      return result;
+    }
+    // Nothing to do, go to sleep unless something was queued
+    // since we last looked or the thread pool is shutting down
+    bool done = false;
     PTHREAD_SAFE_CALL( pthread_mutex_lock(&queue_lock) );
-    if (queue.empty()) 
+    __sync_add_and_fetch(&sleeping_workers, 1);
+    if (__atomic_load_n(&queued_tasks, __ATOMIC_SEQ_CST) <= 0)
     {
       if (!threadpool_finished)
       {
@@ -371,36 +732,34 @@ WeftTask* Weft::dequeue_task(void)
       else
         done = true;
     }
-    else
-    {
-      result = queue.front();
-      queue.pop_front();
-      done = true;
-    }
+    __sync_sub_and_fetch(&sleeping_workers, 1);
     PTHREAD_SAFE_CALL( pthread_mutex_unlock(&queue_lock) );
+    if (done)
+      return NULL;
   }
-  return result;
 }
 
 void Weft::complete_task(WeftTask *task)
 {
-  PTHREAD_SAFE_CALL( pthread_mutex_lock(&count_lock) );
-  assert(pending_count > 0);
-  pending_count--;
-  if (pending_count == 0)
-    PTHREAD_SAFE_CALL( pthread_cond_signal(&count_cond) );
-  PTHREAD_SAFE_CALL( pthread_mutex_unlock(&count_lock) );
+  Program *owner = task->owner;
+  assert(owner != NULL);
   // Clean up the task
   delete task;
+  owner->complete_task();
 }
 
 /*static*/
 void* Weft::worker_loop(void *arg)
 {
-  Weft *weft = (Weft*)arg;
+  WeftWorker *worker = (WeftWorker*)arg;
+  Weft *weft = worker->weft;
+  // Pin before doing anything so everything the worker 
+  // touches first is allocated on its own memory node
+  weft->pin_worker(worker);
+  PTHREAD_SAFE_CALL( pthread_setspecific(weft->worker_key, worker) );
   while (true)
   {
-    WeftTask *task = weft->dequeue_task();
+    WeftTask *task = weft->dequeue_task(worker);
     // If we ever get a NULL task then we are done
     if (task == NULL)
       break;
@@ -410,6 +769,15 @@ void* Weft::worker_loop(void *arg)
   return NULL;
 }
 
+/*static*/
+void* Weft::kernel_loop(void *arg)
+{
+  Program *program = (Program*)arg;
+  program->verify();
+  program->weft->complete_kernel(program);
+  return NULL;
+}
+
 /*static*/
 unsigned long long Weft::get_current_time_in_micros(void)
 {
@@ -436,6 +804,114 @@ size_t Weft::get_memory_usage(void)
   return usage.ru_maxrss;
 }
 
+RangeTask::RangeTask(ParallelBody *b, int s, int e, int g)
+  : WeftTask(), body(b), start(s), stop(e), grain(g)
+{
+}
+
+void RangeTask::execute(void)
+{
+  // Keep splitting off the upper half onto our deque, idle workers
+  // steal from the top so they get the biggest remaining ranges
+  int local_stop = stop;
+  while ((local_stop - start) > grain)
+  {
+    const int middle = start + (local_stop - start) / 2;
+    owner->spawn_task(new RangeTask(body, middle, local_stop, grain));
+    local_stop = middle;
+  }
+  body->execute(start, local_stop);
+}
+
+WorkDeque::TaskBuffer::TaskBuffer(long size)
+  : mask(size-1), tasks(new WeftTask*[size])
+{
+  // Sizes must be powers of two for the mask
+  assert((size & (size-1)) == 0);
+}
+
+WorkDeque::TaskBuffer::~TaskBuffer(void)
+{
+  delete [] tasks;
+}
+
+WorkDeque::WorkDeque(void)
+  : top(0), bottom(0), buffer(new TaskBuffer(256))
+{
+}
+
+WorkDeque::~WorkDeque(void)
+{
+  delete buffer;
+  for (std::vector<TaskBuffer*>::const_iterator it = 
+        retired.begin(); it != retired.end(); it++)
+  {
+    delete (*it);
+  }
+  retired.clear();
+}
+
+void WorkDeque::push(WeftTask *task)
+{
+  const long b = __atomic_load_n(&bottom, __ATOMIC_RELAXED);
+  const long t = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+  TaskBuffer *current = __atomic_load_n(&buffer, __ATOMIC_RELAXED);
+  if ((b - t) > current->mask)
+    current = grow(current, t, b);
+  current->put(b, task);
+  // Make sure the task is visible before the new bottom
+  __atomic_store_n(&bottom, b + 1, __ATOMIC_RELEASE);
+}
+
+WeftTask* WorkDeque::pop(void)
+{
+  const long b = __atomic_load_n(&bottom, __ATOMIC_RELAXED) - 1;
+  TaskBuffer *current = __atomic_load_n(&buffer, __ATOMIC_RELAXED);
+  // Claim the bottom before looking at what thieves have taken
+  __atomic_store_n(&bottom, b, __ATOMIC_SEQ_CST);
+  const long t = __atomic_load_n(&top, __ATOMIC_SEQ_CST);
+  if (t > b)
+  {
+    // Empty
+    __atomic_store_n(&bottom, t, __ATOMIC_RELAXED);
+    return NULL;
+  }
+  WeftTask *result = current->get(b);
+  if (t == b)
+  {
+    // Last task, race any thieves for it
+    if (!__sync_bool_compare_and_swap(&top, t, t + 1))
+      result = NULL;
+    __atomic_store_n(&bottom, t + 1, __ATOMIC_RELAXED);
+  }
+  return result;
+}
+
+WeftTask* WorkDeque::steal(void)
+{
+  const long t = __atomic_load_n(&top, __ATOMIC_SEQ_CST);
+  const long b = __atomic_load_n(&bottom, __ATOMIC_SEQ_CST);
+  if (t >= b)
+    return NULL;
+  TaskBuffer *current = __atomic_load_n(&buffer, __ATOMIC_ACQUIRE);
+  WeftTask *result = current->get(t);
+  // Lose to the owner or another thief and we'll look elsewhere
+  if (!__sync_bool_compare_and_swap(&top, t, t + 1))
+    return NULL;
+  return result;
+}
+
+WorkDeque::TaskBuffer* WorkDeque::grow(TaskBuffer *current, 
+                                       long t, long b)
+{
+  TaskBuffer *next = new TaskBuffer(2 * (current->mask + 1));
+  for (long idx = t; idx < b; idx++)
+    next->put(idx, current->get(idx));
+  retired.push_back(current);
+  __atomic_store_n(&buffer, next, __ATOMIC_RELEASE);
+  return next;
+}
+
 int main(int argc, char **argv)
 {
   Weft weft(argc, argv);
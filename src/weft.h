@@ -34,6 +34,20 @@
   }
 
 #define WARP_SIZE   32
+// Fewest lines of PTX worth handing to a worker thread
+#define MIN_PARSE_CHUNK   1024
+// Ranges of a parallel for are split into this many pieces
+// per worker thread at most so idle workers can steal some
+#define RANGES_PER_WORKER 8
+// Largest power of two bytes that may be race checked together,
+// it has to divide the stride between shared allocations
+#define MAX_RACE_GRANULARITY 256
+// Fewest threads worth handing to a worker when advancing them
+// between barriers while constructing the barrier graph
+#define MIN_ADVANCE_CHUNK 64
+// Shared memory accesses are bucketed by address into this many
+// shards after emulation, a prime spreads aligned addresses evenly
+#define ACCESS_SHARDS     61
 
 enum {
   WEFT_SUCCESS,
@@ -49,6 +63,13 @@ enum {
   WEFT_ERROR_INVALID_PTX_VERSION,
 };
 
+// How worker threads are pinned to the processors of the machine
+enum WorkerAffinity {
+  NO_AFFINITY,
+  CORE_AFFINITY,
+  NODE_AFFINITY,
+};
+
 class Weft;
 class Thread;
 class Program;
@@ -59,32 +80,78 @@ class BarrierDependenceGraph;
 
 class WeftTask {
 public:
+  WeftTask(void) : owner(NULL), node(-1) { }
   virtual ~WeftTask(void) { }
   virtual void execute(void) = 0;
+public:
+  // The program whose stage is waiting for this task to complete
+  Program *owner;
+  // The memory node whose workers should run this task if any
+  int node;
+};
+
+// The body of a parallel for loop, each invocation 
+// handles a contiguous range of indices [start,stop)
+class ParallelBody {
+public:
+  virtual ~ParallelBody(void) { }
+  virtual void execute(int start, int stop) = 0;
+};
+
+// A range of a parallel for loop which splits off halves for 
+// other workers to steal until it is down to the grain size
+class RangeTask : public WeftTask {
+public:
+  RangeTask(ParallelBody *body, int start, int stop, int grain);
+  RangeTask(const RangeTask &rhs) : body(NULL), start(0), stop(0), grain(0)
+    { assert(false); }
+  virtual ~RangeTask(void) { }
+public:
+  RangeTask& operator=(const RangeTask &rhs) { assert(false); return *this; }
+public:
+  virtual void execute(void);
+public:
+  ParallelBody *const body;
+  const int start;
+  const int stop;
+  const int grain;
+};
+
+class ParseLines : public ParallelBody {
+public:
+  ParseLines(Program *program);
+  ParseLines(const ParseLines &rhs) : program(NULL) { assert(false); }
+  virtual ~ParseLines(void) { }
+public:
+  ParseLines& operator=(const ParseLines &rhs) { assert(false); return *this; }
+public:
+  virtual void execute(int start, int stop);
+public:
+  Program *const program;
 };
 
-class EmulateThread : public WeftTask {
+class EmulateThread : public ParallelBody {
 public:
-  EmulateThread(Thread *thread);
-  EmulateThread(const EmulateThread &rhs) : thread(NULL) { assert(false); }
+  EmulateThread(Program *program);
+  EmulateThread(const EmulateThread &rhs) : program(NULL) { assert(false); }
   virtual ~EmulateThread(void) { }
 public:
   EmulateThread& operator=(const EmulateThread &rhs) { assert(false); return *this; }
 public:
-  virtual void execute(void);
+  virtual void execute(int start, int stop);
 public:
-  Thread *const thread;
+  Program *const program;
 };
 
-class EmulateWarp : public WeftTask {
+class EmulateWarp : public ParallelBody {
 public:
-  EmulateWarp(Program *p, Thread **start);
+  EmulateWarp(Program *p, Thread **threads);
   EmulateWarp(const EmulateWarp &rhs) : program(NULL), threads(NULL) { assert(false); }
   virtual ~EmulateWarp(void) { }
 public:
   EmulateWarp& operator=(const EmulateWarp &rhs) { assert(false); return *this; }
 public:
-  virtual void execute(void);
+  virtual void execute(int start, int stop);
 public:
   Program *const program;
   Thread **const threads;
@@ -106,21 +173,42 @@ public:
   const int generation;
 };
 
-class InitializationTask : public WeftTask {
+class AdvanceThreads : public ParallelBody {
 public:
-  InitializationTask(Thread *thread, int total, int max_num_barriers);
-  InitializationTask(const InitializationTask &rhs) 
-    : thread(NULL), total_threads(0), max_num_barriers(0) { assert(false); }
-  virtual ~InitializationTask(void) { }
+  AdvanceThreads(Thread *const *threads, const int *runnable,
+                 const int *program_counters, int *stop_lines,
+                 std::vector<int> *arrive_lines);
+  AdvanceThreads(const AdvanceThreads &rhs) : threads(NULL), runnable(NULL),
+    program_counters(NULL), stop_lines(NULL), arrive_lines(NULL) 
+    { assert(false); }
+  virtual ~AdvanceThreads(void) { }
 public:
-  InitializationTask& operator=(const InitializationTask &rhs)
+  AdvanceThreads& operator=(const AdvanceThreads &rhs)
     { assert(false); return *this; }
 public:
-  virtual void execute(void);
+  virtual void execute(int start, int stop);
 public:
-  Thread *const thread;
-  const int total_threads;
-  const int max_num_barriers;
+  Thread *const *const threads;
+  const int *const runnable;
+  const int *const program_counters;
+  int *const stop_lines;
+  std::vector<int> *const arrive_lines;
+};
+
+class InitializeHappens : public ParallelBody {
+public:
+  InitializeHappens(Thread **threads, BarrierDependenceGraph *graph);
+  InitializeHappens(const InitializeHappens &rhs) 
+    : threads(NULL), graph(NULL) { assert(false); }
+  virtual ~InitializeHappens(void) { }
+public:
+  InitializeHappens& operator=(const InitializeHappens &rhs)
+    { assert(false); return *this; }
+public:
+  virtual void execute(int start, int stop);
+public:
+  Thread **const threads;
+  BarrierDependenceGraph *const graph;
 };
 
 class ReachabilityTask : public WeftTask {
@@ -157,46 +245,134 @@ public:
   const bool forward;
 };
 
-class UpdateThreadTask : public WeftTask {
+class UpdateHappens : public ParallelBody {
 public:
-  UpdateThreadTask(Thread *thread);
-  UpdateThreadTask(const UpdateThreadTask &rhs) : thread(NULL) { assert(false); }
-  virtual ~UpdateThreadTask(void) { }
+  UpdateHappens(Thread **threads);
+  UpdateHappens(const UpdateHappens &rhs) : threads(NULL) { assert(false); }
+  virtual ~UpdateHappens(void) { }
 public:
-  UpdateThreadTask& operator=(const UpdateThreadTask &rhs) 
+  UpdateHappens& operator=(const UpdateHappens &rhs) 
     { assert(false); return *this; }  
 public:
-  virtual void execute(void);
+  virtual void execute(int start, int stop);
 public:
-  Thread *const thread;
+  Thread **const threads;
 };
 
-class RaceCheckTask : public WeftTask {
+class LogAccesses : public ParallelBody {
 public:
-  RaceCheckTask(Address *address);
-  RaceCheckTask(const RaceCheckTask &rhs) : address(NULL) { assert(false); }
-  virtual ~RaceCheckTask(void) { }
+  LogAccesses(SharedMemory *memory, Thread **threads, 
+              int total_threads, int total_chunks);
+  LogAccesses(const LogAccesses &rhs) : memory(NULL), threads(NULL),
+    total_threads(0), total_chunks(0) { assert(false); }
+  virtual ~LogAccesses(void) { }
 public:
-  RaceCheckTask& operator=(const RaceCheckTask &rhs)
+  LogAccesses& operator=(const LogAccesses &rhs)
     { assert(false); return *this; }
 public:
-  virtual void execute(void);
+  virtual void execute(int start, int stop);
 public:
-  Address *const address;
+  SharedMemory *const memory;
+  Thread **const threads;
+  const int total_threads, total_chunks;
 };
 
-class DumpThreadTask : public WeftTask {
+class BucketAccesses : public ParallelBody {
 public:
-  DumpThreadTask(Thread *thread);
-  DumpThreadTask(const DumpThreadTask &rhs) : thread(NULL) { assert(false); }
-  virtual ~DumpThreadTask(void) { }
+  BucketAccesses(SharedMemory *memory);
+  BucketAccesses(const BucketAccesses &rhs) : memory(NULL) { assert(false); }
+  virtual ~BucketAccesses(void) { }
 public:
-  DumpThreadTask& operator=(const DumpThreadTask &rhs)
+  BucketAccesses& operator=(const BucketAccesses &rhs)
     { assert(false); return *this; }
 public:
-  virtual void execute(void);
+  virtual void execute(int start, int stop);
+public:
+  SharedMemory *const memory;
+};
+
+class CheckRaces : public ParallelBody {
+public:
+  CheckRaces(Address **addresses);
+  CheckRaces(const CheckRaces &rhs) : addresses(NULL) { assert(false); }
+  virtual ~CheckRaces(void) { }
+public:
+  CheckRaces& operator=(const CheckRaces &rhs)
+    { assert(false); return *this; }
 public:
-  Thread *const thread;
+  virtual void execute(int start, int stop);
+public:
+  Address **const addresses;
+};
+
+class DumpThread : public ParallelBody {
+public:
+  DumpThread(Thread **threads);
+  DumpThread(const DumpThread &rhs) : threads(NULL) { assert(false); }
+  virtual ~DumpThread(void) { }
+public:
+  DumpThread& operator=(const DumpThread &rhs)
+    { assert(false); return *this; }
+public:
+  virtual void execute(int start, int stop);
+public:
+  Thread **const threads;
+};
+
+// A Chase-Lev work-stealing deque of tasks. Only the worker that
+// owns the deque pushes and pops at the bottom, any other worker
+// may steal from the top. Buffers that are outgrown are kept until
+// the deque is destroyed since thieves may still be reading them.
+class WorkDeque {
+private:
+  struct TaskBuffer {
+  public:
+    TaskBuffer(long size);
+    TaskBuffer(const TaskBuffer &rhs) : mask(0), tasks(NULL) { assert(false); }
+    ~TaskBuffer(void);
+  public:
+    TaskBuffer& operator=(const TaskBuffer &rhs) 
+      { assert(false); return *this; }
+  public:
+    // Slots are read by thieves racing with the owner
+    inline WeftTask* get(long index) const 
+      { return __atomic_load_n(tasks + (index & mask), __ATOMIC_RELAXED); }
+    inline void put(long index, WeftTask *task) 
+      { __atomic_store_n(tasks + (index & mask), task, __ATOMIC_RELAXED); }
+  public:
+    const long mask;
+    WeftTask **const tasks;
+  };
+public:
+  WorkDeque(void);
+  WorkDeque(const WorkDeque &rhs) { assert(false); }
+  ~WorkDeque(void);
+public:
+  WorkDeque& operator=(const WorkDeque &rhs) { assert(false); return *this; }
+public:
+  void push(WeftTask *task);
+  WeftTask* pop(void);
+  WeftTask* steal(void);
+protected:
+  TaskBuffer* grow(TaskBuffer *current, long top, long bottom);
+protected:
+  long top;
+  long bottom;
+  TaskBuffer *buffer;
+  std::vector<TaskBuffer*> retired;
+};
+
+// The state for each thread in the thread pool
+struct WeftWorker {
+public:
+  WeftWorker(void) : weft(NULL), index(-1), node(0), cpu(-1) { }
+public:
+  Weft *weft;
+  int index;
+  // The memory node of the worker and the core it is pinned to if any
+  int node;
+  int cpu;
+  WorkDeque deque;
 };
 
 class Weft {
@@ -205,18 +381,24 @@ public:
   ~Weft(void);
 public:
   void verify(void);
-  void report_error(int error_code, const char *message);
+  void report_error(int error_code, const char *message, 
+                    Program *program = NULL);
   inline bool report_warnings(void) const { return warnings; }
   inline bool print_verbose(void) const { return verbose; }
   inline bool print_detail(void) const { return detailed; }
   inline bool perform_instrumentation(void) const { return instrument; }
   inline bool emit_program_files(void) const { return print_files; }
+  inline int race_check_granularity(void) const { return race_granularity; }
+  inline bool track_warp_frontiers(void) const { return warp_frontiers; }
 protected:
   void parse_inputs(int argc, char **argv);
   bool parse_triple(const std::string &input, int *array,
                     const char *flag, const char *error_str);
   void report_usage(int error, const char *error_str);
   Program* parse_ptx(void);
+  void verify_kernels_in_parallel(void);
+  void complete_kernel(Program *program);
+  void flush_kernels(Program *program);
 public:
   bool initialize_program(Program *program) const;
   void start_parsing_instrumentation(void);
@@ -226,15 +408,19 @@ protected:
 protected:
   void start_threadpool(void);
   void stop_threadpool(void);
-public:
-  void initialize_count(unsigned count);
-  void wait_until_done(void);
 public:
   void enqueue_task(WeftTask *task);
-  WeftTask* dequeue_task(void);
+  void parallel_for(Program *program, ParallelBody *body, 
+                    int start, int stop, int grain = 1);
+  WeftTask* dequeue_task(WeftWorker *worker);
   void complete_task(WeftTask *task);
+protected:
+  WeftTask* find_task(WeftWorker *worker);
+  void discover_topology(void);
+  void pin_worker(WeftWorker *worker);
 public:
   static void* worker_loop(void *arg);
+  static void* kernel_loop(void *arg);
   static unsigned long long get_current_time_in_micros(void);
   static size_t get_memory_usage(void);
 protected:
@@ -249,18 +435,35 @@ protected:
   bool warnings;
   bool warp_synchronous;
   bool print_files;
+  bool parallel_kernels;
+  bool warp_frontiers;
+  WorkerAffinity affinity;
+  int race_granularity;
   std::vector<Program*> programs;
 protected:
   pthread_t *worker_threads;
+  WeftWorker *workers;
+  pthread_key_t worker_key;
   bool threadpool_finished;
+  // The processors of each memory node that workers may run on
+  std::vector<std::vector<int> > node_cpus;
 protected:
-  pthread_mutex_t count_lock;
-  pthread_cond_t count_cond;
-  unsigned int pending_count;
+  // Kernels verified concurrently report their output in file order
+  pthread_mutex_t kernel_lock;
+  pthread_cond_t kernel_cond;
+  std::vector<bool> finished_kernels;
+  unsigned flushed_kernels;
 protected:
+  // Tasks from threads outside the pool go in the shared queue of
+  // their memory node, tasks launched by workers go in their own 
+  // deques. Workers only sleep when no tasks are queued anywhere.
   pthread_mutex_t queue_lock;
   pthread_cond_t queue_cond;
-  std::deque<WeftTask*> queue;
+  std::vector<std::deque<WeftTask*> > node_queues;
+  unsigned next_node_queue;
+  int shared_tasks;
+  int queued_tasks;
+  int sleeping_workers;
 protected:
   unsigned long long parsing_time;
   size_t parsing_memory;